@@ -29,6 +29,7 @@
 #include <iostream>
 #include <iomanip>
 #include <exception>
+#include <stdexcept>
 #include <memory>
 
 //-----------------------------------------------------------------------------
@@ -172,7 +173,7 @@ const tchar* TokenIDToString(TOKEN_ID id);
 //-----------------------------------------------------------------------------
 // Take an input stream (given above) and print out the tokens
 //-----------------------------------------------------------------------------
-int main(int argc, tchar* argv[])
+int main(int, tchar*[])
 {
     Lex::Lexer<TOKEN_ID> lex;
     lex.define(TOKEN_COMMENT,    _T("//.*\\n"));
@@ -191,7 +192,8 @@ int main(int argc, tchar* argv[])
     try
     {
         MatchedTokenList matches;
-        lex.analyze(c_script, matches, ErrorHandler());
+        ErrorHandler onError;
+        lex.analyze(c_script, matches, onError);
 
         for (auto& token : matches.Tokens)
         {
@@ -261,7 +263,7 @@ const tchar* TokenIDToString(TOKEN_ID id)
     IDSTR(RBRACE)
     IDSTR(WHITESPACE)
     IDSTR(NEWLINE)
-    default: throw exception("Bad token ID.");
+    default: throw invalid_argument("Bad token ID.");
     }
 #undef IDSTR
 }
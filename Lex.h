@@ -29,6 +29,44 @@
 #define _LEX_H_
 
 #include <regex>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <cstdint>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <cwchar>
+#include <cstdlib>
+#include <cmath>
+#include <charconv>
+#include <system_error>
+
+// The vector kernels are compiled for each instruction set they use, and the
+// one to run is picked when the program starts (see SimdKernels())
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define LEX_X86 1
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   else
+#       include <immintrin.h>
+#       include <cpuid.h>
+#   endif
+#else
+#   define LEX_X86 0
+#endif
+#if LEX_X86 && (defined(__GNUC__) || defined(__clang__))
+#   define LEX_TARGET(isa) __attribute__((target(isa)))
+#else
+#   define LEX_TARGET(isa)
+#endif
 
 // To default Lex to Unicode or not, #define LEX_UNICODE as 0 or 1 before
 // including Lex.h. This is not mandatory, however, as you can still override
@@ -73,122 +111,6025 @@ struct Location
 #endif
 
 //-----------------------------------------------------------------------------
-// The Lexer is the main body of the Luthor library. It accepts three template
-// parameters that determine the inputs and outputs of the Lexer:
-//     _TokenID: A struct or class that identify matched tokens. Usually this
-//               would be an enum, but you could make it anything: pointer, 
-//               string, COM object... As long as your Match Handler can use it
-//               to identify a token.
-//     _String:  [OPTIONAL] A string class to use with the regex. Luthor has 
-//               been tested with std::string and std::wstring.
-//     _Regex:   [OPTIONAL] A regex class. Use std::regex or std::wregex.
+// NATIVE REGEX ENGINE
+//
+// std::regex is a backtracking engine with no guarantee of linear time, so
+// Luthor carries its own engine for the subset of regular expressions that
+// lexers actually need:
+//
+//      literals, '.', [classes], [^negated classes], \d \w \s \D \W \S,
+//      \t \n \r \f \v \0 \xHH \uHHHH, (groups), (?:groups), a|b,
+//      x*, x+, x?, x{n}, x{n,} and x{n,m}
+//
+// Anchors, back-references, lookaround and lazy quantifiers are rejected with
+// a RegexError. A match is always the longest prefix of the input that the
+// pattern accepts (maximal munch) rather than ECMAScript's "first alternative
+// that works"; for token definitions the two only differ when one alternative
+// is a prefix of a later one.
+//
+// Patterns of up to 64 positions are simulated bit-parallel over their
+// Glushkov automaton, larger ones with a Thompson NFA. Both run in time
+// linear in the length of the input. Select the engine with the _Regex
+// parameter of the Lexer:
+//
+//      Lex::Lexer<TokenID, std::string, Lex::Regex>
+//      Lex::Lexer<TokenID, std::wstring, Lex::WRegex>
+//      Lex::Lexer<TokenID, std::string, Lex::Utf8Regex>
+//
+// Lex::Utf8Regex reads patterns and input as UTF-8. '.', classes and 
+// literals match whole code points, which are compiled into byte-level 
+// transitions so that UTF-8 text is lexed as it is, without widening it.
+// Input that isn't valid UTF-8 matches no '.' or class, so it is reported
+// as an error. \d, \w and \s remain ASCII, as they are in std::regex. The
+// Lexer reports columns (Location::within_line) in code points.
 //-----------------------------------------------------------------------------
-template<
-    typename _TokenID, 
-    typename _String = default_string, 
-    typename _Regex = default_regex>
 
-class Lexer
-{
-public:
+//-----------------------------------------------------------------------------
+// Thrown when a pattern is malformed or uses a feature the native engine does
+// not support. It derives from std::regex_error so existing handlers for
+// std::regex keep working.
+//-----------------------------------------------------------------------------
+class RegexError : public std::regex_error
+{
+public:
+    RegexError(
+        std::regex_constants::error_type code, 
+        const char* message, 
+        size_t offset)
+        : std::regex_error(code)
+        , m_offset(offset)
+    {
+        m_message = std::string("Lex: ") + message + " at offset " + 
+            std::to_string(offset);
+    }
+
+    const char* what() const noexcept override
+    {
+        return m_message.c_str();
+    }
+
+    // Offset of the offending character within the pattern
+    size_t offset() const
+    {
+        return m_offset;
+    }
+
+private:
+    std::string m_message;
+    size_t m_offset;
+};
+
+//-----------------------------------------------------------------------------
+// A set of character codes, stored as sorted, disjoint, inclusive ranges.
+//-----------------------------------------------------------------------------
+class CharSet
+{
+public:
+    typedef std::pair<uint32_t, uint32_t> Range;
+
+    void add(uint32_t c)
+    {
+        add(c, c);
+    }
+
+    void add(uint32_t lo, uint32_t hi)
+    {
+        m_ranges.push_back(Range(lo, hi));
+        Normalize();
+    }
+
+    void add(const CharSet& other)
+    {
+        m_ranges.insert(
+            std::end(m_ranges), 
+            std::begin(other.m_ranges), 
+            std::end(other.m_ranges));
+        Normalize();
+    }
+
+    // Replace the set with every code in [0, maxCode] that it doesn't contain
+    void negate(uint32_t maxCode)
+    {
+        std::vector<Range> inverse;
+        uint32_t next = 0;
+        for (auto& range : m_ranges)
+        {
+            if (range.first > maxCode)
+                break;
+            if (range.first > next)
+                inverse.push_back(Range(next, range.first - 1));
+            next = range.second + 1;
+        }
+        if (next <= maxCode)
+            inverse.push_back(Range(next, maxCode));
+        m_ranges.swap(inverse);
+    }
+
+    bool contains(uint32_t c) const
+    {
+        auto it = std::upper_bound(
+            std::begin(m_ranges), 
+            std::end(m_ranges), 
+            Range(c, UINT32_MAX));
+        return it != std::begin(m_ranges) && (--it)->second >= c;
+    }
+
+    bool intersects(const CharSet& other) const
+    {
+        auto a = std::begin(m_ranges);
+        auto b = std::begin(other.m_ranges);
+        while (a != std::end(m_ranges) && b != std::end(other.m_ranges))
+        {
+            if (a->second < b->first)
+                ++a;
+            else if (b->second < a->first)
+                ++b;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    bool empty() const
+    {
+        return m_ranges.empty();
+    }
+
+    const std::vector<Range>& ranges() const
+    {
+        return m_ranges;
+    }
+
+    bool operator ==(const CharSet& other) const
+    {
+        return m_ranges == other.m_ranges;
+    }
+
+    bool operator !=(const CharSet& other) const
+    {
+        return m_ranges != other.m_ranges;
+    }
+
+private:
+
+    void Normalize()
+    {
+        std::sort(std::begin(m_ranges), std::end(m_ranges));
+        size_t out = 0;
+        for (size_t i = 1; i < m_ranges.size(); ++i)
+        {
+            if (m_ranges[i].first <= m_ranges[out].second + 1)
+            {
+                m_ranges[out].second = 
+                    std::max(m_ranges[out].second, m_ranges[i].second);
+            } else {
+                m_ranges[++out] = m_ranges[i];
+            }
+        }
+        if (!m_ranges.empty())
+            m_ranges.resize(out + 1);
+    }
+
+    std::vector<Range> m_ranges;
+};
+
+//-----------------------------------------------------------------------------
+// Converts a character of any width to its unsigned code.
+//-----------------------------------------------------------------------------
+template<typename _Char>
+inline uint32_t CharCode(_Char c)
+{
+    return static_cast<uint32_t>(
+        static_cast<typename std::make_unsigned<_Char>::type>(c));
+}
+
+//-----------------------------------------------------------------------------
+// The largest character code representable by _Char, capped to Unicode.
+//-----------------------------------------------------------------------------
+template<typename _Char>
+inline uint32_t MaxCharCode()
+{
+    typedef typename std::make_unsigned<_Char>::type _Unsigned;
+    return static_cast<uint32_t>(std::min<uint64_t>(
+        std::numeric_limits<_Unsigned>::max(), 
+        0x10FFFF));
+}
+
+//-----------------------------------------------------------------------------
+// A node of a parsed pattern. Concat and Alternate nodes have any number of
+// children; Repeat nodes have exactly one.
+//-----------------------------------------------------------------------------
+struct PatternNode
+{
+    enum Kind
+    {
+        Empty,
+        Chars,
+        Concat,
+        Alternate,
+        Repeat
+    };
+
+    static constexpr unsigned Unbounded = ~0u;
+
+    PatternNode(Kind type)
+        : Type(type)
+        , Min(1)
+        , Max(1)
+    {
+    }
+
+    Kind Type;
+    CharSet Set;
+    std::vector<size_t> Children;
+    unsigned Min;
+    unsigned Max;
+};
+
+//-----------------------------------------------------------------------------
+// The syntax tree of a pattern. Node 0 is always the root.
+//-----------------------------------------------------------------------------
+class Pattern
+{
+public:
+
+    // Longest {n,m} count accepted. Repeats are expanded when the automata
+    // are built, so this keeps a typo from producing a gigantic automaton.
+    static constexpr unsigned MaxRepeat = 1000;
+
+    Pattern()
+    {
+        m_nodes.push_back(PatternNode(PatternNode::Empty));
+    }
+
+    // Parse the pattern in [begin, end). If utf8 is set, the pattern is read
+    // as UTF-8 and its character sets, which then range over code points, are
+    // lowered to sequences of byte sets, so that it matches UTF-8 bytes.
+    template<typename _It>
+    Pattern(_It begin, _It end, uint32_t maxCode, bool utf8 = false)
+    {
+        m_nodes.push_back(PatternNode(PatternNode::Empty));
+        Parser<_It> parser(begin, end, utf8 ? MaxUnicode : maxCode, utf8, m_nodes);
+        m_nodes[0] = m_nodes[parser.parse()];
+        if (utf8)
+            LowerToUtf8();
+    }
+
+    const PatternNode& node(size_t index) const
+    {
+        return m_nodes[index];
+    }
+
+    const PatternNode& root() const
+    {
+        return m_nodes[0];
+    }
+
+private:
+
+    static constexpr uint32_t MaxUnicode = 0x10FFFF;
+
+    // Replace every set of code points with the alternation of the UTF-8
+    // byte sequences that encode them
+    void LowerToUtf8()
+    {
+        const size_t count = m_nodes.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (m_nodes[i].Type != PatternNode::Chars)
+                continue;
+
+            PatternNode alternate(PatternNode::Alternate);
+            PatternNode ascii(PatternNode::Chars);
+            const CharSet set = m_nodes[i].Set;
+            for (auto& range : set.ranges())
+            {
+                if (range.first < 0x80)
+                    ascii.Set.add(range.first, std::min<uint32_t>(range.second, 0x7F));
+                if (range.second < 0x80)
+                    continue;
+
+                // Surrogates have no UTF-8 encoding
+                uint32_t lo = std::max<uint32_t>(range.first, 0x80);
+                uint32_t hi = range.second;
+                if (lo < 0xD800)
+                    AddUtf8Range(lo, std::min<uint32_t>(hi, 0xD7FF), alternate);
+                if (hi > 0xDFFF)
+                    AddUtf8Range(std::max<uint32_t>(lo, 0xE000), hi, alternate);
+            }
+
+            if (alternate.Children.empty())
+            {
+                m_nodes[i].Set = ascii.Set;
+                continue;
+            }
+            if (!ascii.Set.empty())
+                alternate.Children.push_back(Add(ascii));
+            m_nodes[i] = alternate.Children.size() == 1 ? 
+                m_nodes[alternate.Children[0]] : 
+                alternate;
+        }
+    }
+
+    // Add the byte sequences for the code points [lo, hi], all of which need
+    // at least two bytes. The range is split until each piece is the product
+    // of one byte range per byte of its encoding.
+    void AddUtf8Range(uint32_t lo, uint32_t hi, PatternNode& alternate)
+    {
+        if (lo > hi)
+            return;
+
+        static const uint32_t lengthLimits[] = { 0x7FF, 0xFFFF };
+        for (uint32_t limit : lengthLimits)
+        {
+            if (lo <= limit && hi > limit)
+            {
+                AddUtf8Range(lo, limit, alternate);
+                AddUtf8Range(limit + 1, hi, alternate);
+                return;
+            }
+        }
+
+        for (unsigned bits = 6; bits < 24; bits += 6)
+        {
+            uint32_t mask = (1u << bits) - 1;
+            if ((lo & ~mask) == (hi & ~mask))
+                continue;
+            if ((lo & mask) != 0)
+            {
+                AddUtf8Range(lo, lo | mask, alternate);
+                AddUtf8Range((lo | mask) + 1, hi, alternate);
+                return;
+            }
+            if ((hi & mask) != mask)
+            {
+                AddUtf8Range(lo, (hi & ~mask) - 1, alternate);
+                AddUtf8Range(hi & ~mask, hi, alternate);
+                return;
+            }
+        }
+
+        uint8_t first[4];
+        uint8_t last[4];
+        size_t length = EncodeUtf8(lo, first);
+        EncodeUtf8(hi, last);
+
+        PatternNode concat(PatternNode::Concat);
+        for (size_t i = 0; i < length; ++i)
+        {
+            PatternNode bytes(PatternNode::Chars);
+            bytes.Set.add(first[i], last[i]);
+            concat.Children.push_back(Add(bytes));
+        }
+        alternate.Children.push_back(Add(concat));
+    }
+
+    static size_t EncodeUtf8(uint32_t c, uint8_t* out)
+    {
+        if (c < 0x80)
+        {
+            out[0] = static_cast<uint8_t>(c);
+            return 1;
+        }
+        if (c < 0x800)
+        {
+            out[0] = static_cast<uint8_t>(0xC0 | (c >> 6));
+            out[1] = static_cast<uint8_t>(0x80 | (c & 0x3F));
+            return 2;
+        }
+        if (c < 0x10000)
+        {
+            out[0] = static_cast<uint8_t>(0xE0 | (c >> 12));
+            out[1] = static_cast<uint8_t>(0x80 | ((c >> 6) & 0x3F));
+            out[2] = static_cast<uint8_t>(0x80 | (c & 0x3F));
+            return 3;
+        }
+        out[0] = static_cast<uint8_t>(0xF0 | (c >> 18));
+        out[1] = static_cast<uint8_t>(0x80 | ((c >> 12) & 0x3F));
+        out[2] = static_cast<uint8_t>(0x80 | ((c >> 6) & 0x3F));
+        out[3] = static_cast<uint8_t>(0x80 | (c & 0x3F));
+        return 4;
+    }
+
+    size_t Add(const PatternNode& node)
+    {
+        m_nodes.push_back(node);
+        return m_nodes.size() - 1;
+    }
+
+    template<typename _It>
+    class Parser
+    {
+    public:
+
+        Parser(
+            _It begin, 
+            _It end, 
+            uint32_t maxCode, 
+            bool utf8,
+            std::vector<PatternNode>& nodes)
+            : m_begin(begin)
+            , m_cursor(begin)
+            , m_end(end)
+            , m_maxCode(maxCode)
+            , m_utf8(utf8)
+            , m_depth(0)
+            , m_nodes(nodes)
+        {
+        }
+
+        size_t parse()
+        {
+            size_t root = ParseAlternate();
+            if (m_cursor != m_end)
+                Fail(std::regex_constants::error_paren, "unmatched ')'");
+            return root;
+        }
+
+    private:
+
+        static constexpr unsigned MaxDepth = 256;
+
+        size_t ParseAlternate()
+        {
+            size_t first = ParseConcat();
+            if (!Peek('|'))
+                return first;
+
+            size_t alternate = Add(PatternNode(PatternNode::Alternate));
+            m_nodes[alternate].Children.push_back(first);
+            while (Peek('|'))
+            {
+                ++m_cursor;
+                size_t next = ParseConcat();
+                m_nodes[alternate].Children.push_back(next);
+            }
+            return alternate;
+        }
+
+        size_t ParseConcat()
+        {
+            PatternNode concat(PatternNode::Concat);
+            while (m_cursor != m_end && !Peek('|') && !Peek(')'))
+                concat.Children.push_back(ParseRepeat());
+
+            if (concat.Children.empty())
+                return Add(PatternNode(PatternNode::Empty));
+            if (concat.Children.size() == 1)
+                return concat.Children[0];
+            return Add(concat);
+        }
+
+        size_t ParseRepeat()
+        {
+            size_t atom = ParseAtom();
+            while (m_cursor != m_end)
+            {
+                PatternNode repeat(PatternNode::Repeat);
+                switch (Code(*m_cursor))
+                {
+                case '*': repeat.Min = 0; repeat.Max = PatternNode::Unbounded; break;
+                case '+': repeat.Min = 1; repeat.Max = PatternNode::Unbounded; break;
+                case '?': repeat.Min = 0; repeat.Max = 1; break;
+                case '{': break;
+                default: return atom;
+                }
+
+                if (Code(*m_cursor) == '{')
+                    ParseBounds(repeat.Min, repeat.Max);
+                else
+                    ++m_cursor;
+
+                if (Peek('?'))
+                {
+                    Fail(std::regex_constants::error_badrepeat, 
+                        "lazy quantifiers are not supported");
+                }
+
+                repeat.Children.push_back(atom);
+                atom = Add(repeat);
+            }
+            return atom;
+        }
+
+        void ParseBounds(unsigned& min, unsigned& max)
+        {
+            ++m_cursor;
+            min = ParseCount();
+            max = min;
+            if (Peek(','))
+            {
+                ++m_cursor;
+                max = Peek('}') ? PatternNode::Unbounded : ParseCount();
+            }
+            if (!Peek('}'))
+                Fail(std::regex_constants::error_brace, "missing '}'");
+            ++m_cursor;
+            if (max < min)
+                Fail(std::regex_constants::error_badbrace, "bad repeat range");
+        }
+
+        unsigned ParseCount()
+        {
+            if (m_cursor == m_end || !IsDigit(Code(*m_cursor)))
+                Fail(std::regex_constants::error_badbrace, "expected a count");
+
+            unsigned count = 0;
+            while (m_cursor != m_end && IsDigit(Code(*m_cursor)))
+            {
+                count = count * 10 + (Code(*m_cursor) - '0');
+                if (count > MaxRepeat)
+                {
+                    Fail(std::regex_constants::error_complexity, 
+                        "repeat count too large");
+                }
+                ++m_cursor;
+            }
+            return count;
+        }
+
+        size_t ParseAtom()
+        {
+            PatternNode chars(PatternNode::Chars);
+            uint32_t c = Next();
+            switch (c)
+            {
+            case '(':
+            {
+                if (Peek('?'))
+                {
+                    ++m_cursor;
+                    if (!Peek(':'))
+                    {
+                        Fail(std::regex_constants::error_paren, 
+                            "only (?: groups are supported");
+                    }
+                    ++m_cursor;
+                }
+                if (++m_depth > MaxDepth)
+                    Fail(std::regex_constants::error_stack, "nested too deeply");
+                size_t group = ParseAlternate();
+                --m_depth;
+                if (!Peek(')'))
+                    Fail(std::regex_constants::error_paren, "missing ')'");
+                ++m_cursor;
+                return group;
+            }
+            case '[':
+                chars.Set = ParseClass();
+                break;
+            case '.':
+                chars.Set.add('\n');
+                chars.Set.add('\r');
+                if (m_maxCode >= 0x2029)
+                    chars.Set.add(0x2028, 0x2029);
+                chars.Set.negate(m_maxCode);
+                break;
+            case '\\':
+            {
+                bool isClass;
+                chars.Set = ParseEscape(false, isClass);
+                break;
+            }
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                Fail(std::regex_constants::error_badrepeat, "nothing to repeat");
+            case '^':
+            case '$':
+                Fail(std::regex_constants::error_complexity, 
+                    "anchors are not supported");
+            default:
+                chars.Set.add(c);
+                break;
+            }
+            return Add(chars);
+        }
+
+        CharSet ParseClass()
+        {
+            CharSet set;
+            bool negated = Peek('^');
+            if (negated)
+                ++m_cursor;
+
+            while (!Peek(']'))
+            {
+                if (m_cursor == m_end)
+                    Fail(std::regex_constants::error_brack, "missing ']'");
+
+                bool isClass = false;
+                CharSet item = ParseClassAtom(isClass);
+                if (isClass || !Peek('-'))
+                {
+                    set.add(item);
+                    continue;
+                }
+
+                // A '-' right before the ']' is a literal
+                _It dash = m_cursor;
+                ++m_cursor;
+                if (Peek(']'))
+                {
+                    m_cursor = dash;
+                    set.add(item);
+                    continue;
+                }
+                if (m_cursor == m_end)
+                    Fail(std::regex_constants::error_brack, "missing ']'");
+
+                CharSet upper = ParseClassAtom(isClass);
+                if (isClass)
+                    Fail(std::regex_constants::error_range, "bad class range");
+
+                uint32_t lo = item.ranges()[0].first;
+                uint32_t hi = upper.ranges()[0].first;
+                if (lo > hi)
+                    Fail(std::regex_constants::error_range, "bad class range");
+                set.add(lo, hi);
+            }
+            ++m_cursor;
+
+            if (negated)
+                set.negate(m_maxCode);
+            return set;
+        }
+
+        CharSet ParseClassAtom(bool& isClass)
+        {
+            uint32_t c = Next();
+            if (c == '\\')
+                return ParseEscape(true, isClass);
+
+            CharSet set;
+            set.add(c);
+            isClass = false;
+            return set;
+        }
+
+        CharSet ParseEscape(bool inClass, bool& isClass)
+        {
+            if (m_cursor == m_end)
+                Fail(std::regex_constants::error_escape, "trailing '\\'");
+
+            CharSet set;
+            isClass = true;
+            uint32_t c = Next();
+            switch (c)
+            {
+            case 'd': 
+            case 'D':
+                set.add('0', '9');
+                break;
+            case 'w': 
+            case 'W':
+                set.add('a', 'z');
+                set.add('A', 'Z');
+                set.add('0', '9');
+                set.add('_');
+                break;
+            case 's': 
+            case 'S':
+                set.add('\t', '\r');
+                set.add(' ');
+                break;
+            default:
+                isClass = false;
+                set.add(ParseEscapedChar(c, inClass));
+                return set;
+            }
+
+            if (c == 'D' || c == 'W' || c == 'S')
+                set.negate(m_maxCode);
+            return set;
+        }
+
+        uint32_t ParseEscapedChar(uint32_t c, bool inClass)
+        {
+            switch (c)
+            {
+            case 't': return '\t';
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            case '0': return 0;
+            case 'x': return ParseHex(2);
+            case 'u': return ParseHex(4);
+            case 'b':
+                if (inClass)
+                    return '\b';
+                Fail(std::regex_constants::error_escape, 
+                    "word boundaries are not supported");
+            default:
+                break;
+            }
+
+            if (IsDigit(c))
+            {
+                Fail(std::regex_constants::error_backref, 
+                    "back-references are not supported");
+            }
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+                Fail(std::regex_constants::error_escape, "unknown escape");
+            return c;
+        }
+
+        uint32_t ParseHex(int digits)
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < digits; ++i)
+            {
+                if (m_cursor == m_end)
+                    Fail(std::regex_constants::error_escape, "bad hex escape");
+
+                uint32_t c = Code(*m_cursor);
+                ++m_cursor;
+                if (IsDigit(c))
+                    value = value * 16 + (c - '0');
+                else if (c >= 'a' && c <= 'f')
+                    value = value * 16 + (c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F')
+                    value = value * 16 + (c - 'A' + 10);
+                else
+                    Fail(std::regex_constants::error_escape, "bad hex escape");
+            }
+            if (value > m_maxCode)
+                Fail(std::regex_constants::error_range, "character out of range");
+            return value;
+        }
+
+        // Read one character of the pattern, decoding it if it is UTF-8
+        uint32_t Next()
+        {
+            uint32_t c = Code(*m_cursor);
+            ++m_cursor;
+            if (!m_utf8 || c < 0x80)
+                return c;
+
+            size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+            if (length == 0 || c > 0xF4)
+                Fail(std::regex_constants::error_collate, "invalid UTF-8");
+
+            static const uint32_t smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+            uint32_t code = c & (0x7F >> length);
+            for (size_t i = 1; i < length; ++i)
+            {
+                if (m_cursor == m_end || (Code(*m_cursor) & 0xC0) != 0x80)
+                    Fail(std::regex_constants::error_collate, "invalid UTF-8");
+                code = (code << 6) | (Code(*m_cursor) & 0x3F);
+                ++m_cursor;
+            }
+            if (code < smallest[length] || code > MaxUnicode || 
+                (code >= 0xD800 && code <= 0xDFFF))
+            {
+                Fail(std::regex_constants::error_collate, "invalid UTF-8");
+            }
+            return code;
+        }
+
+        bool Peek(char c) const
+        {
+            return m_cursor != m_end && Code(*m_cursor) == (uint32_t)c;
+        }
+
+        static bool IsDigit(uint32_t c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        static uint32_t Code(
+            typename std::iterator_traits<_It>::value_type c)
+        {
+            return CharCode(c);
+        }
+
+        size_t Add(const PatternNode& node)
+        {
+            m_nodes.push_back(node);
+            return m_nodes.size() - 1;
+        }
+
+        [[noreturn]] void Fail(
+            std::regex_constants::error_type code, 
+            const char* message)
+        {
+            throw RegexError(code, message, std::distance(m_begin, m_cursor));
+        }
+
+        _It m_begin;
+        _It m_cursor;
+        _It m_end;
+        uint32_t m_maxCode;
+        bool m_utf8;
+        unsigned m_depth;
+        std::vector<PatternNode>& m_nodes;
+    };
+
+    std::vector<PatternNode> m_nodes;
+};
+
+//-----------------------------------------------------------------------------
+// The Glushkov (position) automaton of a pattern: one state per occurrence of
+// a character set in the pattern, and no epsilon transitions. A position is
+// entered by reading a character from its set.
+//     Chars:    The set each position reads.
+//     Follow:   The positions that may come straight after each position.
+//     First:    The positions that may start a match.
+//     Last:     The positions that may end a match.
+//     Nullable: Whether the pattern matches the empty string.
+//     Repeated: The pairs of positions that the pattern lets one follow the
+//               other in more than one way, like a and a in (a+)+.
+//-----------------------------------------------------------------------------
+struct GlushkovNfa
+{
+    // Patterns are refused beyond this many positions
+    static constexpr size_t MaxPositions = 1 << 16;
+
+    GlushkovNfa()
+        : Nullable(true)
+    {
+    }
+
+    explicit GlushkovNfa(const Pattern& pattern)
+    {
+        Fragment f = Build(pattern, pattern.root());
+        First.swap(f.First);
+        Last.swap(f.Last);
+        Nullable = f.Nullable;
+
+        for (uint32_t p = 0; p < Follow.size(); ++p)
+        {
+            auto& follow = Follow[p];
+            std::sort(std::begin(follow), std::end(follow));
+            for (size_t i = 1; i < follow.size(); ++i)
+            {
+                if (follow[i] == follow[i - 1] && 
+                    (i < 2 || follow[i] != follow[i - 2]))
+                    Repeated.push_back(std::make_pair(p, follow[i]));
+            }
+            follow.erase(
+                std::unique(std::begin(follow), std::end(follow)), 
+                std::end(follow));
+        }
+    }
+
+    size_t size() const
+    {
+        return Chars.size();
+    }
+
+    std::vector<CharSet> Chars;
+    std::vector<std::vector<uint32_t> > Follow;
+    std::vector<uint32_t> First;
+    std::vector<uint32_t> Last;
+    bool Nullable;
+    std::vector<std::pair<uint32_t, uint32_t> > Repeated;
+
+private:
+
+    struct Fragment
+    {
+        Fragment()
+            : Nullable(true)
+        {
+        }
+
+        std::vector<uint32_t> First;
+        std::vector<uint32_t> Last;
+        bool Nullable;
+    };
+
+    Fragment Build(const Pattern& pattern, const PatternNode& node)
+    {
+        Fragment f;
+        switch (node.Type)
+        {
+        case PatternNode::Empty:
+            break;
+
+        case PatternNode::Chars:
+        {
+            if (Chars.size() >= MaxPositions)
+            {
+                throw RegexError(std::regex_constants::error_complexity, 
+                    "pattern too large", 0);
+            }
+            uint32_t position = static_cast<uint32_t>(Chars.size());
+            Chars.push_back(node.Set);
+            Follow.push_back(std::vector<uint32_t>());
+            f.First.push_back(position);
+            f.Last.push_back(position);
+            f.Nullable = false;
+            break;
+        }
+
+        case PatternNode::Concat:
+            for (size_t child : node.Children)
+                f = Concatenate(f, Build(pattern, pattern.node(child)));
+            break;
+
+        case PatternNode::Alternate:
+            f.Nullable = false;
+            for (size_t child : node.Children)
+            {
+                Fragment option = Build(pattern, pattern.node(child));
+                Append(f.First, option.First);
+                Append(f.Last, option.Last);
+                f.Nullable |= option.Nullable;
+            }
+            break;
+
+        case PatternNode::Repeat:
+        {
+            const PatternNode& child = pattern.node(node.Children[0]);
+            bool unbounded = node.Max == PatternNode::Unbounded;
+
+            // x{n,} is x{n-1} followed by x+, and x{n,m} is x{n} followed by 
+            // m-n copies of x?
+            unsigned fixed = unbounded && node.Min > 0 ? node.Min - 1 : node.Min;
+            for (unsigned i = 0; i < fixed; ++i)
+                f = Concatenate(f, Build(pattern, child));
+
+            if (unbounded)
+            {
+                Fragment loop = Build(pattern, child);
+                for (uint32_t p : loop.Last)
+                    Append(Follow[p], loop.First);
+                loop.Nullable |= node.Min == 0;
+                f = Concatenate(f, loop);
+            } else {
+                for (unsigned i = node.Min; i < node.Max; ++i)
+                {
+                    Fragment option = Build(pattern, child);
+                    option.Nullable = true;
+                    f = Concatenate(f, option);
+                }
+            }
+            break;
+        }
+        }
+        return f;
+    }
+
+    Fragment Concatenate(Fragment& a, const Fragment& b)
+    {
+        for (uint32_t p : a.Last)
+            Append(Follow[p], b.First);
+
+        Fragment f;
+        f.First.swap(a.First);
+        if (a.Nullable)
+            Append(f.First, b.First);
+        f.Last = b.Last;
+        if (b.Nullable)
+            Append(f.Last, a.Last);
+        f.Nullable = a.Nullable && b.Nullable;
+        return f;
+    }
+
+    static void Append(std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+    {
+        a.insert(std::end(a), std::begin(b), std::end(b));
+    }
+};
+
+//-----------------------------------------------------------------------------
+// A Thompson NFA, simulated breadth-first so that every input character is 
+// read exactly once. Used for patterns too large for bit-parallel matching.
+//-----------------------------------------------------------------------------
+class ThompsonNfa
+{
+public:
+
+    ThompsonNfa()
+        : m_start(NoState)
+    {
+    }
+
+    explicit ThompsonNfa(const Pattern& pattern)
+    {
+        Fragment f = Build(pattern, pattern.root());
+        uint32_t match = Add(State::Match, NoState, NoState);
+        Patch(f, match);
+        m_start = f.Start;
+    }
+
+    // Find the longest non-empty match that begins at start
+    template<typename _It>
+    bool match(_It start, _It end, _It& matchEnd) const
+    {
+        if (m_start == NoState)
+            return false;
+
+        std::vector<uint32_t> current;
+        std::vector<uint32_t> next;
+        std::vector<uint32_t> stack;
+        std::vector<uint32_t> marks(m_states.size(), 0);
+        uint32_t generation = 1;
+
+        AddClosure(m_start, current, stack, marks, generation);
+
+        bool found = false;
+        for (_It cursor = start; cursor != end && !current.empty(); )
+        {
+            uint32_t c = CharCode(*cursor);
+            ++cursor;
+            ++generation;
+            next.clear();
+
+            bool accept = false;
+            for (uint32_t s : current)
+            {
+                if (m_sets[m_states[s].Set].contains(c))
+                {
+                    accept |= AddClosure(
+                        m_states[s].Out, next, stack, marks, generation);
+                }
+            }
+            current.swap(next);
+
+            if (accept)
+            {
+                matchEnd = cursor;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+private:
+
+    static constexpr uint32_t NoState = ~0u;
+
+    struct State
+    {
+        enum Kind
+        {
+            Chars,
+            Split,
+            Match
+        };
+
+        Kind Type;
+        uint32_t Set;
+        uint32_t Out;
+        uint32_t Out1;
+    };
+
+    struct Fragment
+    {
+        uint32_t Start;
+        std::vector<std::pair<uint32_t, bool> > Dangling;
+    };
+
+    // Follow the epsilon transitions from state s, adding the character-
+    // reading states reached to the list. Returns true if Match was reached.
+    bool AddClosure(
+        uint32_t s,
+        std::vector<uint32_t>& list,
+        std::vector<uint32_t>& stack,
+        std::vector<uint32_t>& marks,
+        uint32_t generation) const
+    {
+        bool matched = false;
+        stack.push_back(s);
+        while (!stack.empty())
+        {
+            s = stack.back();
+            stack.pop_back();
+            if (s == NoState || marks[s] == generation)
+                continue;
+            marks[s] = generation;
+
+            const State& state = m_states[s];
+            switch (state.Type)
+            {
+            case State::Chars:
+                list.push_back(s);
+                break;
+            case State::Split:
+                stack.push_back(state.Out1);
+                stack.push_back(state.Out);
+                break;
+            case State::Match:
+                matched = true;
+                break;
+            }
+        }
+        return matched;
+    }
+
+    uint32_t Add(typename State::Kind type, uint32_t out, uint32_t out1)
+    {
+        State state;
+        state.Type = type;
+        state.Set = 0;
+        state.Out = out;
+        state.Out1 = out1;
+        m_states.push_back(state);
+        return static_cast<uint32_t>(m_states.size() - 1);
+    }
+
+    void Patch(const Fragment& f, uint32_t target)
+    {
+        for (auto& dangling : f.Dangling)
+        {
+            State& state = m_states[dangling.first];
+            (dangling.second ? state.Out1 : state.Out) = target;
+        }
+    }
+
+    Fragment Empty()
+    {
+        Fragment f;
+        f.Start = Add(State::Split, NoState, NoState);
+        f.Dangling.push_back(std::make_pair(f.Start, false));
+        return f;
+    }
+
+    Fragment Concatenate(const Fragment& a, const Fragment& b)
+    {
+        Patch(a, b.Start);
+        Fragment f;
+        f.Start = a.Start;
+        f.Dangling = b.Dangling;
+        return f;
+    }
+
+    // x* when optional is true, otherwise x+
+    Fragment Loop(const Fragment& x, bool optional)
+    {
+        uint32_t split = Add(State::Split, x.Start, NoState);
+        Patch(x, split);
+        Fragment f;
+        f.Start = optional ? split : x.Start;
+        f.Dangling.push_back(std::make_pair(split, true));
+        return f;
+    }
+
+    Fragment Optional(const Fragment& x)
+    {
+        uint32_t split = Add(State::Split, x.Start, NoState);
+        Fragment f;
+        f.Start = split;
+        f.Dangling = x.Dangling;
+        f.Dangling.push_back(std::make_pair(split, true));
+        return f;
+    }
+
+    Fragment Build(const Pattern& pattern, const PatternNode& node)
+    {
+        switch (node.Type)
+        {
+        case PatternNode::Chars:
+        {
+            Fragment f;
+            f.Start = Add(State::Chars, NoState, NoState);
+            m_states[f.Start].Set = static_cast<uint32_t>(m_sets.size());
+            m_sets.push_back(node.Set);
+            f.Dangling.push_back(std::make_pair(f.Start, false));
+            return f;
+        }
+
+        case PatternNode::Concat:
+        {
+            Fragment f = Build(pattern, pattern.node(node.Children[0]));
+            for (size_t i = 1; i < node.Children.size(); ++i)
+                f = Concatenate(f, Build(pattern, pattern.node(node.Children[i])));
+            return f;
+        }
+
+        case PatternNode::Alternate:
+        {
+            Fragment f = Build(pattern, pattern.node(node.Children.back()));
+            for (size_t i = node.Children.size() - 1; i-- > 0; )
+            {
+                Fragment option = Build(pattern, pattern.node(node.Children[i]));
+                uint32_t split = Add(State::Split, option.Start, f.Start);
+                f.Start = split;
+                f.Dangling.insert(
+                    std::end(f.Dangling), 
+                    std::begin(option.Dangling), 
+                    std::end(option.Dangling));
+            }
+            return f;
+        }
+
+        case PatternNode::Repeat:
+        {
+            const PatternNode& child = pattern.node(node.Children[0]);
+            bool unbounded = node.Max == PatternNode::Unbounded;
+            unsigned fixed = unbounded && node.Min > 0 ? node.Min - 1 : node.Min;
+
+            Fragment f = Empty();
+            for (unsigned i = 0; i < fixed; ++i)
+                f = Concatenate(f, Build(pattern, child));
+
+            if (unbounded)
+                return Concatenate(f, Loop(Build(pattern, child), node.Min == 0));
+
+            for (unsigned i = node.Min; i < node.Max; ++i)
+                f = Concatenate(f, Optional(Build(pattern, child)));
+            return f;
+        }
+
+        case PatternNode::Empty:
+        default:
+            return Empty();
+        }
+    }
+
+    std::vector<State> m_states;
+    std::vector<CharSet> m_sets;
+    uint32_t m_start;
+};
+
+//-----------------------------------------------------------------------------
+// Luthor's native regex. Compiles the pattern once and then matches prefixes
+// of the input in linear time (see NATIVE REGEX ENGINE above). With _Utf8 
+// set, both the pattern and the input are UTF-8: character sets range over
+// code points and are matched a byte at a time.
+//-----------------------------------------------------------------------------
+template<typename _Char, bool _Utf8 = false>
+class BasicRegex
+{
+public:
+    typedef _Char value_type;
+
+    static_assert(!_Utf8 || sizeof(_Char) == 1, "UTF-8 needs a byte-sized _Char");
+
+    // Patterns with up to this many positions are matched bit-parallel
+    static constexpr size_t MaxBitParallel = 64;
+
+    BasicRegex()
+        : m_firstMask(0)
+        , m_lastMask(0)
+    {
+    }
+
+    template<typename _It>
+    BasicRegex(_It begin, _It end)
+        : m_pattern(begin, end, MaxCharCode<_Char>(), _Utf8)
+        , m_glushkov(m_pattern)
+        , m_firstMask(0)
+        , m_lastMask(0)
+    {
+        if (m_glushkov.size() <= MaxBitParallel)
+            BuildMasks();
+        else
+            m_thompson = ThompsonNfa(m_pattern);
+    }
+
+    BasicRegex(const std::basic_string<_Char>& pattern)
+        : BasicRegex(std::begin(pattern), std::end(pattern))
+    {
+    }
+
+    BasicRegex(const _Char* pattern)
+        : BasicRegex(pattern, pattern + std::char_traits<_Char>::length(pattern))
+    {
+    }
+
+    // Find the longest non-empty match that begins at start. Returns false
+    // if there isn't one, otherwise sets matchEnd to the end of the match.
+    template<typename _It>
+    bool match(_It start, _It end, _It& matchEnd) const
+    {
+        if (m_glushkov.size() > MaxBitParallel)
+            return m_thompson.match(start, end, matchEnd);
+
+        if (start == end)
+            return false;
+
+        bool found = false;
+        _It cursor = start;
+        uint64_t state = m_firstMask & CharMask(CharCode(*cursor));
+        while (state)
+        {
+            ++cursor;
+            if (state & m_lastMask)
+            {
+                matchEnd = cursor;
+                found = true;
+            }
+            if (cursor == end)
+                break;
+            state = FollowMask(state) & CharMask(CharCode(*cursor));
+        }
+        return found;
+    }
+
+    const Pattern& pattern() const
+    {
+        return m_pattern;
+    }
+
+    const GlushkovNfa& automaton() const
+    {
+        return m_glushkov;
+    }
+
+private:
+
+    typedef std::pair<CharSet::Range, uint64_t> HighMask;
+
+    uint64_t CharMask(uint32_t c) const
+    {
+        if (c < 256)
+            return m_lowMasks[c];
+
+        auto it = std::upper_bound(
+            std::begin(m_highMasks), 
+            std::end(m_highMasks), 
+            HighMask(CharSet::Range(c, UINT32_MAX), UINT64_MAX));
+        if (it == std::begin(m_highMasks) || (--it)->first.second < c)
+            return 0;
+        return it->second;
+    }
+
+    // The union of the follow sets of every position in state, looked up a
+    // byte of the state at a time
+    uint64_t FollowMask(uint64_t state) const
+    {
+        uint64_t next = 0;
+        for (const uint64_t* table = m_followTable.data(); 
+             state; 
+             state >>= 8, table += 256)
+        {
+            next |= table[state & 0xFF];
+        }
+        return next;
+    }
+
+    void BuildMasks()
+    {
+        const size_t positions = m_glushkov.size();
+        std::vector<uint64_t> follow(positions, 0);
+        std::vector<uint32_t> boundaries;
+
+        m_lowMasks.assign(256, 0);
+        for (size_t p = 0; p < positions; ++p)
+        {
+            for (auto& range : m_glushkov.Chars[p].ranges())
+            {
+                for (uint32_t c = range.first; c <= range.second && c < 256; ++c)
+                    m_lowMasks[c] |= 1ull << p;
+                if (range.second >= 256)
+                {
+                    boundaries.push_back(std::max<uint32_t>(range.first, 256));
+                    boundaries.push_back(range.second + 1);
+                }
+            }
+            for (uint32_t q : m_glushkov.Follow[p])
+                follow[p] |= 1ull << q;
+        }
+
+        // Characters beyond the low table are grouped into intervals that 
+        // every position either fully contains or doesn't touch
+        std::sort(std::begin(boundaries), std::end(boundaries));
+        boundaries.erase(
+            std::unique(std::begin(boundaries), std::end(boundaries)), 
+            std::end(boundaries));
+        for (size_t i = 0; i + 1 < boundaries.size(); ++i)
+        {
+            uint64_t mask = 0;
+            for (size_t p = 0; p < positions; ++p)
+            {
+                if (m_glushkov.Chars[p].contains(boundaries[i]))
+                    mask |= 1ull << p;
+            }
+            if (mask)
+            {
+                m_highMasks.push_back(HighMask(
+                    CharSet::Range(boundaries[i], boundaries[i + 1] - 1), 
+                    mask));
+            }
+        }
+
+        size_t chunks = (positions + 7) / 8;
+        m_followTable.assign(chunks * 256, 0);
+        for (size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            uint64_t* table = &m_followTable[chunk * 256];
+            for (unsigned byte = 1; byte < 256; ++byte)
+            {
+                unsigned bit = 0;
+                while (!(byte & (1u << bit)))
+                    ++bit;
+                size_t p = chunk * 8 + bit;
+                table[byte] = table[byte & (byte - 1)] | 
+                    (p < positions ? follow[p] : 0);
+            }
+        }
+
+        for (uint32_t p : m_glushkov.First)
+            m_firstMask |= 1ull << p;
+        for (uint32_t p : m_glushkov.Last)
+            m_lastMask |= 1ull << p;
+    }
+
+    Pattern m_pattern;
+    GlushkovNfa m_glushkov;
+    ThompsonNfa m_thompson;
+    std::vector<uint64_t> m_lowMasks;
+    std::vector<HighMask> m_highMasks;
+    std::vector<uint64_t> m_followTable;
+    uint64_t m_firstMask;
+    uint64_t m_lastMask;
+};
+
+typedef BasicRegex<char> Regex;
+typedef BasicRegex<wchar_t> WRegex;
+typedef BasicRegex<char, true> Utf8Regex;
+
+//-----------------------------------------------------------------------------
+// RegexTraits adapts a regex class to the Lexer. The default works for 
+// std::basic_regex (and anything with the same interface):
+//     compile: Build the regex for a token definition.
+//     match:   Find a non-empty match that begins at start. On success, set
+//              matchEnd to the end of the match and return true. results 
+//              is scratch space that the Lexer keeps between calls.
+//     Native:  True if the regex exposes its automaton(), letting the Lexer
+//              combine every definition into one DFA.
+//     Utf8:    True if the input is UTF-8, so that the Lexer reports columns
+//              in code points rather than code units.
+//-----------------------------------------------------------------------------
+template<typename _Regex>
+struct RegexTraits
+{
+    static constexpr bool Native = false;
+    static constexpr bool Utf8 = false;
+
+    template<typename _String>
+    static _Regex compile(const _String& pattern)
+    {
+        return _Regex(pattern, std::regex_constants::optimize);
+    }
+
+    template<typename _It, typename _Alloc>
+    static bool match(
+        const _Regex& expr, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        std::match_results<_It, _Alloc>& results)
+    {
+        if (!std::regex_search(start, end, results, expr,
+            std::regex_constants::match_continuous |
+            std::regex_constants::match_not_null |
+            std::regex_constants::format_no_copy |
+            std::regex_constants::format_first_only))
+        {
+            return false;
+        }
+
+        matchEnd = start + results.length(0);
+        return true;
+    }
+};
+
+template<typename _Char, bool _Utf8>
+struct RegexTraits<BasicRegex<_Char, _Utf8> >
+{
+    static constexpr bool Native = true;
+    static constexpr bool Utf8 = _Utf8;
+
+    template<typename _String>
+    static BasicRegex<_Char, _Utf8> compile(const _String& pattern)
+    {
+        return BasicRegex<_Char, _Utf8>(std::begin(pattern), std::end(pattern));
+    }
+
+    template<typename _It, typename _Alloc>
+    static bool match(
+        const BasicRegex<_Char, _Utf8>& expr, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        std::match_results<_It, _Alloc>&)
+    {
+        return expr.match(start, end, matchEnd);
+    }
+};
+
+//-----------------------------------------------------------------------------
+// Hashes a sorted set of automaton positions.
+//-----------------------------------------------------------------------------
+struct PositionSetHash
+{
+    template<typename _Set>
+    size_t operator ()(const _Set& set) const
+    {
+        size_t hash = set.size();
+        for (uint32_t p : set)
+            hash = hash * 0x9E3779B1u + p;
+        return hash;
+    }
+};
+
+//-----------------------------------------------------------------------------
+// A Program is the union of the Glushkov automata of every token definition
+// in a Lexer, so that one pass over the input can find the winning token.
+// Position 0 is a virtual start position that every definition's first
+// positions follow; every other position p belongs to definition Owner[p].
+//
+// The Lexer picks the first definition (in order of definition) that matches
+// a non-empty prefix of the input, and takes that definition's longest match.
+// Program keeps that rule by reporting, for a set of positions, the earliest
+// definition that accepts (accepts()) and the earliest definition that could
+// still accept further on (live()).
+//-----------------------------------------------------------------------------
+class Program
+{
+public:
+    static constexpr uint32_t NoToken = ~0u;
+
+    Program()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        m_chars.assign(1, CharSet());
+        m_follow.assign(1, std::vector<uint32_t>());
+        m_owner.assign(1, NoToken);
+        m_last.assign(1, 0);
+        m_definitions = 0;
+        m_intervalStarts.clear();
+        m_intervalClasses.clear();
+        m_representatives.clear();
+        m_lowClasses.clear();
+    }
+
+    // Append the automaton of the next definition
+    void add(const GlushkovNfa& nfa)
+    {
+        const uint32_t base = static_cast<uint32_t>(m_chars.size());
+        for (size_t p = 0; p < nfa.size(); ++p)
+        {
+            m_chars.push_back(nfa.Chars[p]);
+            m_follow.push_back(nfa.Follow[p]);
+            for (auto& q : m_follow.back())
+                q += base;
+            m_owner.push_back(static_cast<uint32_t>(m_definitions));
+            m_last.push_back(0);
+        }
+        for (uint32_t p : nfa.Last)
+            m_last[base + p] = 1;
+        for (uint32_t p : nfa.First)
+            m_follow[0].push_back(base + p);
+        ++m_definitions;
+    }
+
+    // Split the character codes up to maxCode into equivalence classes: two
+    // codes are in the same class if every position either contains both or
+    // neither, so [a-zA-Z0-9_] in every definition is a single class. The
+    // DFAs then need one column per class rather than one per character.
+    void finalize(uint32_t maxCode)
+    {
+        std::vector<uint32_t> boundaries;
+        boundaries.push_back(0);
+        for (auto& chars : m_chars)
+        {
+            for (auto& range : chars.ranges())
+            {
+                boundaries.push_back(range.first);
+                if (range.second < maxCode)
+                    boundaries.push_back(range.second + 1);
+            }
+        }
+        std::sort(std::begin(boundaries), std::end(boundaries));
+        boundaries.erase(
+            std::unique(std::begin(boundaries), std::end(boundaries)), 
+            std::end(boundaries));
+
+        // Each interval between boundaries is uniform; intervals that the
+        // same positions contain are merged into one class
+        std::unordered_map<std::vector<uint32_t>, uint32_t, PositionSetHash> 
+            signatures;
+        std::vector<uint32_t> signature;
+        m_intervalStarts.swap(boundaries);
+        m_intervalClasses.clear();
+        m_representatives.clear();
+        for (uint32_t start : m_intervalStarts)
+        {
+            signature.clear();
+            for (uint32_t p = 1; p < m_chars.size(); ++p)
+            {
+                if (m_chars[p].contains(start))
+                    signature.push_back(p);
+            }
+
+            auto inserted = signatures.insert(std::make_pair(
+                signature, 
+                static_cast<uint32_t>(m_representatives.size())));
+            if (inserted.second)
+                m_representatives.push_back(start);
+            m_intervalClasses.push_back(inserted.first->second);
+        }
+
+        m_lowClasses.resize(256);
+        for (uint32_t c = 0; c < 256; ++c)
+            m_lowClasses[c] = c <= maxCode ? SearchClass(c) : 0;
+    }
+
+    size_t definitions() const
+    {
+        return m_definitions;
+    }
+
+    size_t size() const
+    {
+        return m_chars.size();
+    }
+
+    size_t classes() const
+    {
+        return m_representatives.size();
+    }
+
+    uint32_t classOf(uint32_t c) const
+    {
+        return c < 256 ? m_lowClasses[c] : SearchClass(c);
+    }
+
+    // A character code that belongs to the class
+    uint32_t representative(uint32_t cls) const
+    {
+        return m_representatives[cls];
+    }
+
+    // The uniform intervals of character codes, by their first code, and the
+    // class of each
+    const std::vector<uint32_t>& intervalStarts() const
+    {
+        return m_intervalStarts;
+    }
+
+    const std::vector<uint32_t>& intervalClasses() const
+    {
+        return m_intervalClasses;
+    }
+
+    // The sorted set of positions reached from set by reading c
+    template<typename _Set, typename _Next>
+    void step(
+        const _Set& set, 
+        uint32_t c, 
+        _Next& next) const
+    {
+        next.clear();
+        for (uint32_t p : set)
+        {
+            for (uint32_t q : m_follow[p])
+            {
+                if (m_chars[q].contains(c))
+                    next.push_back(q);
+            }
+        }
+        std::sort(std::begin(next), std::end(next));
+        next.erase(std::unique(std::begin(next), std::end(next)), std::end(next));
+    }
+
+    // The earliest definition with a match ending in this set, or NoToken
+    template<typename _Set>
+    uint32_t accepts(const _Set& set) const
+    {
+        uint32_t token = NoToken;
+        for (uint32_t p : set)
+        {
+            if (m_last[p])
+                token = std::min(token, m_owner[p]);
+        }
+        return token;
+    }
+
+    // The earliest definition with a position in this set, or NoToken
+    template<typename _Set>
+    uint32_t live(const _Set& set) const
+    {
+        uint32_t token = NoToken;
+        for (uint32_t p : set)
+            token = std::min(token, m_owner[p]);
+        return token;
+    }
+
+    // The definition that position p belongs to
+    uint32_t owner(uint32_t p) const
+    {
+        return m_owner[p];
+    }
+
+private:
+
+    uint32_t SearchClass(uint32_t c) const
+    {
+        auto it = std::upper_bound(
+            std::begin(m_intervalStarts), 
+            std::end(m_intervalStarts), 
+            c);
+        return m_intervalClasses[it - std::begin(m_intervalStarts) - 1];
+    }
+
+    std::vector<CharSet> m_chars;
+    std::vector<std::vector<uint32_t> > m_follow;
+    std::vector<uint32_t> m_owner;
+    std::vector<uint8_t> m_last;
+    size_t m_definitions;
+    std::vector<uint32_t> m_intervalStarts;
+    std::vector<uint32_t> m_intervalClasses;
+    std::vector<uint32_t> m_representatives;
+    std::vector<uint32_t> m_lowClasses;
+};
+
+//-----------------------------------------------------------------------------
+// A set of byte values as two 16-entry tables indexed by the low 4 bits of a
+// byte, the form a vector byte shuffle (pshufb) can test 16 to 64 bytes 
+// against at once. Bit h of Low[l] is set if the byte (h << 4 | l) is in the
+// set; High holds the bytes from 0x80 up in the same way.
+//-----------------------------------------------------------------------------
+struct ByteSet
+{
+    uint8_t Low[16];
+    uint8_t High[16];
+
+    void add(uint8_t b)
+    {
+        uint8_t* row = b < 0x80 ? Low : High;
+        row[b & 15] |= static_cast<uint8_t>(1 << ((b >> 4) & 7));
+    }
+
+    bool contains(uint8_t b) const
+    {
+        const uint8_t* row = b < 0x80 ? Low : High;
+        return ((row[b & 15] >> ((b >> 4) & 7)) & 1) != 0;
+    }
+};
+
+//-----------------------------------------------------------------------------
+// The instruction sets that the vector kernels below are written for, from
+// the least capable up. SSE2 has no byte shuffle, so at that level runs of
+// a ByteSet are tested a byte at a time.
+//-----------------------------------------------------------------------------
+enum SimdLevel
+{
+    SimdScalar,
+    SimdSse2,
+    SimdSsse3,
+    SimdAvx2,
+    SimdAvx512
+};
+
+inline const char* simdLevelName(SimdLevel level)
+{
+    static const char* const names[] = { "scalar", "sse2", "ssse3", "avx2", "avx512" };
+    return names[level];
+}
+
+inline uint32_t CountTrailingZeros(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<unsigned long>(bits)))
+        return static_cast<uint32_t>(index);
+    _BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+    return static_cast<uint32_t>(index) + 32;
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+}
+
+inline uint32_t PopCount(uint64_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<uint32_t>(__builtin_popcountll(bits));
+#else
+    bits -= (bits >> 1) & 0x5555555555555555ull;
+    bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return static_cast<uint32_t>((bits * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// The kernels. Each comes in a portable version and one per instruction set
+// that helps it; the vector versions handle whole vectors and leave the rest
+// to the portable one. All of them are compiled into every build, for the
+// instruction set named in their LEX_TARGET, and only called once the CPU is
+// known to support it (see SimdKernels()).
+//
+//     RunLength:     The number of bytes at the start of [begin, end) that
+//                    are in a ByteSet. The low and high 4 bits of each byte
+//                    pick its row and its bit in the set's tables.
+//     FindAny:       The first byte in [begin, end) equal to a, b or c, or
+//                    end.
+//     CountNewlines: The number of '\n' bytes in [begin, end).
+//-----------------------------------------------------------------------------
+inline size_t RunLengthScalar(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    const ByteSet& set)
+{
+    const uint8_t* cursor = begin;
+    while (cursor != end && set.contains(*cursor))
+        ++cursor;
+    return cursor - begin;
+}
+
+inline const uint8_t* FindAnyScalar(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    uint8_t a, 
+    uint8_t b, 
+    uint8_t c)
+{
+    for ( ; begin != end; ++begin)
+    {
+        if (*begin == a || *begin == b || *begin == c)
+            break;
+    }
+    return begin;
+}
+
+inline size_t CountNewlinesScalar(const uint8_t* begin, const uint8_t* end)
+{
+    size_t lines = 0;
+    for ( ; begin != end; ++begin)
+        lines += *begin == '\n';
+    return lines;
+}
+
+#if LEX_X86
+
+LEX_TARGET("sse2")
+inline const uint8_t* FindAnySse2(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    uint8_t a, 
+    uint8_t b, 
+    uint8_t c)
+{
+    const __m128i va = _mm_set1_epi8(static_cast<char>(a));
+    const __m128i vb = _mm_set1_epi8(static_cast<char>(b));
+    const __m128i vc = _mm_set1_epi8(static_cast<char>(c));
+    for ( ; end - begin >= 16; begin += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), 
+            _mm_cmpeq_epi8(v, vc));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    return FindAnyScalar(begin, end, a, b, c);
+}
+
+LEX_TARGET("sse2")
+inline size_t CountNewlinesSse2(const uint8_t* begin, const uint8_t* end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t lines = 0;
+    for ( ; end - begin >= 16; begin += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        lines += PopCount(static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline))));
+    }
+    return lines + CountNewlinesScalar(begin, end);
+}
+
+LEX_TARGET("ssse3")
+inline size_t RunLengthSsse3(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    const ByteSet& set)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.Low));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.High));
+    const __m128i bits = _mm_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t* cursor = begin;
+    for ( ; end - cursor >= 16; cursor += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i top = _mm_cmplt_epi8(v, zero);
+        __m128i row = _mm_or_si128(
+            _mm_andnot_si128(top, _mm_shuffle_epi8(low, lo)), 
+            _mm_and_si128(top, _mm_shuffle_epi8(high, lo)));
+        __m128i in = _mm_and_si128(row, _mm_shuffle_epi8(bits, hi));
+        uint32_t outside = static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(in, zero)));
+        if (outside)
+            return (cursor - begin) + CountTrailingZeros(outside);
+    }
+    return (cursor - begin) + RunLengthScalar(cursor, end, set);
+}
+
+LEX_TARGET("avx2,popcnt")
+inline size_t RunLengthAvx2(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    const ByteSet& set)
+{
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.Low)));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.High)));
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    const uint8_t* cursor = begin;
+    for ( ; end - cursor >= 32; cursor += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i top = _mm256_cmpgt_epi8(zero, v);
+        __m256i row = _mm256_or_si256(
+            _mm256_andnot_si256(top, _mm256_shuffle_epi8(low, lo)), 
+            _mm256_and_si256(top, _mm256_shuffle_epi8(high, lo)));
+        __m256i in = _mm256_and_si256(row, _mm256_shuffle_epi8(bits, hi));
+        uint32_t outside = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(in, zero)));
+        if (outside)
+            return (cursor - begin) + CountTrailingZeros(outside);
+    }
+    return (cursor - begin) + RunLengthSsse3(cursor, end, set);
+}
+
+LEX_TARGET("avx2,popcnt")
+inline const uint8_t* FindAnyAvx2(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    uint8_t a, 
+    uint8_t b, 
+    uint8_t c)
+{
+    const __m256i va = _mm256_set1_epi8(static_cast<char>(a));
+    const __m256i vb = _mm256_set1_epi8(static_cast<char>(b));
+    const __m256i vc = _mm256_set1_epi8(static_cast<char>(c));
+    for ( ; end - begin >= 32; begin += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)), 
+            _mm256_cmpeq_epi8(v, vc));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    return FindAnySse2(begin, end, a, b, c);
+}
+
+LEX_TARGET("avx2,popcnt")
+inline size_t CountNewlinesAvx2(const uint8_t* begin, const uint8_t* end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t lines = 0;
+    for ( ; end - begin >= 32; begin += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        lines += PopCount(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline))));
+    }
+    return lines + CountNewlinesSse2(begin, end);
+}
+
+LEX_TARGET("avx512f,avx512bw,avx2,popcnt")
+inline size_t RunLengthAvx512(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    const ByteSet& set)
+{
+    // The tables are broadcast with a full mask into zeros, since the plain
+    // broadcast starts from an undefined register that GCC warns about
+    const __mmask16 all = 0xFFFF;
+    const __m512i low = _mm512_maskz_broadcast_i32x4(all,
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.Low)));
+    const __m512i high = _mm512_maskz_broadcast_i32x4(all,
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(set.High)));
+    const __m512i bits = _mm512_maskz_broadcast_i32x4(all, _mm_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    const uint8_t* cursor = begin;
+    for ( ; end - cursor >= 64; cursor += 64)
+    {
+        __m512i v = _mm512_loadu_si512(cursor);
+        __m512i lo = _mm512_and_si512(v, nibble);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+        __m512i row = _mm512_mask_blend_epi8(
+            _mm512_movepi8_mask(v), 
+            _mm512_shuffle_epi8(low, lo), 
+            _mm512_shuffle_epi8(high, lo));
+        uint64_t outside = _mm512_testn_epi8_mask(row, _mm512_shuffle_epi8(bits, hi));
+        if (outside)
+            return (cursor - begin) + CountTrailingZeros(outside);
+    }
+    return (cursor - begin) + RunLengthAvx2(cursor, end, set);
+}
+
+LEX_TARGET("avx512f,avx512bw,avx2,popcnt")
+inline const uint8_t* FindAnyAvx512(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    uint8_t a, 
+    uint8_t b, 
+    uint8_t c)
+{
+    const __m512i va = _mm512_set1_epi8(static_cast<char>(a));
+    const __m512i vb = _mm512_set1_epi8(static_cast<char>(b));
+    const __m512i vc = _mm512_set1_epi8(static_cast<char>(c));
+    for ( ; end - begin >= 64; begin += 64)
+    {
+        __m512i v = _mm512_loadu_si512(begin);
+        uint64_t mask = 
+            _mm512_cmpeq_epi8_mask(v, va) | 
+            _mm512_cmpeq_epi8_mask(v, vb) | 
+            _mm512_cmpeq_epi8_mask(v, vc);
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    return FindAnyAvx2(begin, end, a, b, c);
+}
+
+LEX_TARGET("avx512f,avx512bw,avx2,popcnt")
+inline size_t CountNewlinesAvx512(const uint8_t* begin, const uint8_t* end)
+{
+    const __m512i newline = _mm512_set1_epi8('\n');
+    size_t lines = 0;
+    for ( ; end - begin >= 64; begin += 64)
+    {
+        __m512i v = _mm512_loadu_si512(begin);
+        lines += PopCount(_mm512_cmpeq_epi8_mask(v, newline));
+    }
+    return lines + CountNewlinesAvx2(begin, end);
+}
+
+inline void Cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4])
+{
+#ifdef _MSC_VER
+    int values[4];
+    __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i)
+        registers[i] = static_cast<uint32_t>(values[i]);
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// The register state that the operating system saves (XCR0)
+inline uint64_t SavedRegisterState()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (uint64_t(hi) << 32) | lo;
+#endif
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// The most capable SimdLevel that this CPU and operating system support. 
+// AVX2 and AVX-512 also need the operating system to save the wider 
+// registers, and AVX-512 needs its byte and word instructions (AVX512BW).
+//-----------------------------------------------------------------------------
+inline SimdLevel DetectSimdLevel()
+{
+#if LEX_X86
+    uint32_t r[4];
+    Cpuid(0, 0, r);
+    const uint32_t leaves = r[0];
+    if (leaves < 1)
+        return SimdScalar;
+
+    Cpuid(1, 0, r);
+    const bool sse2 = (r[3] & (1u << 26)) != 0;
+    const bool ssse3 = (r[2] & (1u << 9)) != 0;
+    const bool popcnt = (r[2] & (1u << 23)) != 0;
+    const bool osxsave = (r[2] & (1u << 27)) != 0;
+    const uint64_t saved = osxsave ? SavedRegisterState() : 0;
+    const bool ymm = (saved & 0x06) == 0x06;
+    const bool zmm = (saved & 0xE6) == 0xE6;
+
+    bool avx2 = false;
+    bool avx512 = false;
+    if (leaves >= 7)
+    {
+        Cpuid(7, 0, r);
+        avx2 = (r[1] & (1u << 5)) != 0;
+        avx512 = (r[1] & (1u << 16)) != 0 && (r[1] & (1u << 30)) != 0;
+    }
+
+    if (avx512 && avx2 && popcnt && zmm)
+        return SimdAvx512;
+    if (avx2 && popcnt && ymm)
+        return SimdAvx2;
+    if (sse2 && ssse3)
+        return SimdSsse3;
+    if (sse2)
+        return SimdSse2;
+#endif
+    return SimdScalar;
+}
+
+//-----------------------------------------------------------------------------
+// The kernels for one SimdLevel.
+//-----------------------------------------------------------------------------
+struct SimdKernelTable
+{
+    SimdLevel Level;
+    size_t (*RunLength)(const uint8_t*, const uint8_t*, const ByteSet&);
+    const uint8_t* (*FindAny)(const uint8_t*, const uint8_t*, uint8_t, uint8_t, uint8_t);
+    size_t (*CountNewlines)(const uint8_t*, const uint8_t*);
+};
+
+inline SimdKernelTable SelectSimdKernels(SimdLevel level)
+{
+    SimdKernelTable table = { 
+        SimdScalar, RunLengthScalar, FindAnyScalar, CountNewlinesScalar };
+#if LEX_X86
+    if (level >= SimdSse2)
+    {
+        table.Level = SimdSse2;
+        table.FindAny = FindAnySse2;
+        table.CountNewlines = CountNewlinesSse2;
+    }
+    if (level >= SimdSsse3)
+    {
+        table.Level = SimdSsse3;
+        table.RunLength = RunLengthSsse3;
+    }
+    if (level >= SimdAvx2)
+    {
+        table.Level = SimdAvx2;
+        table.RunLength = RunLengthAvx2;
+        table.FindAny = FindAnyAvx2;
+        table.CountNewlines = CountNewlinesAvx2;
+    }
+    if (level >= SimdAvx512)
+    {
+        table.Level = SimdAvx512;
+        table.RunLength = RunLengthAvx512;
+        table.FindAny = FindAnyAvx512;
+        table.CountNewlines = CountNewlinesAvx512;
+    }
+#else
+    (void)level;
+#endif
+    return table;
+}
+
+//-----------------------------------------------------------------------------
+// The kernels the process uses, chosen the first time they are needed: the
+// most capable ones that the CPU supports, or fewer if the LUTHOR_SIMD
+// environment variable names a less capable level ("scalar", "sse2", 
+// "ssse3", "avx2" or "avx512"). A level the CPU doesn't support is never 
+// chosen, so the variable can only be used to compare the kernels.
+//-----------------------------------------------------------------------------
+inline const SimdKernelTable& SimdKernels()
+{
+    static const SimdKernelTable table = []
+    {
+        SimdLevel level = DetectSimdLevel();
+        if (const char* requested = std::getenv("LUTHOR_SIMD"))
+        {
+            for (int l = SimdScalar; l <= SimdAvx512; ++l)
+            {
+                if (std::strcmp(requested, simdLevelName(SimdLevel(l))) == 0)
+                    level = std::min(level, SimdLevel(l));
+            }
+        }
+        return SelectSimdKernels(level);
+    }();
+    return table;
+}
+
+// The SimdLevel of the kernels in use
+inline SimdLevel simdLevel()
+{
+    return SimdKernels().Level;
+}
+
+inline size_t ByteRunLength(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    const ByteSet& set)
+{
+    return SimdKernels().RunLength(begin, end, set);
+}
+
+inline const uint8_t* FindAnyByte(
+    const uint8_t* begin, 
+    const uint8_t* end, 
+    uint8_t a, 
+    uint8_t b, 
+    uint8_t c)
+{
+    return SimdKernels().FindAny(begin, end, a, b, c);
+}
+
+inline size_t CountNewlines(const uint8_t* begin, const uint8_t* end)
+{
+    return SimdKernels().CountNewlines(begin, end);
+}
+
+//-----------------------------------------------------------------------------
+// Scanning for the longest match can read far past the end of the token it 
+// finds, and the next scan may read the same text again, so the total work 
+// of an analysis can grow with the square of its length. ScanMemo records, 
+// for pairs of DFA state and input position that a scan went through after
+// its last match, that no definition earlier than a bound can accept from 
+// there. A later scan that reaches one of those pairs stops, which keeps the
+// work of the whole analysis linear in its length (after Reps, "Maximal-munch
+// tokenization in linear time", 1998).
+//
+// The pairs a scan goes through are kept as a run of states, one per 
+// position. A deterministic scan that reaches a recorded pair would follow
+// the rest of that run, so runs that cover the same position always hold
+// different states there.
+//-----------------------------------------------------------------------------
+class ScanMemo
+{
+public:
+
+    explicit ScanMemo(
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : m_runs(resource)
+        , m_states(resource)
+        , m_trail(resource)
+        , m_first(0)
+    {
+    }
+
+    void clear()
+    {
+        m_runs.clear();
+        m_states.clear();
+        m_trail.clear();
+    }
+
+    // Called at the start of each scan, from position. Forgets the runs that
+    // end before it.
+    void begin(size_t position)
+    {
+        size_t kept = 0;
+        for (auto& run : m_runs)
+        {
+            if (run.First + run.Count > position)
+                m_runs[kept++] = run;
+        }
+        m_runs.resize(kept);
+        if (m_runs.empty())
+            m_states.clear();
+
+        m_trail.clear();
+        m_first = position + 1;
+    }
+
+    // The scan reached state at the next position
+    void step(uint32_t state)
+    {
+        m_trail.push_back(state);
+    }
+
+    // The state numbers changed, so forget everything; the scan goes on from
+    // position
+    void forget(size_t position)
+    {
+        clear();
+        m_first = position;
+    }
+
+    // Whether the scan can stop at state and position because no definition
+    // earlier than best can accept from there
+    bool exhausted(uint32_t state, size_t position, uint32_t best) const
+    {
+        for (auto& run : m_runs)
+        {
+            if (position >= run.First && 
+                position - run.First < run.Count &&
+                m_states[run.Offset + position - run.First] == state &&
+                (run.Bound == Program::NoToken || run.Bound > best))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Called at the end of each scan. From every position at or after 
+    // matched, the scan found no definition earlier than best to accept.
+    void end(size_t matched, uint32_t best)
+    {
+        size_t first = std::max(matched, m_first);
+        if (first - m_first >= m_trail.size())
+            return;
+
+        Run run;
+        run.First = first;
+        run.Count = m_trail.size() - (first - m_first);
+        run.Offset = m_states.size();
+        run.Bound = best == Program::NoToken ? best : best + 1;
+        m_states.insert(
+            std::end(m_states), 
+            std::begin(m_trail) + (first - m_first), 
+            std::end(m_trail));
+        m_runs.push_back(run);
+    }
+
+private:
+
+    struct Run
+    {
+        size_t First;
+        size_t Count;
+        size_t Offset;
+        uint32_t Bound;
+    };
+
+    std::pmr::vector<Run> m_runs;
+    std::pmr::vector<uint32_t> m_states;
+    std::pmr::vector<uint32_t> m_trail;
+    size_t m_first;
+};
+
+//-----------------------------------------------------------------------------
+// A DFA over a Program that is built lazily: each state is a set of program
+// positions, created the first time the input leads to it and cached. The
+// cache is capped at a memory limit. When it fills up it is flushed and 
+// rebuilt from the states the input is visiting now; if that happens so
+// often that the cache isn't paying for itself, matching falls back to
+// simulating the Program directly for the rest of the analysis.
+//
+// Several analyses may scan at once. The cache is locked while a scan reads
+// and adds to it, and a scan that simulates the Program runs without the 
+// lock. What belongs to one analysis is kept in its own Session.
+//
+// The cache is allocated from a memory resource. A copy of a LazyDfa starts
+// with an empty cache, allocated from the default resource.
+//-----------------------------------------------------------------------------
+class LazyDfa
+{
+public:
+    static constexpr size_t DefaultMemoryLimit = 2 << 20;
+
+    // The state of one analysis: whether it has fallen back to simulation,
+    // which filling of the cache its ScanMemo numbers states from, and the
+    // position sets of the simulation
+    struct Session
+    {
+        explicit Session(
+            std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : Current(resource)
+            , Next(resource)
+        {
+            begin();
+        }
+
+        // Called at the start of each analysis
+        void begin()
+        {
+            Bail = false;
+            Generation = 0;
+        }
+
+        bool Bail;
+        size_t Generation;
+        std::pmr::vector<uint32_t> Current;
+        std::pmr::vector<uint32_t> Next;
+    };
+
+    explicit LazyDfa(
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : m_index(resource)
+        , m_sets(resource)
+        , m_transitions(resource)
+        , m_accept(resource)
+        , m_live(resource)
+        , m_scratch(resource)
+        , m_limit(DefaultMemoryLimit)
+        , m_generation(0)
+    {
+        reset();
+    }
+
+    LazyDfa(const LazyDfa& other)
+        : m_limit(other.m_limit)
+        , m_generation(0)
+    {
+        reset();
+    }
+
+    LazyDfa& operator =(const LazyDfa& other)
+    {
+        m_limit = other.m_limit;
+        reset();
+        return *this;
+    }
+
+    std::pmr::memory_resource* resource() const
+    {
+        return m_transitions.get_allocator().resource();
+    }
+
+    void setMemoryLimit(size_t bytes)
+    {
+        m_limit = bytes;
+        reset();
+    }
+
+    size_t memoryLimit() const
+    {
+        return m_limit;
+    }
+
+    size_t memoryUsage() const
+    {
+        return m_memory;
+    }
+
+    // Drop every cached state, e.g. because the program changed
+    void reset()
+    {
+        m_index.clear();
+        m_sets.clear();
+        m_transitions.clear();
+        m_accept.clear();
+        m_live.clear();
+        m_classes = 0;
+        m_memory = 0;
+        m_flushes = 0;
+        m_scanned = 0;
+        m_flushedAt = 0;
+    }
+
+    // Number of times the cache has been flushed since the last reset
+    size_t flushes() const
+    {
+        return m_flushes;
+    }
+
+    // Find the winning definition for the input at start. Returns its index
+    // and sets matchEnd to the end of its match, or returns NoToken. Sets
+    // scanEnd to the end of the input that was read. session belongs to the
+    // analysis.
+    template<typename _It>
+    uint32_t scan(
+        const Program& program, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        _It& scanEnd,
+        Session& session)
+    {
+        if (!session.Bail)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            uint32_t best;
+            if (Scan(program, start, end, matchEnd, scanEnd, best))
+                return best;
+            session.Bail = true;
+        }
+        return Simulate(program, start, end, matchEnd, scanEnd, session);
+    }
+
+    // As above, but using and updating memo so that the total work of an
+    // analysis is linear (see ScanMemo). position is the offset of start in 
+    // the input. The cache never falls back to simulation in this mode, and
+    // the memo is forgotten whenever the cache is flushed, by this analysis
+    // or another.
+    template<typename _It>
+    uint32_t scan(
+        const Program& program, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        _It& scanEnd,
+        ScanMemo& memo,
+        size_t position,
+        Session& session)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_classes != program.classes())
+            Initialize(program);
+        if (session.Generation != m_generation)
+            memo.forget(position);
+
+        uint32_t best = Program::NoToken;
+        uint32_t state = StartState;
+        size_t matched = position;
+        _It cursor = start;
+        memo.begin(position);
+        while (cursor != end)
+        {
+            uint32_t cls = program.classOf(CharCode(*cursor));
+            ++cursor;
+            ++position;
+
+            uint32_t next = m_transitions[state * m_classes + cls];
+            if (next == Unknown)
+            {
+                size_t generation = m_generation;
+                next = Compute(program, state, cls, false);
+                if (m_generation != generation)
+                    memo.forget(position);
+            }
+            if (next == DeadState)
+                break;
+
+            state = next;
+            memo.step(state);
+            uint32_t accept = m_accept[state];
+            if (accept != Program::NoToken && accept <= best)
+            {
+                best = accept;
+                matchEnd = cursor;
+                matched = position;
+            }
+            if (m_live[state] > best || memo.exhausted(state, position, best))
+                break;
+        }
+
+        memo.end(matched, best);
+        session.Generation = m_generation;
+        m_scanned += std::distance(start, cursor);
+        scanEnd = cursor;
+        return best;
+    }
+
+private:
+
+    static constexpr uint32_t DeadState = 0;
+    static constexpr uint32_t StartState = 1;
+    static constexpr uint32_t Unknown = ~0u;
+
+    // A flush this soon after the previous one (in bytes scanned per cached
+    // state) means the cache is thrashing
+    static constexpr size_t MinBytesPerState = 10;
+
+    typedef std::pmr::vector<uint32_t> PositionSet;
+    typedef std::pmr::unordered_map<
+        PositionSet, 
+        uint32_t, 
+        PositionSetHash> Index;
+
+    // scan() with the cache locked. Returns false, having cached nothing, if
+    // the cache is thrashing and matching should fall back to simulation.
+    template<typename _It>
+    bool Scan(
+        const Program& program, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        _It& scanEnd,
+        uint32_t& best)
+    {
+        if (m_classes != program.classes())
+            Initialize(program);
+
+        best = Program::NoToken;
+        uint32_t state = StartState;
+        _It cursor = start;
+        while (cursor != end)
+        {
+            uint32_t cls = program.classOf(CharCode(*cursor));
+            ++cursor;
+
+            uint32_t next = m_transitions[state * m_classes + cls];
+            if (next == Unknown)
+            {
+                next = Compute(program, state, cls);
+                if (next == Unknown)
+                    return false;
+            }
+            if (next == DeadState)
+                break;
+
+            state = next;
+            uint32_t accept = m_accept[state];
+            if (accept != Program::NoToken && accept <= best)
+            {
+                best = accept;
+                matchEnd = cursor;
+            }
+            if (m_live[state] > best)
+                break;
+        }
+
+        m_scanned += std::distance(start, cursor);
+        scanEnd = cursor;
+        return true;
+    }
+
+    void Initialize(const Program& program)
+    {
+        m_index.clear();
+        m_sets.clear();
+        m_transitions.clear();
+        m_accept.clear();
+        m_live.clear();
+        m_memory = 0;
+        m_classes = program.classes();
+        ++m_generation;
+
+        AddState(program, PositionSet(resource()));
+        AddState(program, PositionSet(1, 0, resource()));
+        std::fill(
+            std::begin(m_transitions), 
+            std::begin(m_transitions) + m_classes, 
+            DeadState);
+    }
+
+    size_t StateCost(size_t positions) const
+    {
+        return m_classes * sizeof(uint32_t) + 
+            positions * 2 * sizeof(uint32_t) + 
+            2 * sizeof(uint32_t) + 
+            64;
+    }
+
+    uint32_t AddState(const Program& program, const PositionSet& set)
+    {
+        auto found = m_index.find(set);
+        if (found != std::end(m_index))
+            return found->second;
+
+        uint32_t state = static_cast<uint32_t>(m_sets.size());
+        auto inserted = m_index.insert(std::make_pair(set, state)).first;
+        m_sets.push_back(&inserted->first);
+        m_transitions.resize(m_transitions.size() + m_classes, Unknown);
+        m_accept.push_back(program.accepts(set));
+        m_live.push_back(program.live(set));
+        m_memory += StateCost(set.size());
+        return state;
+    }
+
+    // Work out and cache the transition from state on cls. May flush the 
+    // cache, in which case state is renumbered. Returns Unknown, having 
+    // cached nothing, if the cache is thrashing and mayBail.
+    uint32_t Compute(
+        const Program& program, 
+        uint32_t& state, 
+        uint32_t cls, 
+        bool mayBail = true)
+    {
+        program.step(*m_sets[state], program.representative(cls), m_scratch);
+
+        auto found = m_index.find(m_scratch);
+        if (found == std::end(m_index) && 
+            m_memory + StateCost(m_scratch.size()) > m_limit)
+        {
+            if (mayBail && 
+                m_scanned - m_flushedAt < MinBytesPerState * m_sets.size())
+            {
+                return Unknown;
+            }
+
+            PositionSet current(*m_sets[state], resource());
+            Initialize(program);
+            state = AddState(program, current);
+            m_flushedAt = m_scanned;
+            ++m_flushes;
+        }
+
+        uint32_t next = found != std::end(m_index) ? 
+            found->second : 
+            AddState(program, m_scratch);
+        m_transitions[state * m_classes + cls] = next;
+        return next;
+    }
+
+    // Run the program as an NFA, without touching the cache
+    template<typename _It>
+    static uint32_t Simulate(
+        const Program& program, 
+        _It start, 
+        _It end, 
+        _It& matchEnd,
+        _It& scanEnd,
+        Session& session)
+    {
+        uint32_t best = Program::NoToken;
+        PositionSet& current = session.Current;
+        PositionSet& next = session.Next;
+        current.assign(1, 0);
+        _It cursor = start;
+        while (cursor != end)
+        {
+            program.step(current, CharCode(*cursor), next);
+            ++cursor;
+            if (next.empty())
+                break;
+
+            current.swap(next);
+            uint32_t accept = program.accepts(current);
+            if (accept != Program::NoToken && accept <= best)
+            {
+                best = accept;
+                matchEnd = cursor;
+            }
+            if (program.live(current) > best)
+                break;
+        }
+        scanEnd = cursor;
+        return best;
+    }
+
+    Index m_index;
+    std::pmr::vector<const PositionSet*> m_sets;
+    std::pmr::vector<uint32_t> m_transitions;
+    std::pmr::vector<uint32_t> m_accept;
+    std::pmr::vector<uint32_t> m_live;
+    PositionSet m_scratch;
+    size_t m_classes;
+    size_t m_limit;
+    size_t m_memory;
+    size_t m_flushes;
+    size_t m_scanned;
+    size_t m_flushedAt;
+    size_t m_generation;
+    std::mutex m_mutex;
+};
+
+//-----------------------------------------------------------------------------
+// A complete DFA over a Program, built up front by subset construction and
+// then minimized with Hopcroft's algorithm. Transition rows have one column 
+// per character class and hold 8-bit state numbers when there are at most 
+// 256 states, 16-bit otherwise, so that the tables of a typical lexer fit in
+// the L1 or L2 cache.
+//
+// State 0 is dead and state 1 is the start. For each state the DFA records
+// the earliest definition that accepts there, and the earliest definition
+// that can accept anywhere after it (which lets scan() stop early).
+//
+// Runs of one class of characters, like the rest of an identifier or a run
+// of digits or spaces, loop on one state. The bytes that loop on each state
+// are kept as a ByteSet, so that scan() can skip the rest of a run of them 
+// many bytes at a time (see ByteRunLength()) instead of stepping through it.
+//
+// All of the tables live in one block of memory that uses offsets rather 
+// than pointers, so it can be written to a file and used straight from a
+// memory mapping of that file (see attach()). A built block is allocated 
+// from a memory resource and shared by copies of the DFA.
+//-----------------------------------------------------------------------------
+class DenseDfa
+{
+public:
+    static constexpr size_t DefaultMaxStates = 10000;
+
+    // Alignment of a built block
+    static constexpr size_t BlockAlignment = 64;
+
+    DenseDfa()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        m_owner.reset();
+        Bind(nullptr);
+    }
+
+    bool valid() const
+    {
+        return m_states != 0;
+    }
+
+    // The tables as one position-independent block of memory
+    const void* data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_data ? static_cast<size_t>(Tables()->Size) : 0;
+    }
+
+    // Use a block written out from data() and size() in place, without 
+    // copying it. The memory must be 8-byte aligned and stay valid while the
+    // DFA, or any copy of it, uses it; owner is kept alive for that purpose.
+    // Returns false if the block is malformed.
+    bool attach(
+        const void* data, 
+        size_t size, 
+        std::shared_ptr<const void> owner)
+    {
+        clear();
+        const Header* header = static_cast<const Header*>(data);
+        if (reinterpret_cast<uintptr_t>(data) % 8 != 0 || 
+            size < sizeof(Header) || 
+            header->Size > size ||
+            header->States < 2 || 
+            header->States > 0x10000 ||
+            (header->StateBytes != 1 && header->StateBytes != 2) ||
+            header->Intervals == 0 ||
+            !Fits(*header, header->Table, 
+                uint64_t(header->States) * header->Classes * header->StateBytes) ||
+            !Fits(*header, header->Accept, header->States * 4ull) ||
+            !Fits(*header, header->LiveAfter, header->States * 4ull) ||
+            !Fits(*header, header->LowClasses, 256 * 2ull) ||
+            !Fits(*header, header->IntervalStarts, header->Intervals * 4ull) ||
+            !Fits(*header, header->IntervalClasses, header->Intervals * 4ull) ||
+            !Fits(*header, header->StateRuns, header->States * 2ull) ||
+            !Fits(*header, header->RunSetTable, header->RunSets * uint64_t(sizeof(ByteSet))))
+        {
+            return false;
+        }
+
+        Bind(data);
+        if (!Consistent())
+        {
+            clear();
+            return false;
+        }
+
+        m_owner = owner;
+        return true;
+    }
+
+    // Largest definition index that the DFA can report, or NoToken if none
+    uint32_t maxToken() const
+    {
+        uint32_t token = Program::NoToken;
+        for (size_t i = 0; i < m_states; ++i)
+        {
+            if (m_accept[i] != Program::NoToken && 
+                (token == Program::NoToken || m_accept[i] > token))
+                token = m_accept[i];
+        }
+        return token;
+    }
+
+    size_t states() const
+    {
+        return m_states;
+    }
+
+    size_t classes() const
+    {
+        return m_classes;
+    }
+
+    // Size of a state number in the transition table: 1 or 2 bytes
+    size_t stateBytes() const
+    {
+        return m_width;
+    }
+
+    size_t memoryUsage() const
+    {
+        return size();
+    }
+
+    // Build the DFA for a finalized program, allocating its block from 
+    // resource. Returns false, leaving the DFA empty, if it would need more 
+    // than maxStates states before minimization.
+    bool build(
+        const Program& program, 
+        size_t maxStates,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        clear();
+        if (program.classes() > 0xFFFF)
+            return false;
+
+        std::vector<uint32_t> transitions;
+        std::vector<uint32_t> accept;
+        if (!Construct(program, maxStates, transitions, accept))
+            return false;
+
+        const size_t classes = program.classes();
+        const size_t states = accept.size();
+        std::vector<uint32_t> blocks = Minimize(transitions, accept, states, classes);
+        return Assemble(program, transitions, accept, blocks, resource);
+    }
+
+    // Find the winning definition for the input at start. Returns its index
+    // and sets matchEnd to the end of its match, or returns NoToken. Sets 
+    // scanEnd to the end of the input that was read.
+    template<typename _It>
+    uint32_t scan(_It start, _It end, _It& matchEnd, _It& scanEnd) const
+    {
+        return m_width == 1 ? 
+            Scan<uint8_t>(start, end, matchEnd, scanEnd) : 
+            Scan<uint16_t>(start, end, matchEnd, scanEnd);
+    }
+
+    // As above, but using and updating memo so that the total work of an
+    // analysis is linear (see ScanMemo). position is the offset of start in
+    // the input.
+    template<typename _It>
+    uint32_t scan(
+        _It start, 
+        _It end, 
+        _It& matchEnd, 
+        _It& scanEnd, 
+        ScanMemo& memo, 
+        size_t position) const
+    {
+        return m_width == 1 ? 
+            ScanMemoized<uint8_t>(start, end, matchEnd, scanEnd, memo, position) : 
+            ScanMemoized<uint16_t>(start, end, matchEnd, scanEnd, memo, position);
+    }
+
+    // The least accept value of any state reachable from each state in one
+    // or more steps, propagated backwards to a fixed point. table holds the
+    // transitions of each state, classes to a row.
+    static std::vector<uint32_t> LiveAfter(
+        const std::vector<uint32_t>& table,
+        const std::vector<uint32_t>& accept,
+        size_t classes)
+    {
+        const size_t states = accept.size();
+        std::vector<std::vector<uint32_t> > predecessors(states);
+        for (size_t s = 0; s < states; ++s)
+        {
+            for (size_t a = 0; a < classes; ++a)
+                predecessors[table[s * classes + a]].push_back(static_cast<uint32_t>(s));
+        }
+
+        std::vector<uint32_t> liveAfter(states, Program::NoToken);
+        std::vector<uint32_t> worklist;
+        for (size_t s = 0; s < states; ++s)
+            worklist.push_back(static_cast<uint32_t>(s));
+        while (!worklist.empty())
+        {
+            uint32_t t = worklist.back();
+            worklist.pop_back();
+            uint32_t value = std::min(accept[t], liveAfter[t]);
+            for (uint32_t s : predecessors[t])
+            {
+                if (value < liveAfter[s])
+                {
+                    liveAfter[s] = value;
+                    worklist.push_back(s);
+                }
+            }
+        }
+        return liveAfter;
+    }
+
+private:
+
+    // Layout of the block: this header, then each table at an 8-byte 
+    // aligned offset from the start of the header
+    struct Header
+    {
+        uint32_t States;
+        uint32_t Classes;
+        uint32_t StateBytes;
+        uint32_t Intervals;
+        uint32_t RunSets;
+        uint32_t Reserved;
+        uint64_t Table;
+        uint64_t Accept;
+        uint64_t LiveAfter;
+        uint64_t LowClasses;
+        uint64_t IntervalStarts;
+        uint64_t IntervalClasses;
+        uint64_t StateRuns;
+        uint64_t RunSetTable;
+        uint64_t Size;
+    };
+
+    static bool Fits(const Header& header, uint64_t offset, uint64_t bytes)
+    {
+        return offset % 8 == 0 && 
+            offset >= sizeof(Header) && 
+            offset <= header.Size && 
+            bytes <= header.Size - offset;
+    }
+
+    // Check that every state and class number in the tables is in range, so
+    // that scan() cannot read outside them
+    bool Consistent() const
+    {
+        for (size_t i = 0; i < m_states * m_classes; ++i)
+        {
+            uint32_t state = m_width == 1 ? 
+                m_table[i] : 
+                reinterpret_cast<const uint16_t*>(m_table)[i];
+            if (state >= m_states)
+                return false;
+        }
+        for (size_t c = 0; c < 256; ++c)
+        {
+            if (m_lowClasses[c] >= m_classes)
+                return false;
+        }
+        for (size_t s = 0; s < m_states; ++s)
+        {
+            if (m_stateRuns[s] > m_runSets)
+                return false;
+        }
+        if (m_intervalStarts[0] != 0)
+            return false;
+        for (size_t i = 0; i < m_intervals; ++i)
+        {
+            if (m_intervalClasses[i] >= m_classes || 
+                (i > 0 && m_intervalStarts[i] <= m_intervalStarts[i - 1]))
+                return false;
+        }
+        return true;
+    }
+
+    const Header* Tables() const
+    {
+        return static_cast<const Header*>(m_data);
+    }
+
+    // Point the table views at a block, or at nothing
+    void Bind(const void* data)
+    {
+        m_data = data;
+        m_states = 0;
+        m_classes = 0;
+        m_width = 0;
+        m_intervals = 0;
+        m_runSets = 0;
+        m_table = nullptr;
+        m_accept = nullptr;
+        m_liveAfter = nullptr;
+        m_lowClasses = nullptr;
+        m_intervalStarts = nullptr;
+        m_intervalClasses = nullptr;
+        m_stateRuns = nullptr;
+        m_runSetTable = nullptr;
+        m_runLength = SimdKernels().RunLength;
+        if (!data)
+            return;
+
+        const Header* header = Tables();
+        const uint8_t* base = static_cast<const uint8_t*>(data);
+        m_states = header->States;
+        m_classes = header->Classes;
+        m_width = header->StateBytes;
+        m_intervals = header->Intervals;
+        m_table = base + header->Table;
+        m_accept = reinterpret_cast<const uint32_t*>(base + header->Accept);
+        m_liveAfter = reinterpret_cast<const uint32_t*>(base + header->LiveAfter);
+        m_lowClasses = reinterpret_cast<const uint16_t*>(base + header->LowClasses);
+        m_intervalStarts = 
+            reinterpret_cast<const uint32_t*>(base + header->IntervalStarts);
+        m_intervalClasses = 
+            reinterpret_cast<const uint32_t*>(base + header->IntervalClasses);
+        m_runSets = header->RunSets;
+        m_stateRuns = reinterpret_cast<const uint16_t*>(base + header->StateRuns);
+        m_runSetTable = reinterpret_cast<const ByteSet*>(base + header->RunSetTable);
+    }
+
+    // Whether _It walks contiguous bytes, which a run can be skipped over
+    template<typename _It>
+    struct IsByteString : std::integral_constant<bool,
+        sizeof(typename std::iterator_traits<_It>::value_type) == 1 && 
+        (std::is_pointer<_It>::value || 
+         std::is_same<_It, std::string::const_iterator>::value || 
+         std::is_same<_It, std::string::iterator>::value)>
+    {
+    };
+
+    // Move cursor past the run of bytes that loop on state
+    template<typename _It>
+    void SkipRun(_It& cursor, _It end, size_t state, std::true_type) const
+    {
+        // Most runs are over at once, so test the first byte before calling
+        // the kernel
+        if (cursor == end)
+            return;
+        const ByteSet& set = m_runSetTable[m_stateRuns[state] - 1];
+        const uint8_t* begin = reinterpret_cast<const uint8_t*>(&*cursor);
+        if (!set.contains(*begin))
+            return;
+
+        cursor += m_runLength(begin, begin + (end - cursor), set);
+    }
+
+    template<typename _It>
+    void SkipRun(_It&, _It, size_t, std::false_type) const
+    {
+    }
+
+    template<typename _Row, typename _It>
+    uint32_t Scan(_It start, _It end, _It& matchEnd, _It& scanEnd) const
+    {
+        const _Row* table = reinterpret_cast<const _Row*>(m_table);
+        const uint32_t* accept = m_accept;
+        const uint32_t* liveAfter = m_liveAfter;
+
+        uint32_t best = Program::NoToken;
+        size_t state = 1;
+        _It cursor = start;
+        while (cursor != end)
+        {
+            state = table[state * m_classes + ClassOf(CharCode(*cursor))];
+            ++cursor;
+            if (state == 0)
+                break;
+
+            if (accept[state] <= best && accept[state] != Program::NoToken)
+            {
+                best = accept[state];
+                matchEnd = cursor;
+            }
+            if (liveAfter[state] > best)
+                break;
+
+            // The rest of a run that loops on this state leaves it unchanged
+            if (m_stateRuns[state])
+            {
+                SkipRun(cursor, end, state, IsByteString<_It>());
+                if (accept[state] == best && best != Program::NoToken)
+                    matchEnd = cursor;
+            }
+        }
+        scanEnd = cursor;
+        return best;
+    }
+
+    template<typename _Row, typename _It>
+    uint32_t ScanMemoized(
+        _It start, 
+        _It end, 
+        _It& matchEnd, 
+        _It& scanEnd, 
+        ScanMemo& memo, 
+        size_t position) const
+    {
+        const _Row* table = reinterpret_cast<const _Row*>(m_table);
+
+        uint32_t best = Program::NoToken;
+        size_t state = 1;
+        size_t matched = position;
+        _It cursor = start;
+        memo.begin(position);
+        while (cursor != end)
+        {
+            state = table[state * m_classes + ClassOf(CharCode(*cursor))];
+            ++cursor;
+            ++position;
+            if (state == 0)
+                break;
+
+            memo.step(static_cast<uint32_t>(state));
+            if (m_accept[state] <= best && m_accept[state] != Program::NoToken)
+            {
+                best = m_accept[state];
+                matchEnd = cursor;
+                matched = position;
+            }
+            if (m_liveAfter[state] > best || 
+                memo.exhausted(static_cast<uint32_t>(state), position, best))
+            {
+                break;
+            }
+        }
+
+        memo.end(matched, best);
+        scanEnd = cursor;
+        return best;
+    }
+
+    uint32_t ClassOf(uint32_t c) const
+    {
+        if (c < 256)
+            return m_lowClasses[c];
+
+        auto it = std::upper_bound(
+            m_intervalStarts, 
+            m_intervalStarts + m_intervals, 
+            c);
+        return m_intervalClasses[it - m_intervalStarts - 1];
+    }
+
+    // Subset construction: state 0 is the empty set, state 1 the start
+    static bool Construct(
+        const Program& program, 
+        size_t maxStates,
+        std::vector<uint32_t>& transitions,
+        std::vector<uint32_t>& accept)
+    {
+        const size_t classes = program.classes();
+        std::unordered_map<std::vector<uint32_t>, uint32_t, PositionSetHash> index;
+        std::vector<const std::vector<uint32_t>*> sets;
+        std::vector<uint32_t> next;
+
+        std::vector<uint32_t> initial[2] = { 
+            std::vector<uint32_t>(), 
+            std::vector<uint32_t>(1, 0) };
+        for (auto& set : initial)
+        {
+            auto inserted = index.insert(std::make_pair(
+                set, 
+                static_cast<uint32_t>(sets.size())));
+            sets.push_back(&inserted.first->first);
+            accept.push_back(program.accepts(set));
+        }
+
+        for (size_t state = 0; state < sets.size(); ++state)
+        {
+            for (uint32_t cls = 0; cls < classes; ++cls)
+            {
+                program.step(*sets[state], program.representative(cls), next);
+                auto inserted = index.insert(std::make_pair(
+                    next, 
+                    static_cast<uint32_t>(sets.size())));
+                if (inserted.second)
+                {
+                    if (sets.size() >= maxStates)
+                        return false;
+                    sets.push_back(&inserted.first->first);
+                    accept.push_back(program.accepts(next));
+                }
+                transitions.push_back(inserted.first->second);
+            }
+        }
+        return true;
+    }
+
+    // Hopcroft's algorithm. States are initially split by the definition 
+    // they accept, since scan() only ever looks at that. Returns the block
+    // (equivalence class) of every state.
+    static std::vector<uint32_t> Minimize(
+        const std::vector<uint32_t>& transitions,
+        const std::vector<uint32_t>& accept,
+        size_t states,
+        size_t classes)
+    {
+        struct Block
+        {
+            uint32_t First;
+            uint32_t End;
+            uint32_t Marked;
+            bool Queued;
+        };
+
+        // Inverse transitions, grouped by (class, target)
+        std::vector<uint32_t> offsets(classes * states + 1, 0);
+        std::vector<uint32_t> sources(classes * states);
+        for (size_t s = 0; s < states; ++s)
+        {
+            for (size_t a = 0; a < classes; ++a)
+                ++offsets[a * states + transitions[s * classes + a] + 1];
+        }
+        for (size_t i = 1; i < offsets.size(); ++i)
+            offsets[i] += offsets[i - 1];
+        {
+            std::vector<uint32_t> fill(std::begin(offsets), std::end(offsets) - 1);
+            for (size_t s = 0; s < states; ++s)
+            {
+                for (size_t a = 0; a < classes; ++a)
+                {
+                    size_t key = a * states + transitions[s * classes + a];
+                    sources[fill[key]++] = static_cast<uint32_t>(s);
+                }
+            }
+        }
+
+        // The partition: elements holds the states of each block contiguously
+        std::vector<uint32_t> elements(states);
+        std::vector<uint32_t> where(states);
+        std::vector<uint32_t> block(states);
+        std::vector<Block> blocks;
+        std::vector<uint32_t> worklist;
+
+        for (uint32_t s = 0; s < states; ++s)
+            elements[s] = s;
+        std::stable_sort(std::begin(elements), std::end(elements), 
+            [&](uint32_t a, uint32_t b) { return accept[a] < accept[b]; });
+        for (uint32_t i = 0; i < states; ++i)
+        {
+            uint32_t s = elements[i];
+            where[s] = i;
+            if (i == 0 || accept[s] != accept[elements[i - 1]])
+            {
+                Block b = { i, i, 0, true };
+                worklist.push_back(static_cast<uint32_t>(blocks.size()));
+                blocks.push_back(b);
+            }
+            block[s] = static_cast<uint32_t>(blocks.size() - 1);
+            ++blocks.back().End;
+        }
+
+        std::vector<uint32_t> splitter;
+        std::vector<uint32_t> touched;
+        while (!worklist.empty())
+        {
+            uint32_t b = worklist.back();
+            worklist.pop_back();
+            blocks[b].Queued = false;
+            splitter.assign(
+                std::begin(elements) + blocks[b].First, 
+                std::begin(elements) + blocks[b].End);
+
+            for (size_t a = 0; a < classes; ++a)
+            {
+                // Mark the predecessors of the splitter on a, moving them to
+                // the front of their blocks
+                touched.clear();
+                for (uint32_t t : splitter)
+                {
+                    for (uint32_t i = offsets[a * states + t]; 
+                         i < offsets[a * states + t + 1]; 
+                         ++i)
+                    {
+                        uint32_t s = sources[i];
+                        Block& y = blocks[block[s]];
+                        uint32_t marked = y.First + y.Marked;
+                        if (where[s] < marked)
+                            continue;
+
+                        uint32_t other = elements[marked];
+                        elements[where[s]] = other;
+                        where[other] = where[s];
+                        elements[marked] = s;
+                        where[s] = marked;
+                        if (y.Marked++ == 0)
+                            touched.push_back(block[s]);
+                    }
+                }
+
+                // Split each touched block into its marked and unmarked parts
+                for (uint32_t y : touched)
+                {
+                    uint32_t marked = blocks[y].Marked;
+                    blocks[y].Marked = 0;
+                    if (marked == blocks[y].End - blocks[y].First)
+                        continue;
+
+                    Block z = { blocks[y].First, blocks[y].First + marked, 0, false };
+                    blocks[y].First = z.End;
+                    uint32_t zi = static_cast<uint32_t>(blocks.size());
+                    blocks.push_back(z);
+                    for (uint32_t i = z.First; i < z.End; ++i)
+                        block[elements[i]] = zi;
+
+                    // If y is still to be processed, both halves must be;
+                    // otherwise the smaller half is enough
+                    uint32_t queue = zi;
+                    if (!blocks[y].Queued && 
+                        blocks[y].End - blocks[y].First < z.End - z.First)
+                    {
+                        queue = y;
+                    }
+                    blocks[queue].Queued = true;
+                    worklist.push_back(queue);
+                }
+            }
+        }
+        return block;
+    }
+
+    // Number the minimized states (dead first, then breadth-first from the 
+    // start so that likely neighbours share cache lines) and lay out tables
+    bool Assemble(
+        const Program& program,
+        const std::vector<uint32_t>& transitions,
+        const std::vector<uint32_t>& accept,
+        const std::vector<uint32_t>& blocks,
+        std::pmr::memory_resource* resource)
+    {
+        const size_t classes = program.classes();
+        const uint32_t unnumbered = ~0u;
+        std::vector<uint32_t> number(transitions.size() / classes + 1, unnumbered);
+        std::vector<uint32_t> order;
+
+        // The start state always gets its own number, even if it is dead
+        number[blocks[0]] = 0;
+        order.push_back(0);
+        order.push_back(1);
+        if (blocks[1] != blocks[0])
+            number[blocks[1]] = 1;
+
+        for (size_t i = 1; i < order.size(); ++i)
+        {
+            for (size_t a = 0; a < classes; ++a)
+            {
+                uint32_t t = transitions[order[i] * classes + a];
+                if (number[blocks[t]] == unnumbered)
+                {
+                    number[blocks[t]] = static_cast<uint32_t>(order.size());
+                    order.push_back(t);
+                }
+            }
+        }
+
+        const size_t states = order.size();
+        const size_t width = states <= 0x100 ? 1 : 2;
+        if (states > 0x10000)
+            return false;
+
+        std::vector<uint32_t> table(states * classes, 0);
+        std::vector<uint32_t> accepts(states);
+        for (size_t s = 0; s < states; ++s)
+        {
+            accepts[s] = s == 0 ? Program::NoToken : accept[order[s]];
+            for (size_t a = 0; a < classes && s != 0; ++a)
+                table[s * classes + a] = number[blocks[transitions[order[s] * classes + a]]];
+        }
+        std::vector<uint32_t> liveAfter = LiveAfter(table, accepts, classes);
+
+        // The bytes that loop on each state, with each distinct set kept once
+        std::vector<uint16_t> stateRuns(states, 0);
+        std::vector<ByteSet> runSets;
+        std::unordered_map<std::string, uint16_t> runIndex;
+        for (size_t s = 1; s < states; ++s)
+        {
+            ByteSet set = ByteSet();
+            bool loops = false;
+            for (uint32_t c = 0; c < 256; ++c)
+            {
+                if (table[s * classes + program.classOf(c)] == s)
+                {
+                    set.add(static_cast<uint8_t>(c));
+                    loops = true;
+                }
+            }
+            if (!loops)
+                continue;
+
+            std::string key(reinterpret_cast<const char*>(&set), sizeof(set));
+            auto inserted = runIndex.insert(std::make_pair(
+                key, 
+                static_cast<uint16_t>(runSets.size() + 1)));
+            if (inserted.second)
+                runSets.push_back(set);
+            stateRuns[s] = inserted.first->second;
+        }
+
+        // Lay the tables out in one block
+        Header header = Header();
+        header.States = static_cast<uint32_t>(states);
+        header.Classes = static_cast<uint32_t>(classes);
+        header.StateBytes = static_cast<uint32_t>(width);
+        header.Intervals = static_cast<uint32_t>(program.intervalStarts().size());
+        header.Table = Align(sizeof(Header));
+        header.Accept = Align(header.Table + table.size() * width);
+        header.LiveAfter = Align(header.Accept + states * 4);
+        header.LowClasses = Align(header.LiveAfter + states * 4);
+        header.IntervalStarts = Align(header.LowClasses + 256 * 2);
+        header.IntervalClasses = Align(header.IntervalStarts + header.Intervals * 4);
+        header.RunSets = static_cast<uint32_t>(runSets.size());
+        header.StateRuns = Align(header.IntervalClasses + header.Intervals * 4);
+        header.RunSetTable = Align(header.StateRuns + states * 2);
+        header.Size = Align(header.RunSetTable + runSets.size() * sizeof(ByteSet));
+
+        const size_t size = static_cast<size_t>(header.Size);
+        uint8_t* base = static_cast<uint8_t*>(resource->allocate(size, BlockAlignment));
+        m_owner = std::shared_ptr<const void>(
+            base, 
+            [resource, size](const void* block)
+            {
+                resource->deallocate(const_cast<void*>(block), size, BlockAlignment);
+            },
+            std::pmr::polymorphic_allocator<uint8_t>(resource));
+        std::memset(base, 0, size);
+        std::memcpy(base, &header, sizeof(header));
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            if (width == 1)
+                base[header.Table + i] = static_cast<uint8_t>(table[i]);
+            else
+                reinterpret_cast<uint16_t*>(base + header.Table)[i] = 
+                    static_cast<uint16_t>(table[i]);
+        }
+        std::memcpy(base + header.Accept, accepts.data(), states * 4);
+        std::memcpy(base + header.LiveAfter, liveAfter.data(), states * 4);
+        for (uint32_t c = 0; c < 256; ++c)
+        {
+            reinterpret_cast<uint16_t*>(base + header.LowClasses)[c] = 
+                static_cast<uint16_t>(program.classOf(c));
+        }
+        std::memcpy(base + header.IntervalStarts, 
+            program.intervalStarts().data(), header.Intervals * 4);
+        std::memcpy(base + header.IntervalClasses, 
+            program.intervalClasses().data(), header.Intervals * 4);
+        std::memcpy(base + header.StateRuns, stateRuns.data(), states * 2);
+        if (!runSets.empty())
+        {
+            std::memcpy(base + header.RunSetTable, 
+                runSets.data(), runSets.size() * sizeof(ByteSet));
+        }
+
+        Bind(base);
+        return true;
+    }
+
+    static uint64_t Align(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    std::shared_ptr<const void> m_owner;
+    const void* m_data;
+    const uint8_t* m_table;
+    const uint32_t* m_accept;
+    const uint32_t* m_liveAfter;
+    const uint16_t* m_lowClasses;
+    const uint32_t* m_intervalStarts;
+    const uint32_t* m_intervalClasses;
+    const uint16_t* m_stateRuns;
+    const ByteSet* m_runSetTable;
+    size_t (*m_runLength)(const uint8_t*, const uint8_t*, const ByteSet&);
+    size_t m_states;
+    size_t m_classes;
+    size_t m_width;
+    size_t m_intervals;
+    size_t m_runSets;
+};
+
+//-----------------------------------------------------------------------------
+// Works out how each definition of a Program behaves in a Lexer, for 
+// Lexer::analyzeDefinitions(). The combined behaviour comes from the subset
+// automaton that compile() builds, explored together with the definition a
+// scan would pick so far; the rest comes from each definition's own
+// Glushkov automaton.
+//-----------------------------------------------------------------------------
+class DefinitionAnalysis
+{
+public:
+    static constexpr size_t Unbounded = ~size_t(0);
+
+    // Ambiguity is only checked in definitions with up to this many positions
+    // on loops
+    static constexpr size_t MaxAmbiguityPositions = 1024;
+
+    // What is found out about one definition. ShadowedBy holds the indices
+    // of the definitions that win wherever it matches, if it never wins.
+    struct Result
+    {
+        bool CanWin;
+        std::vector<uint32_t> ShadowedBy;
+        size_t MaxLength;
+        bool ReadsPastMatch;
+        bool Ambiguous;
+    };
+
+    // Analyze the definitions of program, whose automata are nfas. Returns
+    // false if the subset automaton has more than maxStates states or a 
+    // definition is too large to check for ambiguity; what couldn't be 
+    // checked is then reported as harmless.
+    bool analyze(
+        const Program& program, 
+        const std::vector<GlushkovNfa>& nfas, 
+        size_t maxStates)
+    {
+        Result harmless;
+        harmless.CanWin = true;
+        harmless.MaxLength = 0;
+        harmless.ReadsPastMatch = false;
+        harmless.Ambiguous = false;
+        m_results.assign(nfas.size(), harmless);
+
+        bool complete = true;
+        for (size_t d = 0; d < nfas.size(); ++d)
+            complete &= Single(nfas[d], m_results[d]);
+        return Combined(program, maxStates) && complete;
+    }
+
+    const std::vector<Result>& results() const
+    {
+        return m_results;
+    }
+
+private:
+
+    static constexpr uint32_t Unreached = ~0u;
+
+    // Tarjan's algorithm, without recursion, over the nodes reachable from
+    // roots. successors(v, out) lists the successors of node v in out. Sets 
+    // the component of every node reached (Unreached for the rest), and 
+    // whether each component has a cycle. Components are numbered so that 
+    // edges only lead to the same or a lower number.
+    template<typename _Successors>
+    static void Components(
+        size_t nodes,
+        const std::vector<uint32_t>& roots,
+        _Successors successors,
+        std::vector<uint32_t>& component,
+        std::vector<uint8_t>& cyclic)
+    {
+        struct Frame
+        {
+            uint32_t Node;
+            size_t Begin;
+            size_t Next;
+            size_t End;
+            bool SelfLoop;
+        };
+
+        std::vector<uint32_t> index(nodes, Unreached);
+        std::vector<uint32_t> low(nodes, 0);
+        std::vector<uint32_t> stack;
+        std::vector<uint32_t> edges;
+        std::vector<uint32_t> out;
+        std::vector<Frame> frames;
+        uint32_t counter = 0;
+        component.assign(nodes, Unreached);
+        cyclic.clear();
+
+        auto enter = [&](uint32_t v)
+        {
+            index[v] = low[v] = counter++;
+            stack.push_back(v);
+            out.clear();
+            successors(v, out);
+            Frame frame = { v, edges.size(), edges.size(), edges.size() + out.size(), false };
+            edges.insert(std::end(edges), std::begin(out), std::end(out));
+            frames.push_back(frame);
+        };
+
+        for (uint32_t root : roots)
+        {
+            if (index[root] != Unreached)
+                continue;
+
+            enter(root);
+            while (!frames.empty())
+            {
+                Frame& frame = frames.back();
+                if (frame.Next < frame.End)
+                {
+                    uint32_t v = frame.Node;
+                    uint32_t w = edges[frame.Next++];
+                    if (w == v)
+                        frame.SelfLoop = true;
+                    if (index[w] == Unreached)
+                        enter(w);
+                    else if (component[w] == Unreached)
+                        low[v] = std::min(low[v], index[w]);
+                    continue;
+                }
+
+                uint32_t v = frame.Node;
+                bool selfLoop = frame.SelfLoop;
+                edges.resize(frame.Begin);
+                frames.pop_back();
+                if (!frames.empty())
+                {
+                    uint32_t parent = frames.back().Node;
+                    low[parent] = std::min(low[parent], low[v]);
+                }
+                if (low[v] != index[v])
+                    continue;
+
+                uint32_t number = static_cast<uint32_t>(cyclic.size());
+                size_t members = 0;
+                uint32_t w;
+                do
+                {
+                    w = stack.back();
+                    stack.pop_back();
+                    component[w] = number;
+                    ++members;
+                } while (w != v);
+                cyclic.push_back(members > 1 || selfLoop);
+            }
+        }
+    }
+
+    // The longest match of a definition, and whether it is ambiguous: 
+    // whether some input can take it from a position back to the same 
+    // position in two different ways. A backtracking matcher may then try 
+    // exponentially many ways through a run of that input.
+    static bool Single(const GlushkovNfa& nfa, Result& result)
+    {
+        const size_t n = nfa.size();
+        std::vector<uint32_t> roots(n);
+        for (uint32_t p = 0; p < n; ++p)
+            roots[p] = p;
+
+        std::vector<uint32_t> component;
+        std::vector<uint8_t> cyclic;
+        Components(n, roots, 
+            [&](uint32_t p, std::vector<uint32_t>& out) { out = nfa.Follow[p]; },
+            component, cyclic);
+
+        // Components come in reverse topological order, so the longest match
+        // from each position can be found in order of component
+        if (std::find(std::begin(cyclic), std::end(cyclic), 1) != std::end(cyclic))
+        {
+            result.MaxLength = Unbounded;
+        } else {
+            std::vector<uint8_t> last(n, 0);
+            for (uint32_t p : nfa.Last)
+                last[p] = 1;
+            std::vector<uint32_t> order(n);
+            for (uint32_t p = 0; p < n; ++p)
+                order[component[p]] = p;
+
+            std::vector<size_t> longest(n, 0);
+            for (uint32_t p : order)
+            {
+                size_t after = 0;
+                for (uint32_t q : nfa.Follow[p])
+                    after = std::max(after, longest[q]);
+                longest[p] = after || last[p] ? after + 1 : 0;
+            }
+            result.MaxLength = 0;
+            for (uint32_t p : nfa.First)
+                result.MaxLength = std::max(result.MaxLength, longest[p]);
+        }
+
+        for (auto& pair : nfa.Repeated)
+        {
+            uint32_t c = component[pair.first];
+            if (c == component[pair.second] && cyclic[c])
+            {
+                result.Ambiguous = true;
+                return true;
+            }
+        }
+        // Run two copies of the automaton over the same input: it is 
+        // ambiguous if a pair of equal positions and a pair of different 
+        // ones lie on a common cycle. Only positions on cycles can be part
+        // of one.
+        std::vector<uint32_t> looping;
+        std::vector<uint32_t> local(n, Unreached);
+        for (uint32_t p = 0; p < n; ++p)
+        {
+            if (cyclic[component[p]])
+            {
+                local[p] = static_cast<uint32_t>(looping.size());
+                looping.push_back(p);
+            }
+        }
+        const size_t m = looping.size();
+        if (m > MaxAmbiguityPositions)
+            return false;
+
+        std::vector<uint32_t> pairRoots;
+        for (uint32_t i = 0; i < m; ++i)
+            pairRoots.push_back(static_cast<uint32_t>(i * m + i));
+        Components(m * m, pairRoots, 
+            [&](uint32_t pair, std::vector<uint32_t>& out)
+            {
+                for (uint32_t p : nfa.Follow[looping[pair / m]])
+                {
+                    for (uint32_t q : nfa.Follow[looping[pair % m]])
+                    {
+                        if (local[p] != Unreached && local[q] != Unreached &&
+                            nfa.Chars[p].intersects(nfa.Chars[q]))
+                            out.push_back(static_cast<uint32_t>(local[p] * m + local[q]));
+                    }
+                }
+            },
+            component, cyclic);
+
+        std::vector<uint8_t> kinds(cyclic.size(), 0);
+        for (size_t pair = 0; pair < m * m; ++pair)
+        {
+            if (component[pair] != Unreached)
+                kinds[component[pair]] |= pair / m == pair % m ? 1 : 2;
+        }
+        result.Ambiguous = std::find(std::begin(kinds), std::end(kinds), 3) != std::end(kinds);
+        return true;
+    }
+
+    // Explore the subset automaton with the definition a scan would pick so
+    // far, as LazyDfa::scan() and DenseDfa::scan() run it
+    bool Combined(const Program& program, size_t maxStates)
+    {
+        const size_t classes = program.classes();
+        const size_t definitions = program.definitions();
+        std::unordered_map<std::vector<uint32_t>, uint32_t, PositionSetHash> index;
+        std::vector<const std::vector<uint32_t>*> sets;
+        std::vector<uint32_t> transitions;
+        std::vector<uint32_t> accept;
+        std::vector<uint32_t> next;
+
+        // State 0 is the empty set, state 1 the start
+        std::vector<uint32_t> initial[2] = { 
+            std::vector<uint32_t>(), 
+            std::vector<uint32_t>(1, 0) };
+        for (auto& set : initial)
+        {
+            auto inserted = index.insert(std::make_pair(
+                set, 
+                static_cast<uint32_t>(sets.size())));
+            sets.push_back(&inserted.first->first);
+            accept.push_back(program.accepts(set));
+        }
+        for (size_t state = 0; state < sets.size(); ++state)
+        {
+            for (uint32_t cls = 0; cls < classes; ++cls)
+            {
+                program.step(*sets[state], program.representative(cls), next);
+                auto inserted = index.insert(std::make_pair(
+                    next, 
+                    static_cast<uint32_t>(sets.size())));
+                if (inserted.second)
+                {
+                    if (sets.size() >= maxStates)
+                        return false;
+                    sets.push_back(&inserted.first->first);
+                    accept.push_back(program.accepts(next));
+                }
+                transitions.push_back(inserted.first->second);
+            }
+        }
+        const size_t states = sets.size();
+        std::vector<uint32_t> liveAfter = 
+            DenseDfa::LiveAfter(transitions, accept, classes);
+
+        // A pair of state and best definition so far is numbered 
+        // state * width + best, with best == definitions for none yet. The
+        // scan stops at a pair once no definition it could still reach 
+        // would beat best.
+        const size_t width = definitions + 1;
+        auto best = [&](size_t pair) -> uint32_t
+        {
+            size_t b = pair % width;
+            return b == definitions ? Program::NoToken : static_cast<uint32_t>(b);
+        };
+        auto stops = [&](size_t pair)
+        {
+            return liveAfter[pair / width] > best(pair);
+        };
+
+        std::vector<uint8_t> visited(states * width, 0);
+        std::vector<size_t> worklist(1, 1 * width + definitions);
+        visited[worklist[0]] = 1;
+        while (!worklist.empty())
+        {
+            size_t pair = worklist.back();
+            worklist.pop_back();
+            if (stops(pair))
+                continue;
+
+            for (size_t cls = 0; cls < classes; ++cls)
+            {
+                uint32_t target = transitions[pair / width * classes + cls];
+                if (target == 0)
+                    continue;
+                size_t b = std::min<size_t>(pair % width, 
+                    accept[target] == Program::NoToken ? definitions : accept[target]);
+                size_t reached = target * width + b;
+                if (!visited[reached])
+                {
+                    visited[reached] = 1;
+                    worklist.push_back(reached);
+                }
+            }
+        }
+
+        // A definition wins if a scan can end with it as best. If it can't,
+        // the definitions that are best while it is part way through a match
+        // shadow it.
+        std::vector<std::vector<uint32_t> > byBest(width);
+        for (size_t pair = 0; pair < visited.size(); ++pair)
+        {
+            if (visited[pair])
+                byBest[pair % width].push_back(static_cast<uint32_t>(pair / width));
+        }
+        for (size_t d = 0; d < definitions; ++d)
+            m_results[d].CanWin = !byBest[d].empty();
+        for (size_t b = 0; b < definitions; ++b)
+        {
+            for (uint32_t state : byBest[b])
+            {
+                for (uint32_t p : *sets[state])
+                {
+                    uint32_t d = program.owner(p);
+                    if (d > b && !m_results[d].CanWin)
+                        m_results[d].ShadowedBy.push_back(static_cast<uint32_t>(b));
+                }
+            }
+        }
+        for (auto& result : m_results)
+        {
+            auto& shadows = result.ShadowedBy;
+            std::sort(std::begin(shadows), std::end(shadows));
+            shadows.erase(std::unique(std::begin(shadows), std::end(shadows)), std::end(shadows));
+        }
+
+        // A scan reads without limit past the match it returns if it can go
+        // round a cycle of states that keep best but don't accept it. The
+        // definitions that keep it going are to blame.
+        std::vector<uint32_t> component;
+        std::vector<uint8_t> cyclic;
+        std::vector<uint8_t> past(states);
+        for (size_t b = 0; b < width; ++b)
+        {
+            if (byBest[b].empty())
+                continue;
+
+            std::fill(std::begin(past), std::end(past), 0);
+            for (uint32_t state : byBest[b])
+            {
+                size_t pair = state * width + b;
+                past[state] = !stops(pair) && 
+                    (accept[state] == Program::NoToken || accept[state] > best(pair));
+            }
+            Components(states, byBest[b], 
+                [&](uint32_t state, std::vector<uint32_t>& out)
+                {
+                    if (!past[state])
+                        return;
+                    for (size_t cls = 0; cls < classes; ++cls)
+                    {
+                        uint32_t target = transitions[state * classes + cls];
+                        if (past[target])
+                            out.push_back(target);
+                    }
+                },
+                component, cyclic);
+
+            for (uint32_t state : byBest[b])
+            {
+                if (!past[state] || !cyclic[component[state]])
+                    continue;
+                for (uint32_t p : *sets[state])
+                {
+                    uint32_t d = program.owner(p);
+                    if (d <= b)
+                        m_results[d].ReadsPastMatch = true;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::vector<Result> m_results;
+};
+
+//-----------------------------------------------------------------------------
+// A mutex that copies as a new, unlocked mutex, so that a class holding one 
+// keeps its implicit copy constructor and assignment.
+//-----------------------------------------------------------------------------
+class CopyableMutex : public std::mutex
+{
+public:
+
+    CopyableMutex()
+    {
+    }
+
+    CopyableMutex(const CopyableMutex&)
+        : std::mutex()
+    {
+    }
+
+    CopyableMutex& operator =(const CopyableMutex&)
+    {
+        return *this;
+    }
+};
+
+//-----------------------------------------------------------------------------
+// Maps the keywords of a language to their token identifiers with a perfect
+// hash, so that a lexeme can be classified with one hash and one comparison
+// however many keywords there are. The hash is found when the table is built
+// by "hash and displace": keywords are grouped into buckets by one hash, and
+// each bucket is given a seed for a second hash that sends all of its 
+// keywords to free slots (or, for a bucket of one, the slot itself).
+//
+// Like DenseDfa, the hash tables and the keywords' spellings live in one 
+// block of memory that uses offsets rather than pointers, so that a Lexer 
+// image can carry the table and use it straight from a memory mapping (see
+// attach()). Copies of a table share its memory.
+//-----------------------------------------------------------------------------
+template<typename _String, typename _TokenID>
+class KeywordTable
+{
+public:
+    typedef std::pair<_String, _TokenID> Keyword;
+    typedef typename _String::value_type _Char;
+
+    KeywordTable()
+    {
+        Bind(nullptr, nullptr);
+    }
+
+    // If a keyword is listed twice, the first entry wins
+    explicit KeywordTable(const std::vector<Keyword>& keywords)
+    {
+        Bind(nullptr, nullptr);
+        std::vector<Keyword> unique;
+        for (auto& keyword : keywords)
+        {
+            bool duplicate = false;
+            for (auto& existing : unique)
+                duplicate |= existing.first == keyword.first;
+            if (!duplicate)
+                unique.push_back(keyword);
+        }
+        if (!unique.empty())
+            Build(unique);
+    }
+
+    bool empty() const
+    {
+        return m_count == 0;
+    }
+
+    // The number of keywords
+    size_t size() const
+    {
+        return m_count;
+    }
+
+    // The spelling and identifier of keyword k, in the order they were given
+    _String spelling(size_t k) const
+    {
+        return _String(m_chars + m_entries[k].Offset, 
+            m_chars + m_entries[k].Offset + m_entries[k].Length);
+    }
+
+    const _TokenID& id(size_t k) const
+    {
+        return m_ids[k];
+    }
+
+    // The identifier of the keyword spelled by [begin, end), or nullptr
+    template<typename _It>
+    const _TokenID* find(_It begin, _It end) const
+    {
+        if (!m_count)
+            return nullptr;
+
+        uint32_t hash = Hash(begin, end, 0);
+        int32_t displace = m_displace[hash % m_buckets];
+        uint32_t slot = displace < 0 ? 
+            static_cast<uint32_t>(-displace - 1) : 
+            Hash(begin, end, displace) % m_slotCount;
+        if (m_slots[slot] == Empty)
+            return nullptr;
+
+        const Entry& entry = m_entries[m_slots[slot]];
+        if (static_cast<size_t>(std::distance(begin, end)) != entry.Length ||
+            !std::equal(begin, end, m_chars + entry.Offset))
+        {
+            return nullptr;
+        }
+        return &m_ids[m_slots[slot]];
+    }
+
+    size_t memoryUsage() const
+    {
+        return m_count ? 
+            static_cast<size_t>(m_header->Size) + m_count * sizeof(_TokenID) : 0;
+    }
+
+    // Append the table to out: the block, then the identifiers. attach() 
+    // needs it at an 8-byte aligned offset.
+    void serialize(std::vector<uint8_t>& out) const
+    {
+        static_assert(std::is_trivially_copyable<_TokenID>::value, 
+            "serialize() copies token identifiers byte for byte");
+        if (!m_count)
+            return;
+        const uint8_t* block = reinterpret_cast<const uint8_t*>(m_header);
+        out.insert(out.end(), block, block + m_header->Size);
+        const uint8_t* ids = reinterpret_cast<const uint8_t*>(m_ids);
+        out.insert(out.end(), ids, ids + m_count * sizeof(_TokenID));
+    }
+
+    // Use a table of count keywords written by serialize() in place, without
+    // copying it. The memory must be 8-byte aligned and stay valid while the
+    // table, or any copy of it, uses it; owner is kept alive for that 
+    // purpose. Returns the number of bytes used, or 0 if the table is 
+    // malformed.
+    size_t attach(
+        const void* data, 
+        size_t size, 
+        size_t count, 
+        std::shared_ptr<const void> owner)
+    {
+        static_assert(alignof(_TokenID) <= 8, 
+            "attach() reads token identifiers in place");
+        Bind(nullptr, nullptr);
+        if (!count)
+            return 0;
+
+        const Header* header = static_cast<const Header*>(data);
+        if (reinterpret_cast<uintptr_t>(data) % 8 != 0 || 
+            size < sizeof(Header) || 
+            header->Size > size ||
+            header->Size % 8 != 0 ||
+            header->Keywords != count ||
+            header->Buckets == 0 ||
+            header->Slots < count ||
+            !Fits(*header, header->Entries, count * uint64_t(sizeof(Entry))) ||
+            !Fits(*header, header->Displace, header->Buckets * 4ull) ||
+            !Fits(*header, header->SlotTable, header->Slots * 4ull) ||
+            !Fits(*header, header->Chars, header->CharCount * uint64_t(sizeof(_Char))) ||
+            (size - header->Size) / sizeof(_TokenID) < count)
+        {
+            return 0;
+        }
+
+        const uint8_t* base = static_cast<const uint8_t*>(data);
+        Bind(header, reinterpret_cast<const _TokenID*>(base + header->Size));
+        if (!Consistent())
+        {
+            Bind(nullptr, nullptr);
+            return 0;
+        }
+
+        m_owner = owner;
+        return static_cast<size_t>(header->Size) + count * sizeof(_TokenID);
+    }
+
+private:
+
+    static constexpr uint32_t Empty = ~0u;
+
+    // The block starts with a Header giving the offsets of its tables: an 
+    // Entry for each keyword, the seed or slot for each bucket, the keyword
+    // for each slot (or Empty), and the keywords' characters
+    struct Header
+    {
+        uint32_t Keywords;
+        uint32_t Buckets;
+        uint32_t Slots;
+        uint32_t CharCount;
+        uint64_t Entries;
+        uint64_t Displace;
+        uint64_t SlotTable;
+        uint64_t Chars;
+        uint64_t Size;
+    };
+
+    // Where a keyword's spelling is in the block's characters
+    struct Entry
+    {
+        uint32_t Offset;
+        uint32_t Length;
+    };
+
+    // The memory of a table built in place
+    struct Storage
+    {
+        std::vector<uint64_t> Block;
+        std::vector<_TokenID> Ids;
+    };
+
+    static uint64_t Align(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    static bool Fits(const Header& header, uint64_t offset, uint64_t bytes)
+    {
+        return offset % 8 == 0 && 
+            offset >= sizeof(Header) && 
+            offset <= header.Size && 
+            bytes <= header.Size - offset;
+    }
+
+    template<typename _It>
+    static uint32_t Hash(_It begin, _It end, int32_t seed)
+    {
+        uint32_t hash = 2166136261u ^ (static_cast<uint32_t>(seed) * 0x9E3779B9u);
+        for ( ; begin != end; ++begin)
+        {
+            hash ^= CharCode(*begin);
+            hash *= 16777619u;
+        }
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6Bu;
+        hash ^= hash >> 13;
+        return hash;
+    }
+
+    void Bind(const Header* header, const _TokenID* ids)
+    {
+        m_owner.reset();
+        m_header = header;
+        m_ids = ids;
+        m_count = 0;
+        m_buckets = 0;
+        m_slotCount = 0;
+        m_entries = nullptr;
+        m_displace = nullptr;
+        m_slots = nullptr;
+        m_chars = nullptr;
+        if (!header)
+            return;
+
+        const uint8_t* base = reinterpret_cast<const uint8_t*>(header);
+        m_count = header->Keywords;
+        m_buckets = header->Buckets;
+        m_slotCount = header->Slots;
+        m_entries = reinterpret_cast<const Entry*>(base + header->Entries);
+        m_displace = reinterpret_cast<const int32_t*>(base + header->Displace);
+        m_slots = reinterpret_cast<const uint32_t*>(base + header->SlotTable);
+        m_chars = reinterpret_cast<const _Char*>(base + header->Chars);
+    }
+
+    // Check that every slot, keyword and spelling in the tables is in range,
+    // so that find() cannot read outside them
+    bool Consistent() const
+    {
+        for (size_t k = 0; k < m_count; ++k)
+        {
+            if (m_entries[k].Offset > m_header->CharCount ||
+                m_entries[k].Length > m_header->CharCount - m_entries[k].Offset)
+            {
+                return false;
+            }
+        }
+        for (size_t b = 0; b < m_buckets; ++b)
+        {
+            if (m_displace[b] < 0 && 
+                static_cast<uint32_t>(-(m_displace[b] + 1)) >= m_slotCount)
+            {
+                return false;
+            }
+        }
+        for (size_t s = 0; s < m_slotCount; ++s)
+        {
+            if (m_slots[s] != Empty && m_slots[s] >= m_count)
+                return false;
+        }
+        return true;
+    }
+
+    void Build(const std::vector<Keyword>& keywords)
+    {
+        const size_t count = keywords.size();
+        std::vector<std::vector<uint32_t> > buckets((count + 1) / 2);
+        for (uint32_t k = 0; k < count; ++k)
+        {
+            const _String& word = keywords[k].first;
+            buckets[Hash(std::begin(word), std::end(word), 0) % buckets.size()].push_back(k);
+        }
+
+        std::vector<uint32_t> order(buckets.size());
+        for (uint32_t b = 0; b < order.size(); ++b)
+            order[b] = b;
+        std::stable_sort(std::begin(order), std::end(order), 
+            [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        // A bucket of n keywords needs a seed that sends them to n distinct
+        // free slots; the search is short while the table stays sparse enough
+        std::vector<int32_t> displace;
+        std::vector<uint32_t> slots;
+        for (size_t slotCount = count; ; slotCount += slotCount / 4 + 1)
+        {
+            displace.assign(buckets.size(), 0);
+            slots.assign(slotCount, Empty);
+            if (Place(keywords, buckets, order, displace, slots))
+                break;
+        }
+        Assemble(keywords, displace, slots);
+    }
+
+    static bool Place(
+        const std::vector<Keyword>& keywords,
+        const std::vector<std::vector<uint32_t> >& buckets,
+        const std::vector<uint32_t>& order,
+        std::vector<int32_t>& displace,
+        std::vector<uint32_t>& slots)
+    {
+        static constexpr int32_t MaxSeed = 1 << 12;
+
+        std::vector<uint32_t> placed;
+        uint32_t nextFree = 0;
+        for (uint32_t b : order)
+        {
+            const std::vector<uint32_t>& bucket = buckets[b];
+            if (bucket.empty())
+                break;
+
+            if (bucket.size() == 1)
+            {
+                while (slots[nextFree] != Empty)
+                    ++nextFree;
+                slots[nextFree] = bucket[0];
+                displace[b] = -static_cast<int32_t>(nextFree) - 1;
+                continue;
+            }
+
+            int32_t seed = 1;
+            for ( ; seed < MaxSeed; ++seed)
+            {
+                placed.clear();
+                for (uint32_t k : bucket)
+                {
+                    const _String& word = keywords[k].first;
+                    uint32_t slot = Hash(std::begin(word), std::end(word), seed) % 
+                        slots.size();
+                    if (slots[slot] != Empty || 
+                        std::find(std::begin(placed), std::end(placed), slot) != 
+                            std::end(placed))
+                    {
+                        break;
+                    }
+                    placed.push_back(slot);
+                }
+                if (placed.size() == bucket.size())
+                    break;
+            }
+            if (seed == MaxSeed)
+                return false;
+
+            for (size_t i = 0; i < bucket.size(); ++i)
+                slots[placed[i]] = bucket[i];
+            displace[b] = seed;
+        }
+        return true;
+    }
+
+    // Lay the tables out in one block
+    void Assemble(
+        const std::vector<Keyword>& keywords,
+        const std::vector<int32_t>& displace,
+        const std::vector<uint32_t>& slots)
+    {
+        size_t chars = 0;
+        for (auto& keyword : keywords)
+            chars += keyword.first.size();
+
+        Header header = Header();
+        header.Keywords = static_cast<uint32_t>(keywords.size());
+        header.Buckets = static_cast<uint32_t>(displace.size());
+        header.Slots = static_cast<uint32_t>(slots.size());
+        header.CharCount = static_cast<uint32_t>(chars);
+        header.Entries = Align(sizeof(Header));
+        header.Displace = Align(header.Entries + keywords.size() * sizeof(Entry));
+        header.SlotTable = Align(header.Displace + displace.size() * sizeof(int32_t));
+        header.Chars = Align(header.SlotTable + slots.size() * sizeof(uint32_t));
+        header.Size = Align(header.Chars + chars * sizeof(_Char));
+
+        std::shared_ptr<Storage> storage = std::make_shared<Storage>();
+        storage->Block.assign(static_cast<size_t>(header.Size / 8), 0);
+        uint8_t* base = reinterpret_cast<uint8_t*>(storage->Block.data());
+        std::memcpy(base, &header, sizeof(header));
+        std::memcpy(base + header.Displace, displace.data(), displace.size() * sizeof(int32_t));
+        std::memcpy(base + header.SlotTable, slots.data(), slots.size() * sizeof(uint32_t));
+
+        Entry* entries = reinterpret_cast<Entry*>(base + header.Entries);
+        _Char* text = reinterpret_cast<_Char*>(base + header.Chars);
+        uint32_t offset = 0;
+        for (size_t k = 0; k < keywords.size(); ++k)
+        {
+            const _String& word = keywords[k].first;
+            entries[k].Offset = offset;
+            entries[k].Length = static_cast<uint32_t>(word.size());
+            std::copy(std::begin(word), std::end(word), text + offset);
+            offset += entries[k].Length;
+            storage->Ids.push_back(keywords[k].second);
+        }
+
+        Bind(reinterpret_cast<const Header*>(base), storage->Ids.data());
+        m_owner = storage;
+    }
+
+    std::shared_ptr<const void> m_owner;
+    const Header* m_header;
+    const _TokenID* m_ids;
+    size_t m_count;
+    size_t m_buckets;
+    size_t m_slotCount;
+    const Entry* m_entries;
+    const int32_t* m_displace;
+    const uint32_t* m_slots;
+    const _Char* m_chars;
+};
+
+//-----------------------------------------------------------------------------
+// A token found by Lexer::tokenize() or Lexer::relex().
+//     ID:        The token identifier of the definition that matched.
+//     Where:     The location of its first character.
+//     Length:    Its length in characters.
+//     Lookahead: How far past its start the Lexer read to find it (and to
+//                reject any characters it skipped just before it), plus one
+//                if it read up to the end of the input. An edit at or after
+//                Where.global + Lookahead can't change the token.
+//-----------------------------------------------------------------------------
+template<typename _TokenID>
+struct Token
+{
+    _TokenID ID;
+    Location Where;
+    size_t Length;
+    size_t Lookahead;
+};
+
+//-----------------------------------------------------------------------------
+// A compact token, as delivered in batches by Lexer::analyzeBatched().
+//     ID:     The token identifier of the definition that matched.
+//     Offset: The 0-based offset of its first character in the stream.
+//     Length: Its length in characters, which must be below 2^32.
+//     Line:   The line it starts on, which must be below 2^32. A text with
+//             more lines than that needs analyze() or tokenize().
+// Debug builds assert both limits; release builds keep the low 32 bits.
+//-----------------------------------------------------------------------------
+template<typename _TokenID>
+struct TokenRecord
+{
+    _TokenID ID;
+    size_t Offset;
+    uint32_t Length;
+    uint32_t Line;
+};
+
+//-----------------------------------------------------------------------------
+// The forms of number that Lexer::defineNumber() matches.
+//     NumberDecimal: Digits, like 42.
+//     NumberHex:     0x or 0X and hex digits, like 0x2A.
+//     NumberFloat:   Digits with a decimal point, an exponent or both, like
+//                    4.2, 42., .42, 42e-1 or 4.2E1. Digits alone are not a
+//                    float.
+//-----------------------------------------------------------------------------
+enum NumberFormat
+{
+    NumberDecimal = 1,
+    NumberHex = 2,
+    NumberFloat = 4,
+    NumberAny = NumberDecimal | NumberHex | NumberFloat
+};
+
+//-----------------------------------------------------------------------------
+// The value of a numeric token, worked out while it was matched.
+//     IsFloat:  Whether it is a NumberFloat.
+//     Integer:  The value of a decimal or hex integer, modulo 2^64 if it
+//               doesn't fit.
+//     Float:    The value of any number as a double, correctly rounded as
+//               by std::from_chars().
+//     Overflow: Whether an integer doesn't fit in 64 bits.
+//-----------------------------------------------------------------------------
+struct Number
+{
+    bool IsFloat;
+    uint64_t Integer;
+    double Float;
+    bool Overflow;
+};
+
+inline uint32_t DecimalDigit(uint32_t c)
+{
+    return c - '0';
+}
+
+inline uint32_t HexDigit(uint32_t c)
+{
+    if (c - '0' < 10)
+        return c - '0';
+    if ((c | 0x20) - 'a' < 6)
+        return (c | 0x20) - 'a' + 10;
+    return 16;
+}
+
+//-----------------------------------------------------------------------------
+// The double nearest to a decimal number in [begin, end), for the cases 
+// that the exact arithmetic in ScanNumber() can't settle. negligible tells
+// whether a value out of range is tiny rather than huge.
+//-----------------------------------------------------------------------------
+template<typename _It>
+double ParseFloat(_It begin, _It end, bool negligible)
+{
+    std::string text;
+    for ( ; begin != end; ++begin)
+        text += static_cast<char>(CharCode(*begin));
+
+#ifdef __cpp_lib_to_chars
+    double value = 0;
+    if (std::from_chars(text.data(), text.data() + text.size(), value).ec == 
+        std::errc::result_out_of_range)
+    {
+        value = negligible ? 0.0 : std::numeric_limits<double>::infinity();
+    }
+    return value;
+#else
+    // Assumes the "C" locale's decimal point
+    return std::strtod(text.c_str(), nullptr);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Match the longest number of the NumberFormats in formats at start and work
+// out its value as the digits go by. Returns false if there isn't one; 
+// either way sets scanEnd to the end of the input that was read.
+//
+// A float's first 19 significant digits are gathered into a 64-bit integer
+// and its exponent into a power of ten. When the digits fit in a double's 
+// 53 bits and the power is at most 22, both are exact doubles and one 
+// multiplication or division rounds correctly (Clinger, "How to read 
+// floating point numbers accurately", 1990); only the rare numbers outside
+// that range are read again by ParseFloat().
+//-----------------------------------------------------------------------------
+template<typename _It>
+bool ScanNumber(
+    _It start, 
+    _It end, 
+    uint32_t formats, 
+    _It& matchEnd, 
+    _It& scanEnd, 
+    Number& number)
+{
+    number = Number();
+    _It read = start;
+    auto peek = [&](_It at) -> uint32_t
+    {
+        if (at == end)
+            return ~0u;
+        if (!(at < read))
+            read = at + 1;
+        return CharCode(*at);
+    };
+
+    // Hex integers. The first 16 significant digits, and whether any digit
+    // after them is non-zero, are enough to round the value to a double.
+    if ((formats & NumberHex) && 
+        peek(start) == '0' && 
+        (peek(start + 1) | 0x20) == 'x' && 
+        HexDigit(peek(start + 2)) < 16)
+    {
+        uint64_t leading = 0;
+        int dropped = 0;
+        bool sticky = false;
+        _It cursor = start + 2;
+        for (uint32_t d; (d = HexDigit(peek(cursor))) < 16; ++cursor)
+        {
+            number.Overflow |= (number.Integer >> 60) != 0;
+            number.Integer = (number.Integer << 4) | d;
+            if (leading >> 60)
+            {
+                ++dropped;
+                sticky |= d != 0;
+            } else {
+                leading = (leading << 4) | d;
+            }
+        }
+        number.Float = std::ldexp(
+            static_cast<double>(leading | (sticky ? 1 : 0)), 
+            4 * dropped);
+        matchEnd = cursor;
+        scanEnd = read;
+        return true;
+    }
+
+    uint64_t integer = 0;
+    bool overflow = false;
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    auto digit = [&](uint32_t d, bool fraction)
+    {
+        if (mantissa == 0 && d == 0)
+        {
+            exponent -= fraction;
+        } else if (significant < 19) {
+            mantissa = mantissa * 10 + d;
+            ++significant;
+            exponent -= fraction;
+        } else {
+            truncated |= d != 0;
+            exponent += !fraction;
+        }
+    };
+
+    _It cursor = start;
+    size_t digits = 0;
+    for (uint32_t d; (d = DecimalDigit(peek(cursor))) < 10; ++cursor, ++digits)
+    {
+        overflow |= integer > (std::numeric_limits<uint64_t>::max() - d) / 10;
+        integer = integer * 10 + d;
+        digit(d, false);
+    }
+    const _It integerEnd = cursor;
+
+    _It floatEnd = start;
+    if (formats & NumberFloat)
+    {
+        if (peek(cursor) == '.')
+        {
+            _It fraction = cursor + 1;
+            for (uint32_t d; (d = DecimalDigit(peek(fraction))) < 10; ++fraction, ++digits)
+                digit(d, true);
+            if (digits)
+            {
+                cursor = fraction;
+                floatEnd = cursor;
+            }
+        }
+
+        if (digits && (peek(cursor) | 0x20) == 'e')
+        {
+            _It power = cursor + 1;
+            const uint32_t sign = peek(power);
+            if (sign == '+' || sign == '-')
+                ++power;
+            int64_t value = 0;
+            const _It powerStart = power;
+            for (uint32_t d; (d = DecimalDigit(peek(power))) < 10; ++power)
+                value = std::min<int64_t>(value * 10 + d, 1000000);
+            if (power != powerStart)
+            {
+                exponent += sign == '-' ? -value : value;
+                floatEnd = power;
+            }
+        }
+    }
+    scanEnd = read;
+
+    if (floatEnd != start)
+    {
+        static const double powers[] = { 
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        number.IsFloat = true;
+        if (mantissa == 0)
+        {
+            number.Float = 0.0;
+        } else if (!truncated && 
+                   mantissa <= (uint64_t(1) << 53) && 
+                   exponent >= -22 && exponent <= 22) {
+            number.Float = exponent < 0 ? 
+                static_cast<double>(mantissa) / powers[-exponent] : 
+                static_cast<double>(mantissa) * powers[exponent];
+        } else {
+            number.Float = ParseFloat(start, floatEnd, exponent + significant < 0);
+        }
+        matchEnd = floatEnd;
+        return true;
+    }
+
+    if ((formats & NumberDecimal) && integerEnd != start)
+    {
+        number.Integer = integer;
+        number.Overflow = overflow;
+        number.Float = overflow ? 
+            ParseFloat(start, integerEnd, false) : 
+            static_cast<double>(integer);
+        matchEnd = integerEnd;
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// What Lexer::analyzeDefinitions() finds out about a definition.
+//     ID:             Its token identifier.
+//     Source:         Its pattern.
+//     Supported:      Whether the native engine can parse the pattern. If it
+//                     can't, the fields below are left as for a harmless
+//                     definition and the rest are analyzed without it. False
+//                     for delimited and numeric definitions, which have no
+//                     pattern.
+//     CanWin:         Whether any input makes it the winning definition. If 
+//                     not, ShadowedBy holds the earlier definitions that win
+//                     wherever it matches.
+//     MatchesEmpty:   Whether it matches the empty string. The Lexer never
+//                     returns an empty token, so this is usually a mistake.
+//     MaxLength:      The longest token it can match, or Unbounded. Text fed
+//                     to the Lexer in pieces must be split where no token 
+//                     can span the cut.
+//     ReadsPastMatch: Whether a scan can read without limit past the end of
+//                     the token it returns because of this definition, like
+//                     "a*b" in a run of a's with "a" defined before it. The
+//                     next scans read the same text again, so analysis can
+//                     take time quadratic in the length of the input (see
+//                     Lexer::setLinearTime()).
+//     Ambiguous:      Whether it can match some input in exponentially many
+//                     ways, like (a+)+ or (a|aa)*, which a backtracking 
+//                     engine such as std::regex may try one by one. The 
+//                     native engine isn't affected.
+//-----------------------------------------------------------------------------
+template<typename _TokenID, typename _String>
+struct DefinitionReport
+{
+    static constexpr size_t Unbounded = DefinitionAnalysis::Unbounded;
+
+    _TokenID ID;
+    _String Source;
+    bool Supported;
+    bool CanWin;
+    std::vector<_TokenID> ShadowedBy;
+    bool MatchesEmpty;
+    size_t MaxLength;
+    bool ReadsPastMatch;
+    bool Ambiguous;
+};
+
+//-----------------------------------------------------------------------------
+// Scratch space for the Lexer's analyses. A caller that keeps a ScanContext
+// and passes it to each analysis avoids allocating it every time: once it 
+// has grown to fit, lexing with a native _Regex allocates nothing. It may be
+// used by one analysis at a time, and allocates from a memory resource.
+//     Results: Submatches for RegexTraits::match().
+//     Memo:    The ScanMemo of linear time mode.
+//     Lazy:    The analysis' Session with the lazy DFA.
+//-----------------------------------------------------------------------------
+template<typename _It>
+struct ScanContext
+{
+    explicit ScanContext(
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : Results(resource)
+        , Memo(resource)
+        , Lazy(resource)
+    {
+    }
+
+    std::pmr::match_results<_It> Results;
+    ScanMemo Memo;
+    LazyDfa::Session Lazy;
+};
+
+//-----------------------------------------------------------------------------
+// Places to carry on lexing from part way through a text, recorded by a full
+// Lexer::analyze() at the first token boundary after every interval 
+// characters. Each is the Location of a token boundary: the Lexer starts
+// every token afresh, so where a token starts and the line and column there
+// are all it needs to carry on. An index is only good for the text it was 
+// recorded from.
+//-----------------------------------------------------------------------------
+class CheckpointIndex
+{
+public:
+
+    static constexpr size_t DefaultInterval = 64 * 1024;
+
+    explicit CheckpointIndex(size_t interval = DefaultInterval)
+        : m_interval(std::max<size_t>(interval, 1))
+    {
+        clear();
+    }
+
+    size_t interval() const
+    {
+        return m_interval;
+    }
+
+    size_t size() const
+    {
+        return m_checkpoints.size();
+    }
+
+    const Location& operator [](size_t i) const
+    {
+        return m_checkpoints[i];
+    }
+
+    // The last checkpoint at or before offset. The first checkpoint is 
+    // always the start of the text.
+    const Location& nearest(size_t offset) const
+    {
+        auto after = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), 
+            offset, [](size_t offset, const Location& checkpoint)
+            {
+                return offset < checkpoint.global;
+            });
+        return after[-1];
+    }
+
+    // Where the next checkpoint is due
+    size_t due() const
+    {
+        return m_checkpoints.back().global + m_interval;
+    }
+
+    // Add a checkpoint after the last one
+    void add(const Location& checkpoint)
+    {
+        m_checkpoints.push_back(checkpoint);
+    }
+
+    // Forget every checkpoint but the start of the text
+    void clear()
+    {
+        Location start;
+        start.line_number = 1;
+        start.within_line = 1;
+        start.global = 0;
+        m_checkpoints.assign(1, start);
+    }
+
+private:
+
+    size_t m_interval;
+    std::vector<Location> m_checkpoints;
+};
+
+//-----------------------------------------------------------------------------
+// A tracing policy for the Lexer, whose static hooks it calls as it works:
+//     onChunk(from, to):     An analysis of the input in [from, to) begins.
+//     onAttempt(offset):     The Lexer is about to match a token at offset.
+//     onMatch(offset, length, definition):
+//                            The definition with that index (in the order 
+//                            they were defined) matched length characters.
+//     onError(offset):       No definition matched at offset.
+// NoTrace does nothing, so that the calls compile away.
+//-----------------------------------------------------------------------------
+struct NoTrace
+{
+    static void onChunk(size_t, size_t) {}
+    static void onAttempt(size_t) {}
+    static void onMatch(size_t, size_t, uint32_t) {}
+    static void onError(size_t) {}
+};
+
+//-----------------------------------------------------------------------------
+// A read-only view of consecutive elements, like C++20's std::span.
+//-----------------------------------------------------------------------------
+template<typename _Type>
+class Span
+{
+public:
+    typedef _Type value_type;
+    typedef const _Type* const_iterator;
+
+    Span(const _Type* data, size_t size)
+        : m_data(data)
+        , m_size(size)
+    {
+    }
+
+    const _Type* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+    const _Type& operator [](size_t i) const { return m_data[i]; }
+
+private:
+    const _Type* m_data;
+    size_t m_size;
+};
+
+//-----------------------------------------------------------------------------
+// The Lexer is the main body of the Luthor library. It accepts three template
+// parameters that determine the inputs and outputs of the Lexer:
+//     _TokenID: A struct or class that identify matched tokens. Usually this
+//               would be an enum, but you could make it anything: pointer, 
+//               string, COM object... As long as your Match Handler can use it
+//               to identify a token.
+//     _String:  [OPTIONAL] A string class to use with the regex. Luthor has 
+//               been tested with std::string and std::wstring.
+//     _Regex:   [OPTIONAL] A regex class. Use std::regex or std::wregex, or
+//               Luthor's native Lex::Regex or Lex::WRegex. Other classes can
+//               be plugged in by specializing Lex::RegexTraits.
+//     _Trace:   [OPTIONAL] A tracing policy whose hooks are called as the
+//               input is analyzed, such as Lex::RingTrace (LexTrace.h). 
+//               The default, Lex::NoTrace, costs nothing.
+//-----------------------------------------------------------------------------
+template<
+    typename _TokenID, 
+    typename _String = default_string, 
+    typename _Regex = default_regex,
+    typename _Trace = NoTrace>
+
+class Lexer
+{
+public:
+
+    typedef _TokenID token_id_type;
+    typedef _String string_type;
+    typedef _Regex regex_type;
+    typedef Token<_TokenID> token_type;
+    typedef TokenRecord<_TokenID> record_type;
+    typedef DefinitionReport<_TokenID, _String> report_type;
+    typedef ScanContext<typename _String::const_iterator> context_type;
+
+    // Tokens per batch in analyzeBatched()
+    static constexpr size_t BatchSize = 256;
+
+    Lexer()
+        : Lexer(std::pmr::get_default_resource())
+    {
+    }
+
+    // A Lexer that allocates its list of definitions, its DFA tables and the
+    // scratch space of its analyses from resource. The resource must outlive
+    // the Lexer and any copy of it that shares its compiled tables, and must
+    // be thread-safe if several threads analyze at once. Copies allocate from
+    // the default resource. The compiled regexes, patterns and keyword 
+    // tables of the definitions use their own allocators.
+    explicit Lexer(std::pmr::memory_resource* resource)
+        : m_expressions(resource)
+        , m_direct(resource)
+        , m_dfa(resource)
+        , m_programBuilt(false)
+        , m_sourcesOnly(false)
+        , m_linearTime(false)
+    {
+    }
+
+    std::pmr::memory_resource* resource() const
+    {
+        return m_expressions.get_allocator().resource();
+    }
+
+    // Map a token identifier to a regular expression defining that token
+    void define(const _TokenID& id, const _String& definitionRegex)
+    {
+        CompileSources();
+        m_expressions.push_back(TokenDef(id, definitionRegex));
+        m_programBuilt = false;
+        m_dense.clear();
+    }
+
+    // As above, but a match that spells one of the keywords is reported with
+    // the keyword's identifier instead. Use this for identifiers rather than
+    // defining each keyword ahead of them:
+    //
+    //      lex.define(TOKEN_IDENTIFIER, "[a-zA-Z_][a-zA-Z0-9_]*", {
+    //          { "function", TOKEN_FUNCTION }, 
+    //          { "script",   TOKEN_SCRIPT } });
+    //
+    // The keywords are looked up in a perfect hash, so the cost is the same
+    // however many there are. Unlike separate definitions, a keyword only
+    // matches a whole identifier: "functional" is one identifier.
+    void define(
+        const _TokenID& id, 
+        const _String& definitionRegex,
+        const std::vector<std::pair<_String, _TokenID> >& keywords)
+    {
+        define(id, definitionRegex);
+        m_expressions.back().Keywords = KeywordTable<_String, _TokenID>(keywords);
+    }
+
+    // Define a token that runs from an opening delimiter to the first 
+    // closing delimiter after it, such as a comment or a string:
+    //
+    //      lex.defineDelimited(TOKEN_COMMENT, "/*", "*/", 0, true);
+    //      lex.defineDelimited(TOKEN_STRING, "\"", "\"", '\\');
+    //
+    // The character after an escape is part of the token whatever it is, so
+    // an escaped quote doesn't close the string. Unless spansLines, a 
+    // newline before the closing delimiter (other than an escaped one) means
+    // the token doesn't match; neither does a token that is never closed. It
+    // takes its place among the other definitions like any other: the first
+    // definition that matches wins. Rather than stepping through the token
+    // a character at a time, the Lexer searches many characters at once for
+    // the next possible delimiter, escape or newline, and counts the 
+    // newlines as it goes. Throws std::invalid_argument if open or close is 
+    // empty.
+    void defineDelimited(
+        const _TokenID& id, 
+        const _String& open, 
+        const _String& close, 
+        typename _String::value_type escape = 0, 
+        bool spansLines = false)
+    {
+        if (open.empty() || close.empty())
+            throw std::invalid_argument("Delimiters must not be empty");
+
+        CompileSources();
+        TokenDef expr;
+        expr.ID = id;
+        expr.Delimited = true;
+        expr.Open = open;
+        expr.Close = close;
+        expr.Escape = escape;
+        expr.SpansLines = spansLines;
+        m_expressions.push_back(expr);
+        m_direct.push_back(static_cast<uint32_t>(m_expressions.size() - 1));
+        m_programBuilt = false;
+        m_dense.clear();
+    }
+
+    // Define a number token of the NumberFormats in formats, whose value is
+    // worked out as it is matched:
+    //
+    //      lex.defineNumber(TOKEN_FLOAT, Lex::NumberFloat);
+    //      lex.defineNumber(TOKEN_INTEGER, Lex::NumberDecimal | Lex::NumberHex);
+    //
+    // Like other definitions, the first that matches wins, so define floats
+    // before integers or "4.2" is lexed as "4" and ".2". If onMatch can be
+    // called with a const Number& after the lexeme, analyze() passes it the 
+    // value of each numeric token; it must still accept the other tokens 
+    // without one. Floats are rounded as std::from_chars() rounds them, and
+    // "1." is a float. Signs are not part of the number. Throws 
+    // std::invalid_argument if formats has none of the NumberFormats.
+    void defineNumber(const _TokenID& id, uint32_t formats = NumberAny)
+    {
+        if (!(formats & NumberAny))
+            throw std::invalid_argument("No number formats given");
+
+        CompileSources();
+        TokenDef expr;
+        expr.ID = id;
+        expr.Numbers = formats & NumberAny;
+        m_expressions.push_back(expr);
+        m_direct.push_back(static_cast<uint32_t>(m_expressions.size() - 1));
+        m_programBuilt = false;
+        m_dense.clear();
+    }
+
+    // With a native _Regex, build the complete, minimized DFA now instead of
+    // lazily during analyze(). Returns false, and carries on with the lazy 
+    // DFA, if it would need more than maxStates states.
+    bool compile(size_t maxStates = DenseDfa::DefaultMaxStates)
+    {
+        static_assert(RegexTraits<_Regex>::Native, 
+            "compile() needs a native _Regex such as Lex::Regex");
+        CompileSources();
+        BuildProgram();
+        return m_dense.build(m_program, maxStates, resource());
+    }
+
+    // Size in bytes of the compiled DFA's tables, or 0 if not compiled
+    size_t compiledSize() const
+    {
+        return m_dense.memoryUsage();
+    }
+
+    // Look for definitions that are mistaken or slow to lex, filling report
+    // with one entry per definition (see DefinitionReport). The patterns are
+    // analyzed as the native engine reads them, whatever _Regex is, so this
+    // also checks grammars meant for std::regex. Returns false if the 
+    // combined automaton would have more than maxStates states, or a 
+    // definition is too large to check for ambiguity; what couldn't be 
+    // checked is reported as harmless.
+    bool analyzeDefinitions(
+        std::vector<report_type>& report, 
+        size_t maxStates = DenseDfa::DefaultMaxStates) const
+    {
+        report.clear();
+        std::vector<GlushkovNfa> automata(m_expressions.size());
+        Program program;
+        for (size_t d = 0; d < m_expressions.size(); ++d)
+        {
+            const TokenDef& expr = m_expressions[d];
+            report_type entry = report_type();
+            entry.ID = expr.ID;
+            entry.Source = expr.Source;
+            entry.Supported = !expr.Direct();
+            if (entry.Supported)
+            {
+                try
+                {
+                    Pattern pattern(std::begin(expr.Source), std::end(expr.Source), 
+                        MaxCharCode<_Char>(), IsUtf8::value);
+                    automata[d] = GlushkovNfa(pattern);
+                    entry.MatchesEmpty = automata[d].Nullable;
+                }
+                catch (const RegexError&)
+                {
+                    entry.Supported = false;
+                }
+            }
+            program.add(automata[d]);
+            report.push_back(entry);
+        }
+        program.finalize(MaxCharCode<_Char>());
+
+        DefinitionAnalysis analysis;
+        bool complete = analysis.analyze(program, automata, maxStates);
+        for (size_t d = 0; d < report.size(); ++d)
+        {
+            const DefinitionAnalysis::Result& result = analysis.results()[d];
+            report_type& entry = report[d];
+            if (!entry.Supported)
+            {
+                entry.CanWin = true;
+                continue;
+            }
+            entry.CanWin = result.CanWin;
+            for (uint32_t shadow : result.ShadowedBy)
+                entry.ShadowedBy.push_back(m_expressions[shadow].ID);
+            entry.MaxLength = result.MaxLength;
+            entry.ReadsPastMatch = result.ReadsPastMatch;
+            entry.Ambiguous = result.Ambiguous;
+        }
+        return complete;
+    }
+
+    // Append the definitions and compiled DFA to out, in a form that attach()
+    // can use in place. Returns false if compile() has not succeeded. 
+    bool serialize(std::vector<uint8_t>& out) const
+    {
+        static_assert(std::is_trivially_copyable<_TokenID>::value, 
+            "serialize() copies token identifiers byte for byte");
+        if (!m_dense.valid())
+            return false;
+
+        const size_t base = out.size();
+        ImageHeader header = ImageHeader();
+        std::memcpy(header.Magic, ImageMagic, sizeof(header.Magic));
+        header.Version = ImageVersion;
+        header.ByteOrder = ImageByteOrder;
+        header.CharSize = sizeof(_Char);
+        header.TokenIDSize = sizeof(_TokenID);
+        header.Definitions = static_cast<uint32_t>(m_expressions.size());
+        header.Flags = IsUtf8::value ? ImageUtf8 : 0;
+
+        size_t offset = sizeof(ImageHeader);
+        out.resize(base + offset);
+        for (auto& expr : m_expressions)
+            Append(out, &expr.ID, sizeof(_TokenID));
+
+        header.Sources = out.size() - base;
+        for (auto& expr : m_expressions)
+        {
+            AppendString(out, expr.Source);
+            uint32_t keywords = static_cast<uint32_t>(expr.Keywords.size());
+            Append(out, &keywords, sizeof(keywords));
+            if (keywords)
+            {
+                out.resize(base + ImageAlign(out.size() - base));
+                expr.Keywords.serialize(out);
+            }
+
+            uint32_t flags = 
+                (expr.Delimited ? ImageDelimited : 0) | 
+                (expr.SpansLines ? ImageSpansLines : 0) | 
+                (expr.Numbers ? ImageNumbers : 0);
+            Append(out, &flags, sizeof(flags));
+            if (expr.Delimited)
+            {
+                AppendString(out, expr.Open);
+                AppendString(out, expr.Close);
+                Append(out, &expr.Escape, sizeof(_Char));
+            }
+            if (expr.Numbers)
+                Append(out, &expr.Numbers, sizeof(expr.Numbers));
+        }
+
+        out.resize(base + ImageAlign(out.size() - base));
+        header.Dfa = out.size() - base;
+        header.DfaSize = m_dense.size();
+        Append(out, m_dense.data(), m_dense.size());
+
+        header.Size = out.size() - base;
+        std::memcpy(&out[base], &header, sizeof(header));
+        return true;
+    }
+
+    // Replace the definitions and DFA with an image written by serialize(),
+    // using its DFA and keyword tables in place; only the definitions' 
+    // patterns and delimiters are copied. data must be 8-byte aligned and 
+    // stay valid while the Lexer, or any copy of it, uses it; owner is kept
+    // alive for that purpose. The regexes are only compiled again if 
+    // define() is called afterwards. Returns false, leaving the Lexer empty,
+    // if the image is malformed or was written for a different character 
+    // type, encoding or token type.
+    bool attach(
+        const void* data, 
+        size_t size, 
+        std::shared_ptr<const void> owner = std::shared_ptr<const void>())
+    {
+        static_assert(RegexTraits<_Regex>::Native, 
+            "attach() needs a native _Regex such as Lex::Regex");
+        static_assert(std::is_trivially_copyable<_TokenID>::value, 
+            "attach() copies token identifiers byte for byte");
+
+        m_expressions.clear();
+        m_direct.clear();
+        m_program.clear();
+        m_dfa.reset();
+        m_dense.clear();
+        m_programBuilt = false;
+        m_sourcesOnly = false;
+
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        ImageHeader header;
+        if (size < sizeof(header))
+            return false;
+
+        std::memcpy(&header, bytes, sizeof(header));
+        if (std::memcmp(header.Magic, ImageMagic, sizeof(header.Magic)) != 0 ||
+            header.Version != ImageVersion ||
+            header.ByteOrder != ImageByteOrder ||
+            header.CharSize != sizeof(_Char) ||
+            header.TokenIDSize != sizeof(_TokenID) ||
+            header.Flags != (IsUtf8::value ? ImageUtf8 : 0) ||
+            header.Size > size ||
+            header.Sources > header.Size ||
+            header.Sources - sizeof(header) != 
+                uint64_t(header.Definitions) * sizeof(_TokenID) ||
+            header.Dfa < header.Sources ||
+            header.Dfa > header.Size ||
+            header.DfaSize > header.Size - header.Dfa)
+        {
+            return false;
+        }
+
+        std::pmr::vector<TokenDef> expressions(header.Definitions, resource());
+        const uint8_t* cursor = bytes + sizeof(header);
+        for (auto& expr : expressions)
+        {
+            std::memcpy(&expr.ID, cursor, sizeof(_TokenID));
+            cursor += sizeof(_TokenID);
+        }
+
+        const uint8_t* sourcesEnd = bytes + header.Dfa;
+        for (auto& expr : expressions)
+        {
+            uint32_t keywords;
+            if (!ReadString(cursor, sourcesEnd, expr.Source) ||
+                !Read(cursor, sourcesEnd, &keywords, sizeof(keywords)))
+            {
+                return false;
+            }
+
+            if (keywords)
+            {
+                cursor = bytes + ImageAlign(cursor - bytes);
+                if (cursor > sourcesEnd)
+                    return false;
+                size_t used = expr.Keywords.attach(
+                    cursor, sourcesEnd - cursor, keywords, owner);
+                if (!used)
+                    return false;
+                cursor += used;
+            }
+
+            uint32_t flags;
+            if (!Read(cursor, sourcesEnd, &flags, sizeof(flags)))
+                return false;
+            expr.Delimited = (flags & ImageDelimited) != 0;
+            expr.SpansLines = (flags & ImageSpansLines) != 0;
+            if (expr.Delimited && 
+                (!ReadString(cursor, sourcesEnd, expr.Open) ||
+                 !ReadString(cursor, sourcesEnd, expr.Close) ||
+                 !Read(cursor, sourcesEnd, &expr.Escape, sizeof(_Char)) ||
+                 expr.Open.empty() || 
+                 expr.Close.empty()))
+            {
+                return false;
+            }
+            if ((flags & ImageNumbers) && 
+                (!Read(cursor, sourcesEnd, &expr.Numbers, sizeof(expr.Numbers)) ||
+                 !(expr.Numbers & NumberAny) ||
+                 (expr.Numbers & ~uint32_t(NumberAny)) ||
+                 expr.Delimited))
+            {
+                return false;
+            }
+        }
+
+        if (!m_dense.attach(bytes + header.Dfa, size_t(header.DfaSize), owner))
+            return false;
+
+        uint32_t maxToken = m_dense.maxToken();
+        if (maxToken != Program::NoToken && maxToken >= expressions.size())
+        {
+            m_dense.clear();
+            return false;
+        }
+
+        m_expressions.swap(expressions);
+        for (uint32_t d = 0; d < m_expressions.size(); ++d)
+        {
+            if (m_expressions[d].Direct())
+                m_direct.push_back(d);
+        }
+        m_sourcesOnly = true;
+        return true;
+    }
+
+    // With a native _Regex, the Lexer matches all of its definitions at once
+    // with a DFA that is built as the input needs it. This caps the memory
+    // the DFA may use; the default is LazyDfa::DefaultMemoryLimit.
+    void setDfaMemoryLimit(size_t bytes)
+    {
+        m_dfa.setMemoryLimit(bytes);
+    }
+
+    size_t dfaMemoryLimit() const
+    {
+        return m_dfa.memoryLimit();
+    }
+
+    size_t dfaMemoryUsage() const
+    {
+        return m_dfa.memoryUsage();
+    }
+
+    // With a native _Regex, guarantee that every analysis takes time linear
+    // in the length of its input, whatever the definitions. Otherwise a scan
+    // for the longest match may read far ahead of the token it finds, and 
+    // the next scans read the same text again: "a*b" and "a" over a long run
+    // of a's take quadratic time. In this mode the Lexer remembers where 
+    // scans failed (see ScanMemo), at the cost of memory that can grow with 
+    // the length of the input in such cases. The bound is strict when the
+    // Lexer is compile()d; with the lazily built DFA it holds for as long as
+    // the DFA fits its memory limit. It doesn't cover delimited definitions:
+    // each opening delimiter that is never closed is searched to the end of
+    // the input (or line) again. Nor does it cover numeric definitions, 
+    // though a number is only read again when a definition before it wins.
+    void setLinearTime(bool linear)
+    {
+        static_assert(RegexTraits<_Regex>::Native, 
+            "setLinearTime() needs a native _Regex such as Lex::Regex");
+        m_linearTime = linear;
+    }
+
+    bool linearTime() const
+    {
+        return m_linearTime;
+    }
+
+    // An estimate of the memory the Lexer holds: the definitions' patterns 
+    // and the DFA tables
+    size_t memoryUsage() const
+    {
+        size_t bytes = sizeof(*this) + compiledSize() + dfaMemoryUsage() + 
+            m_direct.size() * sizeof(uint32_t);
+        for (auto& expr : m_expressions)
+        {
+            bytes += sizeof(TokenDef) + expr.Source.size() * sizeof(_Char);
+            bytes += (expr.Open.size() + expr.Close.size()) * sizeof(_Char);
+            bytes += expr.Keywords.memoryUsage();
+        }
+        return bytes;
+    }
+
+    // Analyze an character stream. This function takes two functors that are
+    // called when a token is matched or fails to match. These functors should
+    // implement operator(). See Example.cpp. If onError returns, the
+    // character that failed to match is skipped.
+    //
+    // Several threads may analyze with the same Lexer at once. With a native
+    // _Regex that has not been compile()d they take turns, because they share
+    // the lazily built DFA.
+    template<
+		typename _MatchFunc, 
+		typename _ErrorFunc>
+
+    void analyze(
+		const _String& script, 
+		_MatchFunc& onMatch, 
+		_ErrorFunc& onError) const
+    {
+        context_type context(resource());
+        analyze(script, onMatch, onError, context);
+    }
+
+    // As above, with scratch space kept by the caller. Once context has grown
+    // to fit, analysis allocates nothing with a native _Regex; std::regex
+    // still allocates inside std::regex_search().
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc>
+
+    void analyze(
+        const _String& script, 
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError,
+        context_type& context) const
+    {
+        AnalyzeFrom(script, StartLocation(), std::numeric_limits<size_t>::max(), 0,
+            onMatch, onError, context, nullptr, std::false_type());
+    }
+
+    // As analyze(), recording checkpoints along the way into checkpoints 
+    // (which is cleared first), so that any part of script can be analyzed
+    // again later without starting from the beginning (see below)
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc>
+
+    void analyze(
+        const _String& script, 
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError,
+        CheckpointIndex& checkpoints) const
+    {
+        context_type context(resource());
+        analyze(script, onMatch, onError, checkpoints, context);
+    }
+
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc>
+
+    void analyze(
+        const _String& script, 
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError,
+        CheckpointIndex& checkpoints,
+        context_type& context) const
+    {
+        checkpoints.clear();
+        AnalyzeFrom(script, StartLocation(), std::numeric_limits<size_t>::max(), 0,
+            onMatch, onError, context, &checkpoints, std::true_type());
+    }
+
+    // Analyze just the part of script that overlaps [from, to), such as the 
+    // lines in view, carrying on from the last of checkpoints at or before 
+    // from. checkpoints must have been recorded from this script. Tokens 
+    // that end at or before from are not reported (errors are, as ever),
+    // and analysis stops at the first token that starts at or after to. So
+    // the work done depends on the length of the range and the checkpoint
+    // interval rather than the length of script. The tokens are the same as
+    // a full analysis finds, with the same locations.
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc>
+
+    void analyze(
+        const _String& script, 
+        const CheckpointIndex& checkpoints,
+        size_t from,
+        size_t to,
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError) const
+    {
+        context_type context(resource());
+        analyze(script, checkpoints, from, to, onMatch, onError, context);
+    }
+
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc>
+
+    void analyze(
+        const _String& script, 
+        const CheckpointIndex& checkpoints,
+        size_t from,
+        size_t to,
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError,
+        context_type& context) const
+    {
+        AnalyzeFrom(script, checkpoints.nearest(from), to, from, 
+            onMatch, onError, context, nullptr, std::true_type());
+    }
+
+    // Analyze a character stream, handing the tokens to onBatch in batches of
+    // up to BatchSize as a Span<record_type>, so that the consumer can work 
+    // through them in a tight loop:
+    //
+    //      void operator()(Lex::Span<Lex::TokenRecord<TokenID> > tokens);
+    //
+    // Where no definition matches, the tokens so far are delivered and then
+    // onError is called with the location; if it returns, that character is
+    // skipped. Tokens must be shorter than 2^32 characters, and the text must
+    // have fewer than 2^32 lines (see TokenRecord).
+    template<
+        typename _BatchFunc, 
+        typename _ErrorFunc>
 
-    // Map a token identifier to a regular expression defining that token
-    void define(const _TokenID& id, const _String& definitionRegex)
+    void analyzeBatched(
+        const _String& script, 
+        _BatchFunc& onBatch, 
+        _ErrorFunc& onError) const
     {
-        m_expressions.push_back(TokenDef(id, definitionRegex));
+        context_type context(resource());
+        analyzeBatched(script, onBatch, onError, context);
     }
 
-    // Analyze an character stream. This function takes two functors that are
-    // called when a token is matched or fails to match. These functors should
-    // implement operator(). See Example.cpp.
+    // As above, with scratch space kept by the caller (see analyze())
     template<
-		typename _MatchFunc, 
-		typename _ErrorFunc>
+        typename _BatchFunc, 
+        typename _ErrorFunc>
 
-    void analyze(
-		const _String& script, 
-		_MatchFunc& onMatch, 
-		_ErrorFunc& onError)
+    void analyzeBatched(
+        const _String& script, 
+        _BatchFunc& onBatch, 
+        _ErrorFunc& onError,
+        context_type& context) const
     {
-        Location location;
-        location.line_number = 1;
-        location.within_line = 1;
-        location.global = 0;
+        Location where = StartLocation();
+        analyzeAvailable(script, where, script.size(), true, 
+            onBatch, onError, context);
+    }
 
-        auto start = std::begin(script);
-        auto cursor = start;
-        auto end = std::end(script);
-        auto lastLineBegin = start;
+    // As analyzeBatched(), for text that arrives a piece at a time: analyze
+    // script from where, a token boundary, up to available. Unless final, 
+    // stops before the first token whose match read as far as available, 
+    // since the text after it could change the match, and leaves where at 
+    // the place to carry on from once more has arrived; only the text from
+    // available onwards may change in the meantime. Start with where at 
+    // line 1, column 1, offset 0. Since where keeps the line and column, no
+    // call reads back over text that an earlier one analyzed. There is no 
+    // telling how far std::regex reads, so with it nothing is analyzed until
+    // final.
+    template<
+        typename _BatchFunc, 
+        typename _ErrorFunc>
+
+    void analyzeAvailable(
+        const _String& script, 
+        Location& where,
+        size_t available,
+        bool final,
+        _BatchFunc& onBatch, 
+        _ErrorFunc& onError,
+        context_type& context) const
+    {
+        Prepare(IsNative());
+        context.Memo.clear();
+        context.Lazy.begin();
+
+        record_type batch[BatchSize];
+        size_t count = 0;
+        _Trace::onChunk(where.global, available);
+
+        // Columns are only needed for errors, so they're counted from the
+        // last newline, error or the start, whichever is latest
+        const auto start = std::begin(script);
+        const auto end = start + available;
+        auto cursor = start + where.global;
+        auto lastLineBegin = cursor;
+        auto columnStart = cursor;
+        size_t column = where.within_line;
+        size_t line = where.line_number;
         while (cursor < end)
         {
-            // Match it against any of the tokens
-            TokenMatch match = SearchRegex(cursor, end);
+            _StringIt matchEnd = end;
+            _StringIt scanEnd;
+            MatchDetail detail;
+            auto token = MatchRegex(
+                cursor, matchEnd, scanEnd, detail, context, cursor - start);
+            if (!final && scanEnd >= end)
+                break;
 
-            location.global = cursor - start;
-            location.within_line = 1 + cursor - lastLineBegin;
-
-            if (match.Token == std::end(m_expressions))
+            if (token == std::end(m_expressions))
             {
+                if (count)
+                {
+                    onBatch(Span<record_type>(batch, count));
+                    count = 0;
+                }
+
+                Location location;
+                location.line_number = line;
+                location.within_line = 
+                    column + CountColumns(columnStart, cursor, IsUtf8());
+                location.global = cursor - start;
+                column = location.within_line;
+                columnStart = cursor;
+                _Trace::onError(location.global);
                 onError(location);
+                matchEnd = cursor + SkipLength(cursor, end, IsUtf8());
             } else {
-                onMatch(location, 
-                    match.Token->ID, 
-                    match.LexemeStart, 
-                    match.LexemeEnd);
+                record_type& record = batch[count];
+                record.ID = Classify(*token, cursor, matchEnd);
+                record.Offset = cursor - start;
+                assert(size_t(matchEnd - cursor) <= UINT32_MAX && line <= UINT32_MAX);
+                record.Length = static_cast<uint32_t>(matchEnd - cursor);
+                record.Line = static_cast<uint32_t>(line);
+                if (++count == BatchSize)
+                {
+                    onBatch(Span<record_type>(batch, count));
+                    count = 0;
+                }
             }
 
-            location.line_number += CountLineNums(
-                cursor, 
-                match.LexemeEnd, 
-                lastLineBegin);
-            cursor = match.LexemeEnd;
+            if (size_t lines = CountLineNums(cursor, matchEnd, lastLineBegin, detail))
+            {
+                line += lines;
+                column = 1;
+                columnStart = lastLineBegin;
+            }
+            cursor = matchEnd;
+        }
+
+        if (count)
+            onBatch(Span<record_type>(batch, count));
+        where.line_number = line;
+        where.within_line = column + CountColumns(columnStart, cursor, IsUtf8());
+        where.global = cursor - start;
+    }
+
+    // Analyze a character stream into a list of tokens, replacing the 
+    // contents of tokens. Where no definition matches, onError is called 
+    // with the location; if it returns, that character is skipped. tokens 
+    // may use any allocator, e.g. be a std::pmr::vector.
+    template<typename _Alloc, typename _ErrorFunc>
+    void tokenize(
+        const _String& script, 
+        std::vector<token_type, _Alloc>& tokens, 
+        _ErrorFunc& onError) const
+    {
+        typedef typename std::vector<token_type, _Alloc>::const_iterator _TokenIt;
+        tokens.clear();
+        Location location = StartLocation();
+        size_t reach;
+        Tokenize(script, location, std::numeric_limits<size_t>::max(), 
+            _TokenIt(), _TokenIt(), 0, tokens, reach, onError);
+    }
+
+    // Bring tokens up to date after an edit. tokens came from tokenize() or
+    // relex() on the text before the edit, which replaced removed characters
+    // at offset with inserted; script is the text after it. Only the tokens 
+    // that could have read the edited text are analyzed again, up to the 
+    // first token boundary after the edit where the new tokens line up with
+    // the old ones; the rest are kept and moved. onError is called as it is
+    // by tokenize(), for the text that is analyzed again. Returns the number
+    // of tokens that were analyzed again.
+    template<typename _Alloc, typename _ErrorFunc>
+    size_t relex(
+        const _String& script, 
+        size_t offset, 
+        size_t removed, 
+        const _String& inserted, 
+        std::vector<token_type, _Alloc>& tokens, 
+        _ErrorFunc& onError) const
+    {
+        // Keep the tokens that didn't read as far as the edit
+        size_t keep = 0;
+        while (keep < tokens.size() && 
+               tokens[keep].Where.global + tokens[keep].Lookahead <= offset)
+        {
+            ++keep;
+        }
+
+        Location location = keep ? 
+            LocationAfter(script, tokens[keep - 1]) : 
+            StartLocation();
+
+        // The old tokens that start after the edit may line up with the new
+        // ones, once moved by the change in length
+        const ptrdiff_t delta = 
+            static_cast<ptrdiff_t>(inserted.size()) - 
+            static_cast<ptrdiff_t>(removed);
+        auto sync = tokens.cbegin() + keep;
+        while (sync != tokens.cend() && sync->Where.global < offset + removed)
+            ++sync;
+
+        std::vector<token_type, _Alloc> fresh(tokens.get_allocator());
+        size_t reach;
+        auto synced = Tokenize(script, location, offset + inserted.size(), 
+            sync, tokens.cend(), delta, fresh, reach, onError);
+
+        // Move the old tokens from the one that lined up onwards
+        size_t first = synced - tokens.cbegin();
+        if (synced != tokens.cend())
+        {
+            const Location old = synced->Where;
+            tokens[first].Lookahead = reach - location.global;
+            for (size_t i = first; i < tokens.size(); ++i)
+            {
+                Location& where = tokens[i].Where;
+                if (where.line_number == old.line_number)
+                    where.within_line += location.within_line - old.within_line;
+                where.line_number += location.line_number - old.line_number;
+                where.global += delta;
+            }
         }
+
+        tokens.erase(tokens.begin() + keep, tokens.begin() + first);
+        tokens.insert(tokens.begin() + keep, fresh.begin(), fresh.end());
+        return fresh.size();
     }
 
 private:
 
     typedef typename _String::const_iterator _StringIt;
+    typedef typename _String::value_type _Char;
+    typedef std::integral_constant<bool, RegexTraits<_Regex>::Native> IsNative;
+    typedef std::integral_constant<bool, RegexTraits<_Regex>::Utf8> IsUtf8;
 
     struct TokenDef
     {
         TokenDef()
+            : ID()
+            , Delimited(false)
+            , Escape()
+            , SpansLines(false)
+            , Numbers(0)
         {
         }
 
         TokenDef(const _TokenID& id, const _String& regex)
-            : ID(id)
-            , Expr(regex, std::regex::optimize)
+            : Expr(RegexTraits<_Regex>::compile(regex))
+            , ID(id)
+            , Source(regex)
+            , Delimited(false)
+            , Escape()
+            , SpansLines(false)
+            , Numbers(0)
         {
         }
 
         _Regex Expr;
         _TokenID ID;
+        _String Source;
+        KeywordTable<_String, _TokenID> Keywords;
+
+        // For defineDelimited(): no Expr or Source, and no positions in the 
+        // program, so that the DFA never returns it
+        bool Delimited;
+        _String Open;
+        _String Close;
+        _Char Escape;
+        bool SpansLines;
+
+        // For defineNumber(): the NumberFormats it matches, likewise not in
+        // the program. 0 for other definitions.
+        uint32_t Numbers;
+
+        // Whether the Lexer matches it itself rather than with a regex
+        bool Direct() const
+        {
+            return Delimited || Numbers != 0;
+        }
+    };
+
+    // The identifier of a token matched by expr: a keyword's if the lexeme
+    // is one of its keywords, otherwise its own
+    const _TokenID& Classify(
+        const TokenDef& expr, 
+        _StringIt begin, 
+        _StringIt end) const
+    {
+        if (expr.Keywords.empty())
+            return expr.ID;
+
+        const _TokenID* keyword = expr.Keywords.find(begin, end);
+        return keyword ? *keyword : expr.ID;
+    }
+
+    // Layout of a serialized image: this header, the token identifiers, then
+    // for each definition its pattern and keyword count, its KeywordTable at
+    // an 8-byte aligned offset if it has keywords, its flags, its delimiters
+    // and escape if it is delimited and its NumberFormats if it is numeric,
+    // then the DFA's block at an 8-byte aligned offset. Offsets are from the
+    // start of the header.
+    struct ImageHeader
+    {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t ByteOrder;
+        uint32_t CharSize;
+        uint32_t TokenIDSize;
+        uint32_t Definitions;
+        uint32_t Flags;
+        uint64_t Sources;
+        uint64_t Dfa;
+        uint64_t DfaSize;
+        uint64_t Size;
+    };
+
+    static constexpr char ImageMagic[8] = { 'L', 'U', 'T', 'H', 'O', 'R', 'D', 'F' };
+    static constexpr uint32_t ImageVersion = 5;
+    static constexpr uint32_t ImageByteOrder = 0x01020304;
+    static constexpr uint32_t ImageUtf8 = 1;
+    static constexpr uint32_t ImageDelimited = 1;
+    static constexpr uint32_t ImageSpansLines = 2;
+    static constexpr uint32_t ImageNumbers = 4;
+
+    static size_t ImageAlign(size_t offset)
+    {
+        return (offset + 7) & ~size_t(7);
+    }
+
+    static void Append(std::vector<uint8_t>& out, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // A string is stored as a 32-bit length and its characters
+    static void AppendString(std::vector<uint8_t>& out, const _String& string)
+    {
+        uint32_t length = static_cast<uint32_t>(string.size());
+        Append(out, &length, sizeof(length));
+        Append(out, string.data(), length * sizeof(_Char));
+    }
+
+    static bool Read(
+        const uint8_t*& cursor, 
+        const uint8_t* end, 
+        void* data, 
+        size_t size)
+    {
+        if (size_t(end - cursor) < size)
+            return false;
+        std::memcpy(data, cursor, size);
+        cursor += size;
+        return true;
+    }
+
+    static bool ReadString(
+        const uint8_t*& cursor, 
+        const uint8_t* end, 
+        _String& string)
+    {
+        uint32_t length;
+        if (!Read(cursor, end, &length, sizeof(length)) ||
+            size_t(end - cursor) / sizeof(_Char) < length)
+        {
+            return false;
+        }
+        string.resize(length);
+        if (length)
+            std::memcpy(&string[0], cursor, length * sizeof(_Char));
+        cursor += length * sizeof(_Char);
+        return true;
+    }
+
+    // After attach() the definitions only hold their patterns; compile them 
+    // before anything needs to rebuild the program
+    void CompileSources()
+    {
+        if (!m_sourcesOnly)
+            return;
+
+        for (auto& expr : m_expressions)
+        {
+            if (!expr.Direct())
+                expr.Expr = RegexTraits<_Regex>::compile(expr.Source);
+        }
+        m_sourcesOnly = false;
+    }
+
+    // What the scan that found a token learned about it on the way. The 
+    // newlines in it, if they were counted: a delimited token's are counted
+    // as the Lexer looks for its end. And a numeric token's value.
+    struct MatchDetail
+    {
+        bool Counted;
+        size_t Lines;
+        _StringIt LineBegin;
+        bool Numeric;
+        Number Value;
     };
 
     struct TokenMatch
     {
-        typename std::vector<TokenDef>::const_iterator Token;
+        typename std::pmr::vector<TokenDef>::const_iterator Token;
         _StringIt LexemeStart;
         _StringIt LexemeEnd;
+        MatchDetail Detail;
     };
 
-    typename std::vector<TokenDef>::const_iterator MatchRegex(
+    // Hand a token to onMatch, with its value if it is numeric and onMatch
+    // takes one
+    template<typename _MatchFunc>
+    static void Deliver(
+        _MatchFunc& onMatch,
+        const Location& location,
+        const _TokenID& id,
+        _StringIt begin,
+        _StringIt end,
+        const MatchDetail&,
+        std::false_type)
+    {
+        onMatch(location, id, begin, end);
+    }
+
+    template<typename _MatchFunc>
+    static void Deliver(
+        _MatchFunc& onMatch,
+        const Location& location,
+        const _TokenID& id,
+        _StringIt begin,
+        _StringIt end,
+        const MatchDetail& detail,
+        std::true_type)
+    {
+        if (detail.Numeric)
+            onMatch(location, id, begin, end, detail.Value);
+        else
+            onMatch(location, id, begin, end);
+    }
+
+    // Build the program the lazy DFA runs, if it hasn't been. The lock is 
+    // only held for that: the DFA locks its own cache, so analyses can run
+    // at once and onMatch and onError can analyze with the Lexer again.
+    void Prepare(std::false_type) const
+    {
+    }
+
+    void Prepare(std::true_type) const
+    {
+        if (m_dense.valid())
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        BuildProgram();
+    }
+
+    void BuildProgram() const
+    {
+        if (m_programBuilt)
+            return;
+
+        m_program.clear();
+        for (auto& expr : m_expressions)
+            m_program.add(expr.Expr.automaton());
+        m_program.finalize(MaxCharCode<_Char>());
+        m_dfa.reset();
+        m_programBuilt = true;
+    }
+
+    // Find the winning definition at start and set end to the end of its 
+    // match. scanEnd is set to the end of the input that was read, and 
+    // detail to what was learned about the token. context is the analysis'
+    // scratch space, and position the offset of start in the input.
+    typename std::pmr::vector<TokenDef>::const_iterator MatchRegex(
+        _StringIt start,
+        _StringIt& end,
+        _StringIt& scanEnd,
+        MatchDetail& detail,
+        context_type& context,
+        size_t position) const
+    {
+        detail.Counted = false;
+        detail.Numeric = false;
+        _Trace::onAttempt(position);
+        auto token = MatchRegex(start, end, scanEnd, detail, context, position, IsNative());
+        if (token != std::end(m_expressions))
+        {
+            _Trace::onMatch(position, end - start,
+                static_cast<uint32_t>(token - std::begin(m_expressions)));
+        }
+        return token;
+    }
+
+    typename std::pmr::vector<TokenDef>::const_iterator MatchRegex(
+        _StringIt start,
+        _StringIt& end,
+        _StringIt& scanEnd,
+        MatchDetail& detail,
+        context_type& context,
+        size_t position,
+        std::true_type) const
+    {
+        // The delimited and numeric definitions aren't in the DFA. The first
+        // one that matches wins unless the DFA finds an earlier definition.
+        uint32_t direct = Program::NoToken;
+        _StringIt directEnd;
+        scanEnd = start;
+        for (size_t i = 0; i < m_direct.size(); ++i)
+        {
+            const uint32_t d = m_direct[i];
+            _StringIt read;
+            bool matched = MatchDirect(
+                m_expressions[d], start, end, directEnd, read, detail);
+            scanEnd = std::max(scanEnd, read);
+            if (!matched)
+                continue;
+
+            // Only definitions the Lexer matches itself come before it
+            if (d == i)
+            {
+                end = directEnd;
+                return std::begin(m_expressions) + d;
+            }
+            direct = d;
+            break;
+        }
+
+        _StringIt matchEnd;
+        _StringIt read;
+        uint32_t token;
+        if (m_linearTime)
+        {
+            ScanMemo& memo = context.Memo;
+            token = m_dense.valid() ? 
+                m_dense.scan(start, end, matchEnd, read, memo, position) : 
+                m_dfa.scan(m_program, start, end, matchEnd, read, memo, position,
+                    context.Lazy);
+        } else {
+            token = m_dense.valid() ? 
+                m_dense.scan(start, end, matchEnd, read) : 
+                m_dfa.scan(m_program, start, end, matchEnd, read, context.Lazy);
+        }
+        scanEnd = std::max(scanEnd, read);
+        if (direct < token)
+        {
+            end = directEnd;
+            return std::begin(m_expressions) + direct;
+        }
+
+        detail.Counted = false;
+        detail.Numeric = false;
+        if (token == Program::NoToken)
+            return std::end(m_expressions);
+
+        end = matchEnd;
+        return std::begin(m_expressions) + token;
+    }
+
+    typename std::pmr::vector<TokenDef>::const_iterator MatchRegex(
         _StringIt start,
-        _StringIt& end) const
+        _StringIt& end,
+        _StringIt& scanEnd,
+        MatchDetail& detail,
+        context_type& context,
+        size_t,
+        std::false_type) const
     {
-        // TODO: does an allocation happen here? That would suck :(
-        std::match_results<_StringIt> results;
+        // There's no telling how far a regex_search looks
+        scanEnd = end;
+        _StringIt matchEnd;
+        _StringIt read;
         for (auto expr = std::begin(m_expressions); 
              expr != std::end(m_expressions); 
              ++expr)
         {
-            if (std::regex_search(start, end, results, expr->Expr,
-                std::regex_constants::match_flag_type::match_continuous |
-                std::regex_constants::match_flag_type::match_not_null |
-                std::regex_constants::match_flag_type::format_no_copy |
-                std::regex_constants::match_flag_type::format_first_only))
+            if (expr->Direct() ? 
+                MatchDirect(*expr, start, end, matchEnd, read, detail) : 
+                RegexTraits<_Regex>::match(
+                    expr->Expr, start, end, matchEnd, context.Results))
             {
-                end = start + results.str().size();
+                end = matchEnd;
                 return expr;
             }
         }
@@ -196,21 +6137,192 @@ private:
         return std::end(m_expressions);
     }
 
+    // Match a delimited or numeric definition at start, which is before end
+    bool MatchDirect(
+        const TokenDef& expr,
+        _StringIt start,
+        _StringIt end,
+        _StringIt& matchEnd,
+        _StringIt& scanEnd,
+        MatchDetail& detail) const
+    {
+        if (expr.Delimited)
+            return MatchDelimited(expr, start, end, matchEnd, scanEnd, detail);
+
+        Number value;
+        if (!ScanNumber(start, end, expr.Numbers, matchEnd, scanEnd, value))
+            return false;
+
+        // Numbers don't span lines
+        detail.Counted = true;
+        detail.Lines = 0;
+        detail.Numeric = true;
+        detail.Value = value;
+        return true;
+    }
+
+    // Match the delimited definition expr at start, which is before end. On
+    // success, sets matchEnd to the end of the token and lines to the 
+    // newlines in it. Either way, sets scanEnd to the end of the input that 
+    // was read. Between delimiters, the scan jumps straight to the next 
+    // character that could close the token, escape or end a line.
+    bool MatchDelimited(
+        const TokenDef& expr,
+        _StringIt start,
+        _StringIt end,
+        _StringIt& matchEnd,
+        _StringIt& scanEnd,
+        MatchDetail& lines) const
+    {
+        const size_t available = end - start;
+        const size_t open = expr.Open.size();
+        if (available < open || 
+            !std::equal(std::begin(expr.Open), std::end(expr.Open), start))
+        {
+            scanEnd = start + std::min(open, available);
+            return false;
+        }
+
+        const _Char newline = '\n';
+        const _Char* const base = &*start;
+        const _Char* const last = base + available;
+        const size_t closeSize = expr.Close.size();
+        const _Char close = expr.Close[0];
+        const _Char escape = expr.Escape ? expr.Escape : close;
+        const _Char* cursor = base + open;
+        const _Char* read = cursor;
+        const _Char* lineBegin = base;
+        size_t count = CountDelimiterLines(base, cursor, lineBegin);
+        for (;;)
+        {
+            const _Char* hit = FindAny(cursor, last, close, escape, newline);
+            if (hit == last)
+                break;
+
+            if (*hit == close)
+            {
+                const size_t compared = std::min<size_t>(closeSize, last - hit);
+                read = std::max(read, hit + compared);
+                if (compared == closeSize && 
+                    std::equal(std::begin(expr.Close), std::end(expr.Close), hit))
+                {
+                    count += CountDelimiterLines(hit, hit + closeSize, lineBegin);
+                    matchEnd = start + (hit + closeSize - base);
+                    scanEnd = matchEnd;
+                    lines.Counted = true;
+                    lines.Lines = count;
+                    lines.LineBegin = start + (lineBegin - base);
+                    return true;
+                }
+
+                // Not the whole closing delimiter, so its first character is
+                // part of the token
+                if (close != newline)
+                {
+                    cursor = hit + 1;
+                    continue;
+                }
+            } else if (*hit == escape) {
+                if (hit + 1 == last)
+                    break;
+                if (hit[1] == newline)
+                {
+                    ++count;
+                    lineBegin = hit + 2;
+                }
+                cursor = hit + 2;
+                continue;
+            }
+
+            if (!expr.SpansLines)
+            {
+                scanEnd = start + (std::max(read, hit + 1) - base);
+                return false;
+            }
+            ++count;
+            lineBegin = hit + 1;
+            cursor = hit + 1;
+        }
+
+        // Never closed
+        scanEnd = end;
+        return false;
+    }
+
+    // The newlines in a delimiter [first, last), setting lineBegin after the
+    // last of them
+    static size_t CountDelimiterLines(
+        const _Char* first, 
+        const _Char* last, 
+        const _Char*& lineBegin)
+    {
+        size_t count = 0;
+        for (const _Char* c = first; c < last; ++c)
+        {
+            if (*c == (_Char)'\n')
+            {
+                ++count;
+                lineBegin = c + 1;
+            }
+        }
+        return count;
+    }
+
+    // The first of a, b or c in [first, last), or last
+    static const char* FindAny(
+        const char* first, 
+        const char* last, 
+        char a, 
+        char b, 
+        char c)
+    {
+        const uint8_t* begin = reinterpret_cast<const uint8_t*>(first);
+        const uint8_t* found = FindAnyByte(
+            begin, 
+            begin + (last - first), 
+            static_cast<uint8_t>(a), 
+            static_cast<uint8_t>(b), 
+            static_cast<uint8_t>(c));
+        return first + (found - begin);
+    }
+
+    template<typename _C>
+    static const _C* FindAny(
+        const _C* first, 
+        const _C* last, 
+        _C a, 
+        _C b, 
+        _C c)
+    {
+        for ( ; first != last; ++first)
+        {
+            if (*first == a || *first == b || *first == c)
+                break;
+        }
+        return first;
+    }
+
     TokenMatch SearchRegex(
         _StringIt start,
-        _StringIt end) const
+        _StringIt end,
+        context_type& context,
+        size_t position) const
     {
         TokenMatch match;
         match.LexemeStart = start;
         match.LexemeEnd = end; //start < end ? start + 1 : start;
         match.Token = std::end(m_expressions);
+        match.Detail.Counted = false;
+        match.Detail.Numeric = false;
     
         if (start >= end)
         {
             return match;
         }
 
-        match.Token = MatchRegex(start, match.LexemeEnd);
+        _StringIt scanEnd;
+        match.Token = MatchRegex(
+            start, match.LexemeEnd, scanEnd, match.Detail, context, position);
 
         // If there are no matches, return the start of the lexime so we can 
         // throw up an error at this location
@@ -223,12 +6335,28 @@ private:
     size_t CountLineNums(
         _StringIt a, 
         _StringIt b, 
-        _StringIt& lineLineBegin)
+        _StringIt& lineLineBegin) const
     {
+        // Long runs of bytes are counted by a vector kernel, and then only 
+        // the last line is read again to find where it begins
+        if (sizeof(_Char) == 1 && b - a >= 32)
+        {
+            const uint8_t* begin = reinterpret_cast<const uint8_t*>(&*a);
+            size_t lineCount = CountNewlines(begin, begin + (b - a));
+            if (lineCount)
+            {
+                _StringIt last = b;
+                while (*--last != (typename _String::value_type)'\n')
+                    ;
+                lineLineBegin = last + 1;
+            }
+            return lineCount;
+        }
+
         size_t lineCount = 0;
         for ( ; a < b; ++a)
         {
-            if (*a == (const _String::value_type)'\n')
+            if (*a == (typename _String::value_type)'\n')
             {
                 lineLineBegin = a + 1;
                 ++lineCount;
@@ -237,7 +6365,268 @@ private:
         return lineCount;
     }
 
-    std::vector<TokenDef> m_expressions;
+    // As above, unless the scan has already counted them
+    size_t CountLineNums(
+        _StringIt a, 
+        _StringIt b, 
+        _StringIt& lineLineBegin,
+        const MatchDetail& counted) const
+    {
+        if (!counted.Counted)
+            return CountLineNums(a, b, lineLineBegin);
+
+        if (counted.Lines)
+            lineLineBegin = counted.LineBegin;
+        return counted.Lines;
+    }
+
+    static Location StartLocation()
+    {
+        Location location;
+        location.line_number = 1;
+        location.within_line = 1;
+        location.global = 0;
+        return location;
+    }
+
+    // The location of the character after a token
+    Location LocationAfter(const _String& script, const token_type& token) const
+    {
+        auto begin = std::begin(script) + token.Where.global;
+        auto end = begin + token.Length;
+        auto lineBegin = begin;
+        size_t lines = CountLineNums(begin, end, lineBegin);
+
+        Location location = token.Where;
+        location.global += token.Length;
+        location.line_number += lines;
+        location.within_line = lines ? 
+            1 + CountColumns(lineBegin, end, IsUtf8()) : 
+            location.within_line + CountColumns(begin, end, IsUtf8());
+        return location;
+    }
+
+    // The body of analyze(): analyze script from checkpoint, a token 
+    // boundary, until a token starts at or after to. Reports only the tokens
+    // that end after skipTo, and records checkpoints if given. Unless 
+    // _Ranged, to, skipTo and checkpoints are ignored and the whole of 
+    // script is analyzed, without the cost of checking them for each token.
+    // A character that no definition matches is skipped once onError returns.
+    template<
+        typename _MatchFunc, 
+        typename _ErrorFunc,
+        bool _Ranged>
+
+    void AnalyzeFrom(
+        const _String& script, 
+        const Location& checkpoint,
+        size_t to,
+        size_t skipTo,
+        _MatchFunc& onMatch, 
+        _ErrorFunc& onError,
+        context_type& context,
+        CheckpointIndex* checkpoints,
+        std::integral_constant<bool, _Ranged>) const
+    {
+        Location location = checkpoint;
+
+        Prepare(IsNative());
+        context.Memo.clear();
+        context.Lazy.begin();
+
+        auto start = std::begin(script);
+        auto cursor = start + std::min(checkpoint.global, script.size());
+        auto end = std::end(script);
+        auto lastLineBegin = cursor;
+        auto columnStart = cursor;
+        size_t column = checkpoint.within_line;
+        size_t due = checkpoints ? checkpoints->due() : std::numeric_limits<size_t>::max();
+        _Trace::onChunk(cursor - start, std::min(to, script.size()));
+        while (cursor < end && (!_Ranged || size_t(cursor - start) < to))
+        {
+            // Match it against any of the tokens
+            TokenMatch match = SearchRegex(cursor, end, context, cursor - start);
+
+            location.global = cursor - start;
+            location.within_line = column + 
+                CountColumns(columnStart, cursor, IsUtf8());
+
+            if (match.Token == std::end(m_expressions))
+            {
+                _Trace::onError(location.global);
+                onError(location);
+                match.LexemeEnd = cursor + SkipLength(cursor, end, IsUtf8());
+            } else if (!_Ranged || size_t(match.LexemeEnd - start) > skipTo) {
+                Deliver(onMatch, location, 
+                    Classify(*match.Token, match.LexemeStart, match.LexemeEnd), 
+                    match.LexemeStart, 
+                    match.LexemeEnd,
+                    match.Detail,
+                    std::is_invocable<_MatchFunc&, const Location&, 
+                        const _TokenID&, _StringIt, _StringIt, const Number&>());
+            }
+
+            size_t lines = CountLineNums(
+                cursor, 
+                match.LexemeEnd, 
+                lastLineBegin,
+                match.Detail);
+            location.line_number += lines;
+
+            // Columns are counted from the last token so that long lines 
+            // aren't counted over and over
+            column = lines ? 1 : location.within_line;
+            columnStart = lines ? lastLineBegin : cursor;
+            cursor = match.LexemeEnd;
+
+            if (_Ranged && size_t(cursor - start) >= due && cursor < end)
+            {
+                Location boundary;
+                boundary.line_number = location.line_number;
+                boundary.within_line = column + CountColumns(columnStart, cursor, IsUtf8());
+                boundary.global = cursor - start;
+                checkpoints->add(boundary);
+                due = checkpoints->due();
+            }
+        }
+    }
+
+    // Append the tokens of script from location onwards to out. Stops at the 
+    // first token boundary at or after syncFrom where one of the old tokens
+    // [sync, syncEnd), moved by delta, begins, and returns that old token. 
+    // Otherwise runs to the end of script and returns syncEnd. location is 
+    // left where analysis stopped, and reach at the furthest position read
+    // while skipping characters since the last token and, if it stopped at
+    // an old token, by a scan for that token.
+    template<typename _TokenIt, typename _Alloc, typename _ErrorFunc>
+    _TokenIt Tokenize(
+        const _String& script,
+        Location& location,
+        size_t syncFrom,
+        _TokenIt sync,
+        _TokenIt syncEnd,
+        ptrdiff_t delta,
+        std::vector<token_type, _Alloc>& out,
+        size_t& reach,
+        _ErrorFunc& onError) const
+    {
+        Prepare(IsNative());
+
+        const auto start = std::begin(script);
+        const auto end = std::end(script);
+        auto cursor = start + location.global;
+        auto lastLineBegin = cursor;
+        auto columnStart = cursor;
+        size_t column = location.within_line;
+        context_type context(resource());
+        reach = 0;
+        _Trace::onChunk(location.global, script.size());
+        for (;;)
+        {
+            const size_t position = cursor - start;
+            location.global = position;
+            location.within_line = column + 
+                CountColumns(columnStart, cursor, IsUtf8());
+
+            if (position >= syncFrom)
+            {
+                while (sync != syncEnd && 
+                       static_cast<ptrdiff_t>(sync->Where.global) + delta < 
+                       static_cast<ptrdiff_t>(position))
+                {
+                    ++sync;
+                }
+                if (sync != syncEnd && 
+                    static_cast<ptrdiff_t>(sync->Where.global) + delta == 
+                    static_cast<ptrdiff_t>(position))
+                {
+                    // The old token's lookahead counts what was skipped 
+                    // before it in the old text, so its own is found again
+                    _StringIt matchEnd = end;
+                    _StringIt scanEnd;
+                    MatchDetail detail;
+                    MatchRegex(cursor, matchEnd, scanEnd, detail, context, position);
+                    reach = std::max<size_t>(reach, 
+                        (scanEnd - start) + (scanEnd == end ? 1 : 0));
+                    return sync;
+                }
+            }
+            if (cursor == end)
+                break;
+
+            _StringIt matchEnd = end;
+            _StringIt scanEnd;
+            MatchDetail detail;
+            auto token = MatchRegex(
+                cursor, matchEnd, scanEnd, detail, context, position);
+            reach = std::max<size_t>(reach, 
+                (scanEnd - start) + (scanEnd == end ? 1 : 0));
+
+            if (token == std::end(m_expressions))
+            {
+                _Trace::onError(location.global);
+                onError(location);
+                matchEnd = cursor + SkipLength(cursor, end, IsUtf8());
+            } else {
+                token_type found;
+                found.ID = Classify(*token, cursor, matchEnd);
+                found.Where = location;
+                found.Length = matchEnd - cursor;
+                found.Lookahead = reach - position;
+                out.push_back(found);
+                reach = 0;
+            }
+
+            size_t lines = CountLineNums(cursor, matchEnd, lastLineBegin, detail);
+            location.line_number += lines;
+            column = lines ? 1 : location.within_line;
+            columnStart = lines ? lastLineBegin : cursor;
+            cursor = matchEnd;
+        }
+        return syncEnd;
+    }
+
+    // Characters to skip past one that no definition matches
+    size_t SkipLength(_StringIt, _StringIt, std::false_type) const
+    {
+        return 1;
+    }
+
+    size_t SkipLength(_StringIt cursor, _StringIt end, std::true_type) const
+    {
+        size_t length = 1;
+        while (length < 4 && 
+               cursor + length < end && 
+               (CharCode(cursor[length]) & 0xC0) == 0x80)
+        {
+            ++length;
+        }
+        return length;
+    }
+
+    size_t CountColumns(_StringIt a, _StringIt b, std::false_type) const
+    {
+        return b - a;
+    }
+
+    // Code points in a run of UTF-8: every byte but the continuation bytes
+    size_t CountColumns(_StringIt a, _StringIt b, std::true_type) const
+    {
+        size_t columns = 0;
+        for ( ; a < b; ++a)
+            columns += (CharCode(*a) & 0xC0) != 0x80;
+        return columns;
+    }
+
+    std::pmr::vector<TokenDef> m_expressions;
+    std::pmr::vector<uint32_t> m_direct;
+    mutable Program m_program;
+    mutable LazyDfa m_dfa;
+    DenseDfa m_dense;
+    mutable bool m_programBuilt;
+    mutable CopyableMutex m_mutex;
+    bool m_sourcesOnly;
+    bool m_linearTime;
 };
 
 }
@@ -0,0 +1,826 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_BULK_H_
+#define _LEX_BULK_H_
+
+#include "Lex.h"
+
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <fstream>
+#include <exception>
+#include <condition_variable>
+#include <memory>
+#include <new>
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       define LEX_IO_URING 1
+#   endif
+#endif
+#ifndef LEX_IO_URING
+#   define LEX_IO_URING 0
+#endif
+
+#if LEX_IO_URING
+#   include <cerrno>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/syscall.h>
+#   include <linux/io_uring.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Lexing many files at once with one shared Lexer, keeping the disk and
+// every core busy:
+//
+//      Lex::BulkLexer<MyLexer> bulk(lexer);
+//      std::vector<Lex::BulkResult> results = bulk.run(paths, onBatch, onError);
+//
+// On Linux the files are read by one thread that keeps many reads in flight
+// through io_uring, and handed to a pool of worker threads to lex as each
+// one arrives. Elsewhere, or where io_uring isn't allowed, each worker reads
+// its next file with blocking reads and then lexes it.
+//
+// A native Lexer that hasn't been compiled builds its DFA as it lexes, and
+// its analyses take turns to scan with it. Each worker lexes with a copy of
+// it instead, so the workers don't wait for each other, but each copy grows
+// a DFA of its own up to the Lexer's dfaMemoryLimit(). Compile the Lexer to
+// share its tables.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// How a BulkLexer reads and lexes.
+//     Threads:    The worker threads that lex. 0 for one per core.
+//     QueueDepth: With io_uring, the files being read at once.
+//     ReadSize:   With io_uring, the most bytes read from a file at a time.
+//     IoUring:    Whether to use io_uring where it is available.
+//-----------------------------------------------------------------------------
+struct BulkOptions
+{
+    BulkOptions()
+        : Threads(0)
+        , QueueDepth(32)
+        , ReadSize(4 * 1024 * 1024)
+        , IoUring(true)
+    {
+    }
+
+    size_t Threads;
+    size_t QueueDepth;
+    size_t ReadSize;
+    bool IoUring;
+};
+
+//-----------------------------------------------------------------------------
+// What became of one file in a BulkLexer::run().
+//     Read:   Whether it could be read. If not, it wasn't lexed.
+//     Bytes:  Its length.
+//     Tokens: The tokens it was lexed into.
+//     Errors: The times onError was called for it.
+//-----------------------------------------------------------------------------
+struct BulkResult
+{
+    bool Read;
+    size_t Bytes;
+    size_t Tokens;
+    size_t Errors;
+};
+
+//-----------------------------------------------------------------------------
+// The file that a BulkLexer's onBatch or onError is called for.
+//     Index:  Its position in the list of paths.
+//     Worker: The 0-based index of the worker thread lexing it, for keeping
+//             results per thread without locks.
+//     Path:   Its path.
+//     Text:   Its contents, which stay valid until the file is lexed.
+//-----------------------------------------------------------------------------
+template<typename _String>
+struct BulkFile
+{
+    size_t Index;
+    size_t Worker;
+    const std::string* Path;
+    const _String* Text;
+};
+
+#if LEX_IO_URING
+//-----------------------------------------------------------------------------
+// Just enough of io_uring to queue reads and collect their results, by way
+// of the system calls rather than liburing.
+//-----------------------------------------------------------------------------
+class IoUring
+{
+public:
+
+    IoUring()
+        : m_fd(-1)
+        , m_sqRing(MAP_FAILED)
+        , m_cqRing(MAP_FAILED)
+        , m_sqes(MAP_FAILED)
+        , m_unsubmitted(0)
+    {
+    }
+
+    ~IoUring()
+    {
+        close();
+    }
+
+    // Set up a ring for at least entries reads at once. Returns false if
+    // the kernel doesn't have io_uring or won't allow it.
+    bool open(unsigned entries)
+    {
+        close();
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return false;
+        m_fd = fd;
+
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (m_sqRing == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        m_cqRing = single ? m_sqRing : mmap(nullptr, m_cqRingSize,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(m_sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(m_cqRing);
+        m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_sqEntries = params.sq_entries;
+        m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        m_unsubmitted = 0;
+        return true;
+    }
+
+    void close()
+    {
+        if (m_sqes != MAP_FAILED)
+            munmap(m_sqes, m_sqesSize);
+        if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+            munmap(m_cqRing, m_cqRingSize);
+        if (m_sqRing != MAP_FAILED)
+            munmap(m_sqRing, m_sqRingSize);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+        m_sqRing = m_cqRing = m_sqes = MAP_FAILED;
+    }
+
+    // Queue a read of size bytes at offset in fd, to be submitted by the
+    // next submit(). tag comes back with its result. Returns false if the
+    // submission queue is full.
+    bool read(int fd, void* buffer, unsigned size, uint64_t offset, uint64_t tag)
+    {
+        io_uring_sqe* sqe = NextEntry();
+        if (!sqe)
+            return false;
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = size;
+        sqe->off = offset;
+        sqe->user_data = tag;
+        Push();
+        return true;
+    }
+
+    // Queue a request to cancel the read with tag, if the kernel hasn't
+    // started it yet. The request's own result comes back with cancelTag.
+    // Returns false if the submission queue is full.
+    bool cancel(uint64_t tag, uint64_t cancelTag)
+    {
+        io_uring_sqe* sqe = NextEntry();
+        if (!sqe)
+            return false;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = tag;
+        sqe->user_data = cancelTag;
+        Push();
+        return true;
+    }
+
+    // Submit the queued reads and wait until at least wait have completed.
+    // Returns false on an error other than an interruption.
+    bool submit(unsigned wait)
+    {
+        long submitted = syscall(__NR_io_uring_enter, m_fd, m_unsubmitted,
+            wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (submitted < 0)
+            return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+
+        m_unsubmitted -= static_cast<unsigned>(submitted);
+        return true;
+    }
+
+    // Take the next completed read, setting tag to its tag and result to
+    // the bytes read or a negated errno. Returns false if none is waiting.
+    bool complete(uint64_t& tag, int& result)
+    {
+        const unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+            return false;
+
+        const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+        tag = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+
+    IoUring(const IoUring&);
+    IoUring& operator =(const IoUring&);
+
+    // The next free submission queue entry, cleared, or null if it's full
+    io_uring_sqe* NextEntry()
+    {
+        const unsigned tail = *m_sqTail;
+        if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+            return nullptr;
+
+        io_uring_sqe* sqe = &static_cast<io_uring_sqe*>(m_sqes)[tail & m_sqMask];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Queue the entry NextEntry() returned
+    void Push()
+    {
+        const unsigned tail = *m_sqTail;
+        m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++m_unsubmitted;
+    }
+
+    int m_fd;
+    void* m_sqRing;
+    void* m_cqRing;
+    void* m_sqes;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    size_t m_sqesSize;
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned m_sqMask;
+    unsigned* m_sqArray;
+    unsigned m_sqEntries;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned m_cqMask;
+    io_uring_cqe* m_cqes;
+    unsigned m_unsubmitted;
+};
+#endif
+
+template<typename _Lexer>
+class BulkLexer
+{
+public:
+
+    typedef typename _Lexer::string_type _String;
+    typedef typename _Lexer::record_type record_type;
+    typedef BulkFile<_String> file_type;
+
+    static_assert(sizeof(typename _String::value_type) == 1,
+        "A BulkLexer reads files into strings of bytes");
+
+    explicit BulkLexer(
+        const _Lexer& lexer,
+        const BulkOptions& options = BulkOptions())
+        : m_lexer(lexer)
+        , m_options(options)
+        , m_usedIoUring(false)
+    {
+    }
+
+    // Read and lex every file in paths, and return what became of each one
+    // in the same order. The worker threads call
+    //
+    //      void onBatch(const Lex::BulkFile<_String>& file,
+    //                   Lex::Span<record_type> tokens);
+    //      void onError(const Lex::BulkFile<_String>& file,
+    //                   const Lex::Location& location);
+    //
+    // as analyzeBatched() calls its functors, so they must be thread-safe.
+    // The calls for one file are made in order by one thread. An exception
+    // thrown by either stops the run and is rethrown here.
+    template<
+        typename _BatchFunc,
+        typename _ErrorFunc>
+
+    std::vector<BulkResult> run(
+        const std::vector<std::string>& paths,
+        _BatchFunc& onBatch,
+        _ErrorFunc& onError)
+    {
+        auto onFile = [](const file_type&, const BulkResult&) {};
+        return run(paths, onBatch, onError, onFile);
+    }
+
+    // As above, and once each file that could be read has been lexed, the
+    // thread that lexed it calls
+    //
+    //      void onFile(const Lex::BulkFile<_String>& file,
+    //                  const Lex::BulkResult& result);
+    //
+    // so that what was gathered for the file can be used and let go before
+    // the run ends
+    template<
+        typename _BatchFunc,
+        typename _ErrorFunc,
+        typename _FileFunc>
+
+    std::vector<BulkResult> run(
+        const std::vector<std::string>& paths,
+        _BatchFunc& onBatch,
+        _ErrorFunc& onError,
+        _FileFunc& onFile)
+    {
+        m_results.assign(paths.size(), BulkResult());
+        m_jobs.clear();
+        m_buffered = 0;
+        m_next = 0;
+        m_closed = false;
+        m_stop = false;
+        m_error = std::exception_ptr();
+
+        size_t threads = m_options.Threads;
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        m_usedIoUring = false;
+#if LEX_IO_URING
+        IoUring ring;
+        m_usedIoUring = m_options.IoUring &&
+            ring.open(static_cast<unsigned>(std::max<size_t>(m_options.QueueDepth, 1)));
+#endif
+
+        std::vector<std::thread> workers;
+        for (size_t worker = 0; worker < threads; ++worker)
+        {
+            workers.push_back(std::thread([&, worker]()
+            {
+                Guard([&]() { Work(paths, worker, onBatch, onError, onFile); });
+            }));
+        }
+
+#if LEX_IO_URING
+        if (m_usedIoUring)
+            Guard([&]() { ReadAll(ring, paths); });
+#endif
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_ready.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+
+        if (m_error)
+            std::rethrow_exception(m_error);
+        return m_results;
+    }
+
+    // Whether the last run() read the files through io_uring
+    bool usedIoUring() const
+    {
+        return m_usedIoUring;
+    }
+
+private:
+
+    BulkLexer(const BulkLexer&);
+    BulkLexer& operator =(const BulkLexer&);
+
+    struct Job
+    {
+        size_t Index;
+        _String Text;
+    };
+
+    // Run a stage, stopping the others if it throws. The first exception is
+    // kept for run() to rethrow.
+    template<typename _Stage>
+    void Guard(_Stage stage)
+    {
+        try
+        {
+            stage();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+            m_stop = true;
+            m_ready.notify_all();
+            m_room.notify_all();
+        }
+    }
+
+    // A worker: lex the files that have been read or, without io_uring,
+    // read the next file itself. An uncompiled native Lexer is copied, so
+    // that the worker's scans don't wait on the others'.
+    template<typename _BatchFunc, typename _ErrorFunc, typename _FileFunc>
+    void Work(
+        const std::vector<std::string>& paths,
+        size_t worker,
+        _BatchFunc& onBatch,
+        _ErrorFunc& onError,
+        _FileFunc& onFile)
+    {
+        std::unique_ptr<_Lexer> copy;
+        if (RegexTraits<typename _Lexer::regex_type>::Native && 
+            !m_lexer.compiledSize())
+        {
+            copy.reset(new _Lexer(m_lexer));
+        }
+        const _Lexer& lexer = copy ? *copy : m_lexer;
+
+        typename _Lexer::context_type context(lexer.resource());
+        Job job;
+        while (m_usedIoUring ? Take(job) : ReadNext(paths, job))
+        {
+            Analyze(lexer, paths, worker, job, context, onBatch, onError, onFile);
+            if (m_usedIoUring)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_buffered;
+                m_room.notify_one();
+            }
+        }
+    }
+
+    bool Take(Job& job)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [&]() { return m_stop || m_closed || !m_jobs.empty(); });
+        if (m_stop || m_jobs.empty())
+            return false;
+
+        job.Index = m_jobs.front().Index;
+        job.Text.swap(m_jobs.front().Text);
+        m_jobs.pop_front();
+        return true;
+    }
+
+    bool ReadNext(const std::vector<std::string>& paths, Job& job)
+    {
+        for (;;)
+        {
+            const size_t index = m_next.fetch_add(1);
+            if (index >= paths.size() || m_stop)
+                return false;
+
+            // A directory opens, but fails as soon as it is read
+            std::ifstream file(paths[index], std::ios::binary | std::ios::ate);
+            const std::streamoff size = file ? std::streamoff(file.tellg()) : -1;
+            file.seekg(0);
+            file.peek();
+            if (size < 0 || file.bad())
+                continue;
+
+            file.clear();
+            job.Index = index;
+            job.Text.assign(static_cast<size_t>(size), 0);
+            if (size)
+                file.read(&job.Text[0], size);
+            if (!file && !file.eof())
+                continue;
+            job.Text.resize(static_cast<size_t>(file.gcount()));
+            return true;
+        }
+    }
+
+    template<typename _BatchFunc, typename _ErrorFunc, typename _FileFunc>
+    void Analyze(
+        const _Lexer& lexer,
+        const std::vector<std::string>& paths,
+        size_t worker,
+        const Job& job,
+        typename _Lexer::context_type& context,
+        _BatchFunc& onBatch,
+        _ErrorFunc& onError,
+        _FileFunc& onFile)
+    {
+        file_type file;
+        file.Index = job.Index;
+        file.Worker = worker;
+        file.Path = &paths[job.Index];
+        file.Text = &job.Text;
+
+        BulkResult& result = m_results[job.Index];
+        result.Read = true;
+        result.Bytes = job.Text.size();
+        auto batch = [&](Span<record_type> tokens)
+        {
+            result.Tokens += tokens.size();
+            onBatch(file, tokens);
+        };
+        auto error = [&](const Location& location)
+        {
+            ++result.Errors;
+            onError(file, location);
+        };
+        lexer.analyzeBatched(job.Text, batch, error, context);
+        onFile(file, result);
+    }
+
+    void Hand(size_t index, _String& text)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(Job());
+            m_jobs.back().Index = index;
+            m_jobs.back().Text.swap(text);
+        }
+        m_ready.notify_one();
+    }
+
+#if LEX_IO_URING
+    // A file being read through io_uring
+    struct PendingRead
+    {
+        PendingRead()
+            : File(-1)
+            , Index(0)
+            , Offset(0)
+            , Queued(false)
+        {
+        }
+
+        int File;
+        size_t Index;
+        size_t Offset;
+        bool Queued;
+        _String Text;
+    };
+
+    // The tag of a request to cancel a read, which no read has
+    static const uint64_t CancelTag = ~uint64_t(0);
+
+    // Wait until none of reads is being read, and close their files. The
+    // reads that the kernel hasn't started are cancelled. If the ring fails
+    // while they are in flight, the kernel could still write to them, so
+    // they are leaked rather than freed.
+    static void DrainReads(IoUring& ring, std::vector<PendingRead>& reads, size_t& inFlight)
+    {
+        for (size_t slot = 0; slot < reads.size(); ++slot)
+        {
+            if (reads[slot].Queued)
+                ring.cancel(slot, CancelTag);
+        }
+        while (inFlight && ring.submit(1))
+        {
+            uint64_t slot;
+            int result;
+            while (ring.complete(slot, result))
+            {
+                if (slot == CancelTag)
+                    continue;
+                reads[slot].Queued = false;
+                --inFlight;
+            }
+        }
+
+        for (auto& read : reads)
+        {
+            if (read.File >= 0)
+                ::close(read.File);
+            read.File = -1;
+        }
+        if (inFlight)
+            new (std::nothrow) std::vector<PendingRead>(std::move(reads));
+    }
+
+    // The I/O thread: keep up to QueueDepth files being read, and hand each
+    // one to the workers when it has all arrived. Files that have been read
+    // but not yet lexed count against the depth too, so that a slow lexer
+    // doesn't let the files pile up in memory. If the run is stopped, the
+    // reads in flight are waited for, since they write to the buffers; so
+    // they are if anything here throws, before the buffers are freed.
+    void ReadAll(IoUring& ring, const std::vector<std::string>& paths)
+    {
+        const size_t depth = std::max<size_t>(m_options.QueueDepth, 1);
+        const size_t readSize = std::min<size_t>(
+            std::max<size_t>(m_options.ReadSize, 1), 1u << 30);
+        std::vector<PendingRead> reads(depth);
+        std::vector<size_t> free;
+        for (size_t slot = depth; slot-- > 0; )
+            free.push_back(slot);
+
+        size_t next = 0;
+        size_t inFlight = 0;
+        struct Drain
+        {
+            ~Drain()
+            {
+                DrainReads(Ring, Reads, InFlight);
+            }
+
+            IoUring& Ring;
+            std::vector<PendingRead>& Reads;
+            size_t& InFlight;
+        } drain = { ring, reads, inFlight };
+
+        // When the submission queue is full, submit what is in it to make
+        // room
+        auto queue = [&](size_t slot)
+        {
+            PendingRead& read = reads[slot];
+            const size_t size = std::min(readSize, read.Text.size() - read.Offset);
+            while (!ring.read(read.File, &read.Text[read.Offset],
+                static_cast<unsigned>(size), read.Offset, slot))
+            {
+                if (!ring.submit(0))
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+            read.Queued = true;
+            ++inFlight;
+        };
+        auto finish = [&](size_t slot, bool succeeded)
+        {
+            PendingRead& read = reads[slot];
+            ::close(read.File);
+            read.File = -1;
+            if (succeeded)
+            {
+                read.Text.resize(read.Offset);
+                Hand(read.Index, read.Text);
+            } else {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_buffered;
+            }
+            read.Text = _String();
+            free.push_back(slot);
+        };
+
+        while ((next < paths.size() && !m_stop) || inFlight)
+        {
+            // Open files while there is room for them
+            while (next < paths.size() && !free.empty() && !m_stop)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    if (m_buffered >= depth)
+                    {
+                        if (inFlight)
+                            break;
+                        m_room.wait(lock, [&]() { return m_stop || m_buffered < depth; });
+                        continue;
+                    }
+                    ++m_buffered;
+                }
+
+                const size_t index = next++;
+                const int file = ::open(paths[index].c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat info;
+                if (file >= 0 && fstat(file, &info) == 0 && S_ISREG(info.st_mode))
+                {
+                    const size_t slot = free.back();
+                    free.pop_back();
+                    PendingRead& read = reads[slot];
+                    read.File = file;
+                    read.Index = index;
+                    read.Offset = 0;
+                    read.Text.assign(static_cast<size_t>(info.st_size), 0);
+                    if (read.Text.empty())
+                        finish(slot, true);
+                    else
+                        queue(slot);
+                    continue;
+                }
+
+                if (file >= 0)
+                    ::close(file);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_buffered;
+            }
+
+            if (!inFlight)
+                continue;
+            if (!ring.submit(1))
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+
+            uint64_t slot;
+            int result;
+            while (ring.complete(slot, result))
+            {
+                PendingRead& read = reads[slot];
+                read.Queued = false;
+                --inFlight;
+                if ((result == -EAGAIN || result == -EINTR) && !m_stop)
+                {
+                    queue(slot);
+                    continue;
+                }
+
+                // A kernel without IORING_OP_READ; read the rest directly
+                if (result == -EINVAL)
+                {
+                    while (read.Offset < read.Text.size() &&
+                           (result = static_cast<int>(pread(read.File,
+                                &read.Text[read.Offset],
+                                std::min(readSize, read.Text.size() - read.Offset),
+                                read.Offset))) > 0)
+                    {
+                        read.Offset += result;
+                    }
+                    result = result < 0 ? -errno : 0;
+                }
+
+                if (result > 0)
+                {
+                    read.Offset += result;
+                    if (read.Offset < read.Text.size() && !m_stop)
+                    {
+                        queue(slot);
+                        continue;
+                    }
+                }
+
+                // Done, short (the file shrank) or failed
+                finish(static_cast<size_t>(slot), result >= 0 && !m_stop);
+            }
+        }
+    }
+#endif
+
+    const _Lexer& m_lexer;
+    BulkOptions m_options;
+    bool m_usedIoUring;
+    std::vector<BulkResult> m_results;
+    std::deque<Job> m_jobs;
+    size_t m_buffered;
+    std::atomic<size_t> m_next;
+    bool m_closed;
+    std::atomic<bool> m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_room;
+    std::exception_ptr m_error;
+};
+
+}
+
+#endif
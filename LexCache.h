@@ -0,0 +1,298 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_CACHE_H_
+#define _LEX_CACHE_H_
+
+#include "Lex.h"
+
+#include <list>
+#include <future>
+#include <functional>
+#include <unordered_map>
+
+//-----------------------------------------------------------------------------
+// A cache of built Lexers, for programs that lex with many grammars that are
+// only known at run time. A grammar is an ordered list of (token id, pattern)
+// definitions; asking for the same list again returns the same Lexer:
+//
+//      typedef Lex::Lexer<TokenID, std::string, Lex::Regex> MyLexer;
+//
+//      Lex::LexerCache<MyLexer>::Definitions grammar;
+//      grammar.push_back(std::make_pair(TOKEN_INTEGER, "[0-9]+"));
+//      ...
+//      auto lex = Lex::LexerCache<MyLexer>::instance().get(grammar);
+//      lex->analyze(script, onMatch, onError);
+//
+// The Lexers are shared and immutable, and may be used from any number of
+// threads at once. With a native _Regex they are compile()d when they are
+// built. The least recently used grammars are dropped once the Lexers take
+// more than the memory budget. A Lexer whose DFA is too large to compile
+// builds it lazily as it lexes instead, so it is charged for all of its
+// DFA's memory limit (see Lexer::setDfaMemoryLimit) from the start, rather
+// than for the little it holds when it is built. A dropped Lexer lives on
+// until the last shared_ptr to it goes away. When several threads ask for a
+// grammar that isn't cached, one of them builds it while the others wait for
+// the result.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// 64-bit FNV-1a, continuing from hash.
+//-----------------------------------------------------------------------------
+inline uint64_t hashBytes(
+    const void* data,
+    size_t size,
+    uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template<typename _Lexer>
+class LexerCache
+{
+public:
+
+    typedef typename _Lexer::token_id_type _TokenID;
+    typedef typename _Lexer::string_type _String;
+    typedef std::vector<std::pair<_TokenID, _String> > Definitions;
+    typedef std::shared_ptr<const _Lexer> Pointer;
+
+    static constexpr size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+    explicit LexerCache(size_t memoryBudget = DefaultMemoryBudget)
+        : m_memoryBudget(memoryBudget)
+        , m_memoryUsage(0)
+    {
+    }
+
+    // The cache shared by the whole process
+    static LexerCache& instance()
+    {
+        static LexerCache cache;
+        return cache;
+    }
+
+    // The Lexer for a grammar, built now if it isn't cached. Throws whatever
+    // building it throws (e.g. a std::regex_error for a malformed pattern);
+    // a failed grammar isn't cached.
+    Pointer get(const Definitions& definitions)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto found = m_index.find(definitions);
+        if (found != m_index.end())
+        {
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            std::shared_future<Pointer> lexer = found->second->Lexer;
+            lock.unlock();
+            return lexer.get();
+        }
+
+        std::promise<Pointer> promise;
+        m_entries.push_front(Entry());
+        auto entry = m_entries.begin();
+        entry->Lexer = promise.get_future().share();
+        entry->Key = &m_index.insert(std::make_pair(definitions, entry)).first->first;
+        lock.unlock();
+
+        Pointer lexer;
+        size_t bytes = 0;
+        try
+        {
+            lexer = Build(definitions);
+            bytes = Charge(*lexer, std::integral_constant<bool,
+                RegexTraits<typename _Lexer::regex_type>::Native>());
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+            lock.lock();
+            m_index.erase(m_index.find(*entry->Key));
+            m_entries.erase(entry);
+            throw;
+        }
+
+        promise.set_value(lexer);
+        lock.lock();
+        entry->Bytes = bytes;
+        entry->Ready = true;
+        m_memoryUsage += bytes;
+        Evict();
+        return lexer;
+    }
+
+    void setMemoryBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memoryBudget = bytes;
+        Evict();
+    }
+
+    size_t memoryBudget() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_memoryBudget;
+    }
+
+    // The memory the cached Lexers are charged for: their memoryUsage() when
+    // they were built, with the whole DFA memory limit of any that build
+    // their DFA lazily
+    size_t memoryUsage() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_memoryUsage;
+    }
+
+    // The number of grammars cached or being built
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+
+    // Drop every grammar that has been built. Lexers still being built stay.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t budget = m_memoryBudget;
+        m_memoryBudget = 0;
+        Evict();
+        m_memoryBudget = budget;
+    }
+
+private:
+
+    struct DefinitionsHash
+    {
+        size_t operator()(const Definitions& definitions) const
+        {
+            uint64_t hash = hashBytes(nullptr, 0);
+            for (auto& definition : definitions)
+            {
+                size_t id = std::hash<_TokenID>()(definition.first);
+                uint64_t length = definition.second.size();
+                hash = hashBytes(&id, sizeof(id), hash);
+                hash = hashBytes(&length, sizeof(length), hash);
+                hash = hashBytes(
+                    definition.second.data(),
+                    definition.second.size() * sizeof(definition.second[0]),
+                    hash);
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct Entry;
+    typedef std::list<Entry> EntryList;
+    typedef std::unordered_map<
+        Definitions,
+        typename EntryList::iterator,
+        DefinitionsHash> Index;
+
+    struct Entry
+    {
+        Entry()
+            : Key(nullptr)
+            , Bytes(0)
+            , Ready(false)
+        {
+        }
+
+        std::shared_future<Pointer> Lexer;
+        const Definitions* Key;
+        size_t Bytes;
+        bool Ready;
+    };
+
+    static Pointer Build(const Definitions& definitions)
+    {
+        std::shared_ptr<_Lexer> lexer = std::make_shared<_Lexer>();
+        for (auto& definition : definitions)
+            lexer->define(definition.first, definition.second);
+        Compile(*lexer, std::integral_constant<bool,
+            RegexTraits<typename _Lexer::regex_type>::Native>());
+        return lexer;
+    }
+
+    static void Compile(_Lexer& lexer, std::true_type)
+    {
+        lexer.compile();
+    }
+
+    static void Compile(_Lexer&, std::false_type)
+    {
+    }
+
+    // The memory to charge for a Lexer: what it holds now, and room for the
+    // lazily built DFA to grow to its limit if it couldn't be compiled
+    static size_t Charge(const _Lexer& lexer, std::true_type)
+    {
+        size_t bytes = lexer.memoryUsage();
+        const size_t limit = lexer.dfaMemoryLimit();
+        if (!lexer.compiledSize() && limit > lexer.dfaMemoryUsage())
+            bytes += limit - lexer.dfaMemoryUsage();
+        return bytes;
+    }
+
+    static size_t Charge(const _Lexer& lexer, std::false_type)
+    {
+        return lexer.memoryUsage();
+    }
+
+    // Drop the least recently used Lexers until the rest fit the budget
+    void Evict()
+    {
+        auto entry = m_entries.end();
+        while (m_memoryUsage > m_memoryBudget && entry != m_entries.begin())
+        {
+            --entry;
+            if (!entry->Ready)
+                continue;
+
+            m_memoryUsage -= entry->Bytes;
+            m_index.erase(m_index.find(*entry->Key));
+            entry = m_entries.erase(entry);
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    EntryList m_entries;
+    Index m_index;
+    size_t m_memoryBudget;
+    size_t m_memoryUsage;
+};
+
+}
+
+#endif
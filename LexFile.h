@@ -0,0 +1,240 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_FILE_H_
+#define _LEX_FILE_H_
+
+#include "Lex.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Saving and loading compiled lexers. A Lexer that has been compile()d can be
+// written to a file once and then mapped straight into memory by later runs,
+// which skips parsing the patterns and building the DFA:
+//
+//      Lex::Lexer<TokenID, std::string, Lex::Regex> lex;
+//      if (!Lex::loadLexer(lex, "tokens.lex"))
+//      {
+//          lex.define(...);
+//          lex.compile();
+//          Lex::saveLexer(lex, "tokens.lex");
+//      }
+//
+// The file records the character and token identifier sizes and the byte
+// order it was written with, and is rejected if they don't match the Lexer
+// loading it. Token identifiers are copied byte for byte, so they must be
+// trivially copyable (enums and integers are fine).
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// A read-only memory mapping of a whole file.
+//-----------------------------------------------------------------------------
+class MappedFile
+{
+public:
+
+    MappedFile()
+        : m_data(nullptr)
+        , m_size(0)
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    // Map the file at path, replacing any current mapping. Returns false if
+    // the file cannot be opened or is empty.
+    bool open(const char* path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+
+        m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!m_data)
+            return false;
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        int file = ::open(path, O_RDONLY);
+        if (file < 0)
+            return false;
+
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+            data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (data == MAP_FAILED)
+            return false;
+
+        m_data = data;
+        m_size = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void close()
+    {
+        if (!m_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<void*>(m_data), m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const void* data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator =(const MappedFile&);
+
+    const void* m_data;
+    size_t m_size;
+};
+
+//-----------------------------------------------------------------------------
+// A name for a temporary file beside path that no other thread or process is
+// using, for writing a file that is then renamed over path
+//-----------------------------------------------------------------------------
+inline std::string temporaryPath(const std::string& path)
+{
+    static std::atomic<unsigned long long> count(0);
+#ifdef _WIN32
+    const unsigned long process = GetCurrentProcessId();
+#else
+    const unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+    char suffix[64];
+    std::snprintf(suffix, sizeof(suffix), ".%lu-%llu.tmp", process,
+        count.fetch_add(1, std::memory_order_relaxed));
+    return path + suffix;
+}
+
+//-----------------------------------------------------------------------------
+// Write a compiled Lexer to path. The image is written to a temporary file
+// first and then renamed over path, so a reader never sees half a file, and
+// processes writing the same path at once don't write over each other.
+// Returns false if the Lexer is not compiled or the file can't be written.
+//-----------------------------------------------------------------------------
+template<typename _Lexer>
+bool saveLexer(const _Lexer& lexer, const char* path)
+{
+    std::vector<uint8_t> image;
+    if (!lexer.serialize(image))
+        return false;
+
+    const std::string temporary = temporaryPath(path);
+    FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+    written = std::fclose(file) == 0 && written;
+    if (written)
+    {
+#ifdef _WIN32
+        written = MoveFileExA(temporary.c_str(), path,
+            MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        written = std::rename(temporary.c_str(), path) == 0;
+#endif
+    }
+    if (!written)
+        std::remove(temporary.c_str());
+    return written;
+}
+
+//-----------------------------------------------------------------------------
+// Map a file written by saveLexer() and attach the Lexer to it. The mapping
+// stays open for as long as the Lexer, or a copy of it, uses the tables.
+// Returns false, leaving the Lexer empty, if the file is missing, malformed
+// or was written for a different kind of Lexer.
+//-----------------------------------------------------------------------------
+template<typename _Lexer>
+bool loadLexer(_Lexer& lexer, const char* path)
+{
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+    {
+        lexer = _Lexer();
+        return false;
+    }
+    return lexer.attach(file->data(), file->size(), file);
+}
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_PERF_H_
+#define _LEX_PERF_H_
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/perf_event.h>)
+#       define LEX_PERF_EVENTS 1
+#   endif
+#endif
+#ifndef LEX_PERF_EVENTS
+#   define LEX_PERF_EVENTS 0
+#endif
+
+#if LEX_PERF_EVENTS
+#   include <unistd.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <linux/perf_event.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// Counting what the CPU does while a Lexer runs, to tell a grammar whose
+// matching is held up by mispredicted branches from one whose tables don't
+// fit in the caches:
+//
+//      Lex::PerfCounters counters;
+//      counters.start();
+//      lexer.analyze(text, onMatch, onError);
+//      counters.stop();
+//      if (counters.available(Lex::PerfBranchMisses))
+//          ... counters[Lex::PerfBranchMisses] / text.size() ...
+//
+// On Linux the counters are read from perf_event, counting user time only,
+// and include the threads that the constructing thread starts afterwards.
+// Where a counter can't be opened (on other systems, in virtual machines
+// without a PMU, or when perf_event_paranoid forbids it) it just isn't
+// available; the others are still counted.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// The events a PerfCounters counts
+//-----------------------------------------------------------------------------
+enum PerfCounter
+{
+    PerfCycles,
+    PerfInstructions,
+    PerfBranchMisses,
+    PerfL1Misses,
+    PerfLLCMisses,
+    PerfCounterCount
+};
+
+//-----------------------------------------------------------------------------
+// The name of a counter, for reports
+//-----------------------------------------------------------------------------
+inline const char* perfCounterName(PerfCounter counter)
+{
+    static const char* const names[] =
+    {
+        "cycles",
+        "instructions",
+        "branch misses",
+        "L1 misses",
+        "LLC misses"
+    };
+    return counter < PerfCounterCount ? names[counter] : "unknown";
+}
+
+class PerfCounters
+{
+public:
+
+    PerfCounters()
+    {
+        memset(m_values, 0, sizeof(m_values));
+        memset(m_start, 0, sizeof(m_start));
+        for (int c = 0; c < PerfCounterCount; ++c)
+            m_files[c] = Open(static_cast<PerfCounter>(c));
+    }
+
+    ~PerfCounters()
+    {
+#if LEX_PERF_EVENTS
+        for (int c = 0; c < PerfCounterCount; ++c)
+        {
+            if (m_files[c] >= 0)
+                close(m_files[c]);
+        }
+#endif
+    }
+
+    // Whether any counter could be opened
+    bool available() const
+    {
+        for (int c = 0; c < PerfCounterCount; ++c)
+        {
+            if (m_files[c] >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Whether the counter could be opened
+    bool available(PerfCounter counter) const
+    {
+        return m_files[counter] >= 0;
+    }
+
+    // Begin a measurement
+    void start()
+    {
+        for (int c = 0; c < PerfCounterCount; ++c)
+            Read(m_files[c], m_start[c]);
+    }
+
+    // End the measurement, so that operator[] returns the counts since
+    // start(). Where the kernel had to share the hardware between counters,
+    // the counts are scaled up from the time each was running.
+    void stop()
+    {
+        for (int c = 0; c < PerfCounterCount; ++c)
+        {
+            Reading now;
+            m_values[c] = 0;
+            if (!Read(m_files[c], now))
+                continue;
+
+            const uint64_t value = now.Value - m_start[c].Value;
+            const uint64_t enabled = now.Enabled - m_start[c].Enabled;
+            const uint64_t running = now.Running - m_start[c].Running;
+            m_values[c] = running && running < enabled ?
+                static_cast<uint64_t>(static_cast<double>(value) * enabled / running) :
+                value;
+        }
+    }
+
+    // The count from the last measurement, or 0 if the counter isn't
+    // available
+    uint64_t operator[](PerfCounter counter) const
+    {
+        return m_values[counter];
+    }
+
+private:
+
+    // Uncopyable
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    // What the kernel reports for a counter: its value, and for how long
+    // it was enabled and actually counting
+    struct Reading
+    {
+        uint64_t Value;
+        uint64_t Enabled;
+        uint64_t Running;
+    };
+
+    static int Open(PerfCounter counter)
+    {
+#if LEX_PERF_EVENTS
+        static const uint32_t types[] =
+        {
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HW_CACHE
+        };
+        static const uint64_t configs[] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_LL |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+
+        // Separate counters rather than a group, since a group can't be
+        // inherited by new threads
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[counter];
+        attr.config = configs[counter];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        const long file = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        return file < 0 ? -1 : static_cast<int>(file);
+#else
+        (void)counter;
+        return -1;
+#endif
+    }
+
+    static bool Read(int file, Reading& reading)
+    {
+        memset(&reading, 0, sizeof(reading));
+#if LEX_PERF_EVENTS
+        if (file < 0)
+            return false;
+        return read(file, &reading, sizeof(reading)) == sizeof(reading);
+#else
+        (void)file;
+        return false;
+#endif
+    }
+
+    int m_files[PerfCounterCount];
+    Reading m_start[PerfCounterCount];
+    uint64_t m_values[PerfCounterCount];
+};
+
+}
+
+#endif
@@ -0,0 +1,402 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_PIPELINE_H_
+#define _LEX_PIPELINE_H_
+
+#include "Lex.h"
+
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <exception>
+
+//-----------------------------------------------------------------------------
+// Reading, lexing and consuming a file at the same time, on three threads.
+// One thread reads the file a chunk at a time, another lexes what has been
+// read so far and a third, the caller's, hands the tokens to the consumer in
+// batches as analyzeBatched() does:
+//
+//      Lex::Pipeline<MyLexer> pipeline(lexer);
+//      if (!pipeline.run("big.src", onBatch, onError))
+//          // The file couldn't be read
+//
+// The tokens go from the lexing thread to the consumer through a lock-free
+// ring of TokenRecords. When the consumer falls behind and the ring fills,
+// the lexer waits for it; PipelineOptions sets the size of the ring, the
+// size of each read and how long a waiting thread spins before it yields.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// A fixed-size queue that one thread pushes to and another pops from, with
+// no locks. Each side keeps its own index on its own cache line, and a copy
+// of the other's that it only refreshes when the ring looks full or empty.
+// The capacity is rounded up to a power of two.
+//-----------------------------------------------------------------------------
+template<typename _Type>
+class SpscRing
+{
+public:
+
+    explicit SpscRing(size_t capacity)
+        : m_head(0)
+        , m_cachedTail(0)
+        , m_tail(0)
+        , m_cachedHead(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_items.reset(new _Type[size]);
+        m_mask = size - 1;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    // Producer: copy as many of the count items in as there is room for and
+    // return how many that was
+    size_t push(const _Type* items, size_t count)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead + count > capacity())
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+
+        count = std::min(count, capacity() - (tail - m_cachedHead));
+        for (size_t i = 0; i < count; ++i)
+            m_items[(tail + i) & m_mask] = items[i];
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: the items at the front of the ring that are contiguous in
+    // memory, which stay valid until they are pop()ped
+    Span<_Type> peek()
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail)
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+
+        const size_t first = head & m_mask;
+        const size_t count = std::min(m_cachedTail - head, capacity() - first);
+        return Span<_Type>(&m_items[first], count);
+    }
+
+    // Empty the ring. Neither side may be using it.
+    void clear()
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+        m_cachedHead = 0;
+        m_cachedTail = 0;
+    }
+
+    // Consumer: drop count items from the front of the ring
+    void pop(size_t count)
+    {
+        m_head.store(
+            m_head.load(std::memory_order_relaxed) + count,
+            std::memory_order_release);
+    }
+
+private:
+
+    SpscRing(const SpscRing&);
+    SpscRing& operator =(const SpscRing&);
+
+    static constexpr size_t CacheLine = 64;
+
+    alignas(CacheLine) std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+    alignas(CacheLine) std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+    alignas(CacheLine) std::unique_ptr<_Type[]> m_items;
+    size_t m_mask;
+};
+
+//-----------------------------------------------------------------------------
+// How a Pipeline buffers its stages.
+//     ChunkSize: The bytes read from the file at a time. The lexer can start
+//                on each chunk as soon as it has been read.
+//     RingSize:  The tokens that can wait between the lexer and the
+//                consumer before the lexer waits for the consumer.
+//     SpinCount: How many times a waiting thread checks again before it
+//                starts to yield its core to other threads.
+//-----------------------------------------------------------------------------
+struct PipelineOptions
+{
+    PipelineOptions()
+        : ChunkSize(1024 * 1024)
+        , RingSize(64 * 1024)
+        , SpinCount(4096)
+    {
+    }
+
+    size_t ChunkSize;
+    size_t RingSize;
+    size_t SpinCount;
+};
+
+template<typename _Lexer>
+class Pipeline
+{
+public:
+
+    typedef typename _Lexer::string_type _String;
+    typedef typename _Lexer::record_type record_type;
+
+    static_assert(sizeof(typename _String::value_type) == 1,
+        "A Pipeline reads files into strings of bytes");
+
+    explicit Pipeline(
+        const _Lexer& lexer,
+        const PipelineOptions& options = PipelineOptions())
+        : m_lexer(lexer)
+        , m_options(options)
+        , m_ring(options.RingSize)
+    {
+    }
+
+    // Lex the file at path. onBatch is called on this thread with the
+    // tokens in order, a Span<record_type> at a time. onError is called on
+    // the lexing thread as by analyzeBatched(), so the consumer may not yet
+    // have seen the tokens before the error. Returns false if the file 
+    // can't be opened or read. An exception thrown by onBatch or onError
+    // stops the other stages and is rethrown here.
+    template<
+        typename _BatchFunc,
+        typename _ErrorFunc>
+
+    bool run(
+        const char* path,
+        _BatchFunc& onBatch,
+        _ErrorFunc& onError)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+
+        // A directory opens, but fails as soon as it is read
+        const std::streamoff size = file.tellg();
+        file.seekg(0);
+        file.peek();
+        if (size < 0 || file.bad())
+            return false;
+        file.clear();
+
+        // The whole file stays in memory so that the consumer can read the
+        // text of its tokens
+        m_text.assign(static_cast<size_t>(size), 0);
+        m_ring.clear();
+        m_available.store(0, std::memory_order_relaxed);
+        m_readDone.store(false, std::memory_order_relaxed);
+        m_lexDone.store(false, std::memory_order_relaxed);
+        m_stop.store(false, std::memory_order_relaxed);
+        m_failed = false;
+        m_error = std::exception_ptr();
+
+        std::thread reader([&]() { Guard([&]() { Read(file); }); });
+        std::thread lexer([&]() { Guard([&]() { Analyze(onError); }); });
+        Guard([&]() { Consume(onBatch); });
+        reader.join();
+        lexer.join();
+
+        if (m_error)
+            std::rethrow_exception(m_error);
+        return !m_failed;
+    }
+
+    // The text of the file being lexed, as far as it has been read. Valid
+    // for the tokens delivered so far, until the next run().
+    const _String& text() const
+    {
+        return m_text;
+    }
+
+private:
+
+    Pipeline(const Pipeline&);
+    Pipeline& operator =(const Pipeline&);
+
+    // Spins, then yields, until ready() or the pipeline is stopped. Returns
+    // false if it was stopped.
+    template<typename _Ready>
+    bool Wait(_Ready ready) const
+    {
+        for (size_t spins = 0; !ready(); ++spins)
+        {
+            if (m_stop.load(std::memory_order_relaxed))
+                return false;
+            if (spins >= m_options.SpinCount)
+                std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // Run a stage, stopping the others if it throws. The first exception is
+    // kept for run() to rethrow.
+    template<typename _Stage>
+    void Guard(_Stage stage)
+    {
+        try
+        {
+            stage();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_errorMutex);
+            if (!m_error)
+                m_error = std::current_exception();
+            m_stop.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void Read(std::ifstream& file)
+    {
+        char* data = m_text.empty() ? nullptr : &m_text[0];
+        size_t offset = 0;
+        while (offset < m_text.size() && !m_stop.load(std::memory_order_relaxed))
+        {
+            const size_t chunk = std::min(
+                std::max<size_t>(m_options.ChunkSize, 1),
+                m_text.size() - offset);
+            file.read(data + offset, static_cast<std::streamsize>(chunk));
+            const size_t read = static_cast<size_t>(file.gcount());
+            offset += read;
+            m_available.store(offset, std::memory_order_release);
+            if (read < chunk)
+            {
+                // The file shrank or can't be read; lex what there is
+                m_failed = file.bad();
+                break;
+            }
+        }
+        m_readDone.store(true, std::memory_order_release);
+    }
+
+    template<typename _ErrorFunc>
+    void Analyze(_ErrorFunc& onError)
+    {
+        typename _Lexer::context_type context(m_lexer.resource());
+        Location where = { 1, 1, 0 };
+        size_t seen = 0;
+        auto onBatch = [&](Span<record_type> tokens)
+        {
+            const record_type* items = tokens.data();
+            size_t count = tokens.size();
+            while (count)
+            {
+                size_t pushed = 0;
+                if (!Wait([&]() { return (pushed = m_ring.push(items, count)) != 0; }))
+                    throw Stopped();
+                items += pushed;
+                count -= pushed;
+            }
+        };
+
+        try
+        {
+            for (;;)
+            {
+                // Done must be read first, so that available is then final
+                bool done = false;
+                size_t available = 0;
+                if (!Wait([&]()
+                    {
+                        done = m_readDone.load(std::memory_order_acquire);
+                        available = m_available.load(std::memory_order_acquire);
+                        return done || available > seen;
+                    }))
+                {
+                    break;
+                }
+
+                seen = available;
+                m_lexer.analyzeAvailable(m_text, where, available, done,
+                    onBatch, onError, context);
+                if (done)
+                    break;
+            }
+        }
+        catch (const Stopped&)
+        {
+        }
+        m_lexDone.store(true, std::memory_order_release);
+    }
+
+    template<typename _BatchFunc>
+    void Consume(_BatchFunc& onBatch)
+    {
+        for (;;)
+        {
+            Span<record_type> tokens = m_ring.peek();
+            if (tokens.empty())
+            {
+                // Check the ring again after seeing the lexer finish, in
+                // case it pushed its last tokens in between
+                bool done = false;
+                if (!Wait([&]()
+                    {
+                        done = m_lexDone.load(std::memory_order_acquire);
+                        return done || !(tokens = m_ring.peek()).empty();
+                    }))
+                {
+                    return;
+                }
+                if (done && (tokens = m_ring.peek()).empty())
+                    return;
+            }
+
+            onBatch(tokens);
+            m_ring.pop(tokens.size());
+        }
+    }
+
+    struct Stopped
+    {
+    };
+
+    const _Lexer& m_lexer;
+    PipelineOptions m_options;
+    SpscRing<record_type> m_ring;
+    _String m_text;
+    std::atomic<size_t> m_available;
+    std::atomic<bool> m_readDone;
+    std::atomic<bool> m_lexDone;
+    std::atomic<bool> m_stop;
+    bool m_failed;
+    std::mutex m_errorMutex;
+    std::exception_ptr m_error;
+};
+
+}
+
+#endif
@@ -0,0 +1,434 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_TOKEN_CACHE_H_
+#define _LEX_TOKEN_CACHE_H_
+
+#include "Lex.h"
+#include "LexFile.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+//-----------------------------------------------------------------------------
+// A cache of token lists on disk, so that text that has been lexed before
+// isn't lexed again. Each list is kept in a file named after a hash of the
+// compiled grammar and the hash and size of the text, and a hit maps the
+// file and hands out its tokens in place:
+//
+//      Lex::TokenCache<MyLexer> cache(lexer, "build/tokens");
+//      Lex::CachedTokens<MyLexer> tokens = cache.get(text);
+//      for (auto& token : tokens.tokens())
+//          ...
+//
+// Text that has been lexed before then costs one pass of a fast hash over
+// it. The tokens are stored as the TokenRecords analyzeBatched() delivers,
+// so they need no decoding. Only a compile()d Lexer can be hashed; with any
+// other the cache is disabled and get() always lexes. Several threads, and
+// several processes, may share a cache directory: each file is written to a
+// temporary name and renamed into place. Nothing is ever removed from the
+// directory, which may be emptied at any time.
+//
+// The text itself isn't kept, so a hit is never checked against it. Two
+// texts of the same size whose 64-bit hashes collide share a file, and the
+// second gets the first's tokens. xxHash64 is not a cryptographic hash, so
+// don't use the cache for text that may be crafted to collide.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// A 64-bit hash of size bytes (xxHash64), fast enough that hashing a file
+// costs little next to reading it.
+//-----------------------------------------------------------------------------
+inline uint64_t hashContent(const void* data, size_t size, uint64_t seed = 0)
+{
+    static constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+    static constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+    auto rotate = [](uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); };
+    auto read64 = [](const uint8_t* p) { uint64_t x; std::memcpy(&x, p, 8); return x; };
+    auto read32 = [](const uint8_t* p) { uint32_t x; std::memcpy(&x, p, 4); return x; };
+    auto mix = [&](uint64_t acc, uint64_t input)
+    {
+        return rotate(acc + input * Prime2, 31) * Prime1;
+    };
+    auto merge = [&](uint64_t acc, uint64_t lane)
+    {
+        return (acc ^ mix(0, lane)) * Prime1 + Prime4;
+    };
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = p + size;
+    uint64_t hash;
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = { seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1 };
+        for ( ; end - p >= 32; p += 32)
+        {
+            for (int l = 0; l < 4; ++l)
+                lanes[l] = mix(lanes[l], read64(p + l * 8));
+        }
+        hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) +
+            rotate(lanes[2], 12) + rotate(lanes[3], 18);
+        for (int l = 0; l < 4; ++l)
+            hash = merge(hash, lanes[l]);
+    } else {
+        hash = seed + Prime5;
+    }
+
+    hash += size;
+    for ( ; end - p >= 8; p += 8)
+        hash = rotate(hash ^ mix(0, read64(p)), 27) * Prime1 + Prime4;
+    if (end - p >= 4)
+    {
+        hash = rotate(hash ^ (read32(p) * Prime1), 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    for ( ; p < end; ++p)
+        hash = rotate(hash ^ (*p * Prime5), 11) * Prime1;
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+template<typename _Lexer> class TokenCache;
+
+//-----------------------------------------------------------------------------
+// The tokens and errors of one text, either mapped from a TokenCache file or
+// lexed into memory. They stay valid for as long as the CachedTokens.
+//-----------------------------------------------------------------------------
+template<typename _Lexer>
+class CachedTokens
+{
+public:
+
+    typedef typename _Lexer::record_type record_type;
+
+    CachedTokens()
+        : m_mappedTokens(nullptr)
+        , m_mappedErrors(nullptr)
+        , m_tokenCount(0)
+        , m_errorCount(0)
+    {
+    }
+
+    Span<record_type> tokens() const
+    {
+        return m_file ?
+            Span<record_type>(m_mappedTokens, m_tokenCount) :
+            Span<record_type>(m_lexedTokens.data(), m_lexedTokens.size());
+    }
+
+    // The Location of each character that no definition matched
+    Span<Location> errors() const
+    {
+        return m_file ?
+            Span<Location>(m_mappedErrors, m_errorCount) :
+            Span<Location>(m_lexedErrors.data(), m_lexedErrors.size());
+    }
+
+    // Whether the tokens came from the cache rather than being lexed
+    bool hit() const
+    {
+        return m_file != nullptr;
+    }
+
+private:
+
+    friend class TokenCache<_Lexer>;
+
+    std::shared_ptr<MappedFile> m_file;
+    std::vector<record_type> m_lexedTokens;
+    std::vector<Location> m_lexedErrors;
+    const record_type* m_mappedTokens;
+    const Location* m_mappedErrors;
+    size_t m_tokenCount;
+    size_t m_errorCount;
+};
+
+template<typename _Lexer>
+class TokenCache
+{
+public:
+
+    typedef typename _Lexer::string_type _String;
+    typedef typename _Lexer::record_type record_type;
+
+    static_assert(std::is_trivially_copyable<record_type>::value,
+        "A TokenCache stores token identifiers byte for byte");
+
+    // A cache of the tokens lexer finds, kept in directory, which must exist.
+    // The Lexer must outlive the cache and not be changed while it is used.
+    TokenCache(const _Lexer& lexer, const std::string& directory)
+        : m_lexer(lexer)
+        , m_directory(directory)
+        , m_enabled(false)
+        , m_grammarHash(0)
+        , m_hits(0)
+        , m_misses(0)
+    {
+        std::vector<uint8_t> image;
+        if (lexer.serialize(image))
+        {
+            m_enabled = true;
+            m_grammarHash = hashContent(image.data(), image.size());
+        }
+        if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+            m_directory += '/';
+    }
+
+    // The tokens of text: mapped from the cache if it has been lexed before,
+    // otherwise lexed and then stored. A cache file that can't be written
+    // is only a missed chance; the tokens are returned all the same.
+    CachedTokens<_Lexer> get(const _String& text)
+    {
+        CachedTokens<_Lexer> result;
+        const size_t bytes = text.size() * sizeof(typename _String::value_type);
+        const uint64_t contentHash = hashContent(text.data(), bytes, m_grammarHash);
+        const std::string path = PathOf(contentHash, bytes);
+        if (m_enabled && Load(path, contentHash, bytes, result))
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        auto onBatch = [&](Span<record_type> tokens)
+        {
+            result.m_lexedTokens.insert(result.m_lexedTokens.end(), tokens.begin(), tokens.end());
+        };
+        auto onError = [&](const Location& location)
+        {
+            result.m_lexedErrors.push_back(location);
+        };
+        m_lexer.analyzeBatched(text, onBatch, onError);
+        if (m_enabled)
+            Store(path, contentHash, bytes, result);
+        return result;
+    }
+
+    // False if the Lexer isn't compiled, in which case get() always lexes
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    uint64_t grammarHash() const
+    {
+        return m_grammarHash;
+    }
+
+    size_t hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    size_t misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    TokenCache(const TokenCache&);
+    TokenCache& operator =(const TokenCache&);
+
+    // Layout of a cache file: this header, the token records, then the
+    // error Locations, each starting on an 8-byte boundary. The hashes and
+    // the content's size repeat the file name, so that a file copied or
+    // renamed by mistake is not believed.
+    struct FileHeader
+    {
+        char Magic[4];
+        uint32_t Version;
+        uint32_t ByteOrder;
+        uint32_t RecordSize;
+        uint32_t LocationSize;
+        uint32_t Reserved;
+        uint64_t GrammarHash;
+        uint64_t ContentHash;
+        uint64_t ContentSize;
+        uint64_t Tokens;
+        uint64_t Errors;
+    };
+
+    static constexpr char FileMagic[4] = { 'L', 'X', 'T', 'C' };
+    static constexpr uint32_t FileVersion = 1;
+    static constexpr uint32_t FileByteOrder = 0x01020304;
+
+    static size_t Align(size_t offset)
+    {
+        return (offset + 7) & ~size_t(7);
+    }
+
+    // Texts are told apart by their size as well as their hash, so that
+    // texts whose hashes collide only share a file if they are also the
+    // same size
+    std::string PathOf(uint64_t contentHash, size_t bytes) const
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%016llx-%016llx-%llx.tok",
+            static_cast<unsigned long long>(m_grammarHash),
+            static_cast<unsigned long long>(contentHash),
+            static_cast<unsigned long long>(bytes));
+        return m_directory + name;
+    }
+
+    // Copy a record into zeroed space field by field, so that its padding
+    // doesn't carry whatever was in memory into the file
+    static void CopyRecord(uint8_t* out, const record_type& record)
+    {
+        std::memcpy(out + offsetof(record_type, ID), &record.ID, sizeof(record.ID));
+        std::memcpy(out + offsetof(record_type, Offset), &record.Offset, sizeof(record.Offset));
+        std::memcpy(out + offsetof(record_type, Length), &record.Length, sizeof(record.Length));
+        std::memcpy(out + offsetof(record_type, Line), &record.Line, sizeof(record.Line));
+    }
+
+    FileHeader HeaderFor(uint64_t contentHash, size_t bytes) const
+    {
+        FileHeader header = FileHeader();
+        std::memcpy(header.Magic, FileMagic, sizeof(header.Magic));
+        header.Version = FileVersion;
+        header.ByteOrder = FileByteOrder;
+        header.RecordSize = sizeof(record_type);
+        header.LocationSize = sizeof(Location);
+        header.GrammarHash = m_grammarHash;
+        header.ContentHash = contentHash;
+        header.ContentSize = bytes;
+        return header;
+    }
+
+    bool Load(
+        const std::string& path,
+        uint64_t contentHash,
+        size_t bytes,
+        CachedTokens<_Lexer>& result) const
+    {
+        std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+        if (!file->open(path.c_str()) || file->size() < sizeof(FileHeader))
+            return false;
+
+        FileHeader header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        FileHeader expected = HeaderFor(contentHash, bytes);
+        expected.Tokens = header.Tokens;
+        expected.Errors = header.Errors;
+        if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+            return false;
+
+        const uint64_t tokens = Align(sizeof(FileHeader));
+        const uint64_t errors = Align(tokens + header.Tokens * sizeof(record_type));
+        if (header.Tokens > file->size() / sizeof(record_type) ||
+            header.Errors > file->size() / sizeof(Location) ||
+            errors + header.Errors * sizeof(Location) != file->size())
+        {
+            return false;
+        }
+
+        const uint8_t* data = static_cast<const uint8_t*>(file->data());
+        result.m_mappedTokens = reinterpret_cast<const record_type*>(data + tokens);
+        result.m_tokenCount = static_cast<size_t>(header.Tokens);
+        result.m_mappedErrors = reinterpret_cast<const Location*>(data + errors);
+        result.m_errorCount = static_cast<size_t>(header.Errors);
+        result.m_file = file;
+        return true;
+    }
+
+    void Store(
+        const std::string& path,
+        uint64_t contentHash,
+        size_t bytes,
+        const CachedTokens<_Lexer>& result)
+    {
+        FileHeader header = HeaderFor(contentHash, bytes);
+        header.Tokens = result.m_lexedTokens.size();
+        header.Errors = result.m_lexedErrors.size();
+
+        const std::string temporary = temporaryPath(path);
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return;
+
+        static const uint8_t padding[8] = {};
+        auto write = [&](const void* data, size_t size)
+        {
+            return !size || std::fwrite(data, 1, size, file) == size;
+        };
+        bool written =
+            write(&header, sizeof(header)) &&
+            write(padding, Align(sizeof(header)) - sizeof(header));
+
+        const std::vector<record_type>& records = result.m_lexedTokens;
+        const size_t batch = 4096;
+        std::vector<uint8_t> staging(std::min(records.size(), batch) * sizeof(record_type));
+        for (size_t first = 0; written && first < records.size(); first += batch)
+        {
+            const size_t count = std::min(batch, records.size() - first);
+            std::memset(staging.data(), 0, count * sizeof(record_type));
+            for (size_t i = 0; i < count; ++i)
+                CopyRecord(&staging[i * sizeof(record_type)], records[first + i]);
+            written = write(staging.data(), count * sizeof(record_type));
+        }
+
+        const size_t tokens = records.size() * sizeof(record_type);
+        written = written &&
+            write(padding, Align(tokens) - tokens) &&
+            write(result.m_lexedErrors.data(), result.m_lexedErrors.size() * sizeof(Location));
+        written = std::fclose(file) == 0 && written;
+        if (written)
+        {
+#ifdef _WIN32
+            written = MoveFileExA(temporary.c_str(), path.c_str(),
+                MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+            written = std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+        }
+        if (!written)
+            std::remove(temporary.c_str());
+    }
+
+    const _Lexer& m_lexer;
+    std::string m_directory;
+    bool m_enabled;
+    uint64_t m_grammarHash;
+    std::atomic<size_t> m_hits;
+    std::atomic<size_t> m_misses;
+};
+
+}
+
+#endif
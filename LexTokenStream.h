@@ -0,0 +1,637 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_TOKEN_STREAM_H_
+#define _LEX_TOKEN_STREAM_H_
+
+#include "Lex.h"
+
+#include <ostream>
+
+//-----------------------------------------------------------------------------
+// A compact serialized form of a list of tokens, for keeping them between
+// passes. A TokenStreamWriter is fast enough to be handed to
+// analyzeBatched() as the batch functor itself, and writes each block of
+// tokens to a std::ostream as soon as it is full:
+//
+//      std::ofstream file("tokens.lxs", std::ios::binary);
+//      Lex::TokenStreamWriter<TokenID> writer(file);
+//      lex.analyzeBatched(text, writer, onError);
+//      writer.finish();
+//
+// A TokenStreamReader decodes the tokens from memory (such as a MappedFile)
+// a block at a time, and can seek to any token, or to the token at any
+// offset in the text, by way of the index of blocks at the end:
+//
+//      Lex::TokenStreamReader<TokenID> reader;
+//      reader.open(file.data(), file.size());
+//      reader.seekOffset(12345);
+//      Lex::TokenRecord<TokenID> token;
+//      while (reader.next(token))
+//          ...
+//
+// Each token takes a varint of its identifier (with two flags in the low
+// bits) and a varint of its length, plus the gap since the last token and
+// the change of line only where they are not zero; most tokens take two
+// bytes. Token identifiers must be integers or enums in [0, 2^62).
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// The layout of a token stream. Numbers are little-endian.
+//     Header:  "LXTS", the version (u32) and the tokens per block (u32).
+//     Blocks:  The varint count of tokens in the block, the offset and line
+//              of its first token (varints), then its tokens. A token is a
+//              varint tag (identifier << 2 | gap? << 1 | new line?), the
+//              varint length, then the zigzag varint gap from the end of the
+//              last token and the zigzag varint change of line, if flagged.
+//              The first token of a block is relative to its checkpoint.
+//     Index:   For each block, the u64 position of the block, index of its
+//              first token and offset of its first token.
+//     Footer:  The u64 position of the index, the number of blocks and the
+//              number of tokens, then "LXTE" and 4 bytes of zeros.
+//-----------------------------------------------------------------------------
+struct TokenStreamFormat
+{
+    static constexpr char Magic[4] = { 'L', 'X', 'T', 'S' };
+    static constexpr char EndMagic[4] = { 'L', 'X', 'T', 'E' };
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t HeaderSize = 12;
+    static constexpr size_t IndexEntrySize = 24;
+    static constexpr size_t FooterSize = 32;
+    static constexpr size_t DefaultBlockTokens = 4096;
+
+    static uint8_t* PutVarint(uint8_t* out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<uint8_t>(value);
+        return out;
+    }
+
+    // Returns nullptr if the varint runs past end or is too long
+    static const uint8_t* GetVarint(const uint8_t* in, const uint8_t* end, uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; in < end && shift < 64; shift += 7)
+        {
+            const uint8_t byte = *in++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return in;
+        }
+        return nullptr;
+    }
+
+    static uint64_t ZigZag(int64_t value)
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static int64_t UnZigZag(uint64_t value)
+    {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    static void Put32(uint8_t* out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    static void Put64(uint8_t* out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            out[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    static uint32_t Get32(const uint8_t* in)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+            value |= static_cast<uint32_t>(in[i]) << (i * 8);
+        return value;
+    }
+
+    static uint64_t Get64(const uint8_t* in)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i)
+            value |= static_cast<uint64_t>(in[i]) << (i * 8);
+        return value;
+    }
+};
+
+template<typename _TokenID>
+class TokenStreamWriter
+{
+public:
+
+    typedef TokenRecord<_TokenID> record_type;
+
+    static_assert(std::is_integral<_TokenID>::value || std::is_enum<_TokenID>::value,
+        "A token stream stores token identifiers as integers");
+
+    // Write a stream to out, with a checkpoint every blockTokens tokens.
+    // The header is written now.
+    explicit TokenStreamWriter(
+        std::ostream& out,
+        size_t blockTokens = TokenStreamFormat::DefaultBlockTokens)
+        : m_out(out)
+        , m_blockTokens(std::max<size_t>(blockTokens, 1))
+        , m_written(0)
+        , m_tokens(0)
+        , m_used(0)
+        , m_blockCount(0)
+        , m_blockOffset(0)
+        , m_blockLine(0)
+        , m_end(0)
+        , m_line(0)
+        , m_finished(false)
+    {
+        m_block.resize(std::min<size_t>(m_blockTokens, 1024) * MaxTokenSize);
+
+        uint8_t header[TokenStreamFormat::HeaderSize];
+        std::memcpy(header, TokenStreamFormat::Magic, 4);
+        TokenStreamFormat::Put32(header + 4, TokenStreamFormat::Version);
+        TokenStreamFormat::Put32(header + 8, static_cast<uint32_t>(m_blockTokens));
+        Write(header, sizeof(header));
+    }
+
+    // Append a token. Throws std::invalid_argument if its identifier is
+    // negative or too large.
+    void write(const record_type& token)
+    {
+        const uint64_t id = static_cast<uint64_t>(token.ID);
+        if (id >> 62)
+            throw std::invalid_argument("Token identifier out of range");
+
+        if (m_blockCount == 0)
+        {
+            // A checkpoint: the block starts from its first token
+            m_blockOffset = token.Offset;
+            m_blockLine = token.Line;
+            m_end = token.Offset;
+            m_line = token.Line;
+            m_used = 0;
+        }
+        if (m_block.size() - m_used < MaxTokenSize)
+            m_block.resize(m_block.size() * 2);
+
+        const int64_t gap = static_cast<int64_t>(token.Offset - m_end);
+        const int64_t lines = static_cast<int64_t>(token.Line) - static_cast<int64_t>(m_line);
+        uint8_t* out = m_block.data() + m_used;
+        out = TokenStreamFormat::PutVarint(out, (id << 2) | (gap ? 2 : 0) | (lines ? 1 : 0));
+        out = TokenStreamFormat::PutVarint(out, token.Length);
+        if (gap)
+            out = TokenStreamFormat::PutVarint(out, TokenStreamFormat::ZigZag(gap));
+        if (lines)
+            out = TokenStreamFormat::PutVarint(out, TokenStreamFormat::ZigZag(lines));
+        m_used = out - m_block.data();
+
+        m_end = token.Offset + token.Length;
+        m_line = token.Line;
+        if (++m_blockCount == m_blockTokens)
+            FlushBlock();
+    }
+
+    void write(Span<record_type> tokens)
+    {
+        for (auto& token : tokens)
+            write(token);
+    }
+
+    // So that the writer can be analyzeBatched()'s batch functor
+    void operator ()(Span<record_type> tokens)
+    {
+        write(tokens);
+    }
+
+    // Write the last block, the index and the footer. Returns false if the
+    // ostream failed at any point. Nothing may be written afterwards.
+    bool finish()
+    {
+        if (!m_finished)
+        {
+            m_finished = true;
+            FlushBlock();
+
+            const uint64_t indexPosition = m_written;
+            std::vector<uint8_t> index(m_index.size() * TokenStreamFormat::IndexEntrySize +
+                TokenStreamFormat::FooterSize);
+            uint8_t* out = index.data();
+            for (auto& entry : m_index)
+            {
+                TokenStreamFormat::Put64(out, entry.Position);
+                TokenStreamFormat::Put64(out + 8, entry.FirstToken);
+                TokenStreamFormat::Put64(out + 16, entry.FirstOffset);
+                out += TokenStreamFormat::IndexEntrySize;
+            }
+            TokenStreamFormat::Put64(out, indexPosition);
+            TokenStreamFormat::Put64(out + 8, m_index.size());
+            TokenStreamFormat::Put64(out + 16, m_tokens);
+            std::memcpy(out + 24, TokenStreamFormat::EndMagic, 4);
+            Write(index.data(), index.size());
+            m_out.flush();
+        }
+        return !m_out.fail();
+    }
+
+    // Tokens written so far
+    uint64_t tokens() const
+    {
+        return m_tokens + m_blockCount;
+    }
+
+    // Bytes written to the ostream so far
+    uint64_t bytes() const
+    {
+        return m_written;
+    }
+
+private:
+
+    TokenStreamWriter(const TokenStreamWriter&);
+    TokenStreamWriter& operator =(const TokenStreamWriter&);
+
+    // Three 10-byte varints and a 5-byte length
+    static constexpr size_t MaxTokenSize = 35;
+
+    struct IndexEntry
+    {
+        uint64_t Position;
+        uint64_t FirstToken;
+        uint64_t FirstOffset;
+    };
+
+    void Write(const uint8_t* data, size_t size)
+    {
+        m_out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        m_written += size;
+    }
+
+    void FlushBlock()
+    {
+        if (!m_blockCount)
+            return;
+
+        IndexEntry entry;
+        entry.Position = m_written;
+        entry.FirstToken = m_tokens;
+        entry.FirstOffset = m_blockOffset;
+        m_index.push_back(entry);
+
+        uint8_t header[30];
+        uint8_t* out = TokenStreamFormat::PutVarint(header, m_blockCount);
+        out = TokenStreamFormat::PutVarint(out, m_blockOffset);
+        out = TokenStreamFormat::PutVarint(out, m_blockLine);
+        Write(header, out - header);
+        Write(m_block.data(), m_used);
+
+        m_tokens += m_blockCount;
+        m_blockCount = 0;
+    }
+
+    std::ostream& m_out;
+    size_t m_blockTokens;
+    uint64_t m_written;
+    uint64_t m_tokens;
+    std::vector<uint8_t> m_block;
+    size_t m_used;
+    size_t m_blockCount;
+    size_t m_blockOffset;
+    uint32_t m_blockLine;
+    size_t m_end;
+    uint32_t m_line;
+    std::vector<IndexEntry> m_index;
+    bool m_finished;
+};
+
+template<typename _TokenID>
+class TokenStreamReader
+{
+public:
+
+    typedef TokenRecord<_TokenID> record_type;
+
+    static_assert(std::is_integral<_TokenID>::value || std::is_enum<_TokenID>::value,
+        "A token stream stores token identifiers as integers");
+
+    TokenStreamReader()
+    {
+        close();
+    }
+
+    // Read the stream in [data, data + size), which must stay valid while
+    // it is read. Returns false if it isn't a complete token stream.
+    bool open(const void* data, size_t size)
+    {
+        close();
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        if (size < TokenStreamFormat::HeaderSize + TokenStreamFormat::FooterSize ||
+            std::memcmp(bytes, TokenStreamFormat::Magic, 4) != 0 ||
+            TokenStreamFormat::Get32(bytes + 4) != TokenStreamFormat::Version)
+        {
+            return false;
+        }
+
+        const uint8_t* footer = bytes + size - TokenStreamFormat::FooterSize;
+        const uint64_t indexPosition = TokenStreamFormat::Get64(footer);
+        const uint64_t blocks = TokenStreamFormat::Get64(footer + 8);
+        if (std::memcmp(footer + 24, TokenStreamFormat::EndMagic, 4) != 0 ||
+            indexPosition < TokenStreamFormat::HeaderSize ||
+            indexPosition > size ||
+            blocks > (size - indexPosition) / TokenStreamFormat::IndexEntrySize ||
+            indexPosition + blocks * TokenStreamFormat::IndexEntrySize +
+                TokenStreamFormat::FooterSize != size)
+        {
+            return false;
+        }
+
+        // Each block must lie between the one before it and the index
+        const uint8_t* index = bytes + indexPosition;
+        uint64_t position = TokenStreamFormat::HeaderSize;
+        uint64_t firstToken = 0;
+        for (uint64_t b = 0; b < blocks; ++b)
+        {
+            const uint8_t* entry = index + b * TokenStreamFormat::IndexEntrySize;
+            if (TokenStreamFormat::Get64(entry) < position ||
+                TokenStreamFormat::Get64(entry) >= indexPosition ||
+                TokenStreamFormat::Get64(entry + 8) != firstToken)
+            {
+                return false;
+            }
+            position = TokenStreamFormat::Get64(entry) + 1;
+            firstToken = b + 1 < blocks ?
+                TokenStreamFormat::Get64(entry + TokenStreamFormat::IndexEntrySize + 8) :
+                TokenStreamFormat::Get64(footer + 16);
+            if (firstToken <= TokenStreamFormat::Get64(entry + 8))
+                return false;
+        }
+        if (!blocks && TokenStreamFormat::Get64(footer + 16))
+            return false;
+
+        m_data = bytes;
+        m_indexPosition = static_cast<size_t>(indexPosition);
+        m_index = index;
+        m_blocks = static_cast<size_t>(blocks);
+        m_size = static_cast<size_t>(TokenStreamFormat::Get64(footer + 16));
+        seek(0);
+        return true;
+    }
+
+    void close()
+    {
+        m_data = nullptr;
+        m_indexPosition = 0;
+        m_index = nullptr;
+        m_blocks = 0;
+        m_size = 0;
+        m_corrupt = false;
+        m_block = 0;
+        m_position = 0;
+        m_blockLeft = 0;
+        m_cursor = nullptr;
+        m_end = 0;
+        m_line = 0;
+    }
+
+    // The number of tokens in the stream
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // The index of the token that next() returns next
+    size_t position() const
+    {
+        return m_position;
+    }
+
+    // True if a block turned out to be malformed, which ends the stream
+    bool corrupt() const
+    {
+        return m_corrupt;
+    }
+
+    // Read the next token. Returns false at the end of the stream.
+    bool next(record_type& token)
+    {
+        if (!m_blockLeft)
+        {
+            if (m_position >= m_size || !OpenBlock(m_block + (m_position ? 1 : 0)))
+                return false;
+        }
+
+        const uint8_t* end = m_data + m_indexPosition;
+        uint64_t tag, length, gap = 0, lines = 0;
+        const uint8_t* in = TokenStreamFormat::GetVarint(m_cursor, end, tag);
+        if (in)
+            in = TokenStreamFormat::GetVarint(in, end, length);
+        if (in && (tag & 2))
+            in = TokenStreamFormat::GetVarint(in, end, gap);
+        if (in && (tag & 1))
+            in = TokenStreamFormat::GetVarint(in, end, lines);
+        if (!in)
+            return Corrupt();
+        m_cursor = in;
+
+        token.ID = static_cast<_TokenID>(tag >> 2);
+        token.Offset = static_cast<size_t>(m_end + TokenStreamFormat::UnZigZag(gap));
+        token.Length = static_cast<uint32_t>(length);
+        token.Line = static_cast<uint32_t>(m_line + TokenStreamFormat::UnZigZag(lines));
+        m_end = token.Offset + token.Length;
+        m_line = token.Line;
+        --m_blockLeft;
+        ++m_position;
+        return true;
+    }
+
+    // Read up to count tokens into tokens. Returns how many were read.
+    size_t next(record_type* tokens, size_t count)
+    {
+        size_t read = 0;
+        while (read < count && next(tokens[read]))
+            ++read;
+        return read;
+    }
+
+    // Carry on from the token at index (or the end, if there are fewer)
+    void seek(size_t index)
+    {
+        m_blockLeft = 0;
+        m_corrupt = false;
+        if (index >= m_size)
+        {
+            m_position = m_size;
+            return;
+        }
+
+        size_t block = LastBlock([&](size_t b) { return FirstToken(b) <= index; });
+        if (OpenBlock(block))
+            Skip([&](const record_type&, size_t at) { return at < index; });
+    }
+
+    // Carry on from the first token that ends after offset in the text
+    void seekOffset(size_t offset)
+    {
+        m_blockLeft = 0;
+        m_corrupt = false;
+        if (!m_size)
+            return;
+
+        size_t block = LastBlock([&](size_t b) { return FirstOffset(b) <= offset; });
+        if (OpenBlock(block))
+            Skip([&](const record_type& token, size_t) { return token.Offset + token.Length <= offset; });
+    }
+
+private:
+
+    TokenStreamReader(const TokenStreamReader&);
+    TokenStreamReader& operator =(const TokenStreamReader&);
+
+    uint64_t BlockPosition(size_t block) const
+    {
+        return TokenStreamFormat::Get64(m_index + block * TokenStreamFormat::IndexEntrySize);
+    }
+
+    uint64_t FirstToken(size_t block) const
+    {
+        return TokenStreamFormat::Get64(m_index + block * TokenStreamFormat::IndexEntrySize + 8);
+    }
+
+    uint64_t FirstOffset(size_t block) const
+    {
+        return TokenStreamFormat::Get64(m_index + block * TokenStreamFormat::IndexEntrySize + 16);
+    }
+
+    // The last block for which before(block) holds, or the first block
+    template<typename _Before>
+    size_t LastBlock(_Before before) const
+    {
+        size_t low = 0, high = m_blocks;
+        while (high - low > 1)
+        {
+            const size_t middle = low + (high - low) / 2;
+            if (before(middle))
+                low = middle;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    // Position the reader at the start of block. Returns false at the end
+    // of the stream or if the block is malformed.
+    bool OpenBlock(size_t block)
+    {
+        m_blockLeft = 0;
+        if (block >= m_blocks)
+        {
+            m_position = m_size;
+            return false;
+        }
+
+        const uint8_t* end = m_data + m_indexPosition;
+        uint64_t count = 0, offset = 0, line = 0;
+        const uint8_t* in = TokenStreamFormat::GetVarint(m_data + BlockPosition(block), end, count);
+        if (in)
+            in = TokenStreamFormat::GetVarint(in, end, offset);
+        if (in)
+            in = TokenStreamFormat::GetVarint(in, end, line);
+        const uint64_t expected = (block + 1 < m_blocks ? FirstToken(block + 1) : m_size) -
+            FirstToken(block);
+        if (!in || count != expected)
+            return Corrupt();
+
+        m_block = block;
+        m_position = static_cast<size_t>(FirstToken(block));
+        m_blockLeft = static_cast<size_t>(count);
+        m_cursor = in;
+        m_end = static_cast<size_t>(offset);
+        m_line = line;
+        return true;
+    }
+
+    // Read tokens while skip(token, index) holds for the next one, leaving
+    // the reader before the first for which it doesn't
+    template<typename _Skip>
+    void Skip(_Skip skip)
+    {
+        record_type token;
+        for (;;)
+        {
+            const size_t block = m_block;
+            const size_t blockLeft = m_blockLeft;
+            const uint8_t* cursor = m_cursor;
+            const size_t end = m_end;
+            const uint64_t line = m_line;
+            const size_t position = m_position;
+            if (!next(token))
+                return;
+            if (!skip(token, position))
+            {
+                m_block = block;
+                m_blockLeft = blockLeft;
+                m_cursor = cursor;
+                m_end = end;
+                m_line = line;
+                m_position = position;
+                return;
+            }
+        }
+    }
+
+    bool Corrupt()
+    {
+        m_corrupt = true;
+        m_blockLeft = 0;
+        m_position = m_size;
+        return false;
+    }
+
+    const uint8_t* m_data;
+    size_t m_indexPosition;
+    const uint8_t* m_index;
+    size_t m_blocks;
+    size_t m_size;
+    bool m_corrupt;
+    size_t m_block;
+    size_t m_position;
+    size_t m_blockLeft;
+    const uint8_t* m_cursor;
+    size_t m_end;
+    uint64_t m_line;
+};
+
+}
+
+#endif
@@ -0,0 +1,269 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+#ifndef _LEX_TRACE_H_
+#define _LEX_TRACE_H_
+
+#include "Lex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Recording what a Lexer does, for timeline analysis. A Lexer given the
+// RingTrace policy records each of its tracing hooks (see Lex::NoTrace) as
+// an event in a ring owned by the thread that called it:
+//
+//      typedef Lex::Lexer<TokenID, std::string, Lex::Regex, Lex::RingTrace<> >
+//          TracedLexer;
+//      ...
+//      std::vector<Lex::TraceEvent> events;
+//      Lex::RingTrace<>::dump(events);
+//
+// Recording takes no locks: each thread writes only to its own ring, and
+// when the ring is full the oldest events are overwritten. Any thread may
+// dump the events at any time; an event that is overwritten while it is
+// being copied is left out. The rings of threads that have exited are kept
+// until the process exits, so that their events can still be dumped.
+//-----------------------------------------------------------------------------
+namespace Lex
+{
+
+//-----------------------------------------------------------------------------
+// The hook an event records
+//-----------------------------------------------------------------------------
+enum TraceKind
+{
+    TraceChunk,
+    TraceAttempt,
+    TraceMatch,
+    TraceError
+};
+
+//-----------------------------------------------------------------------------
+// One event recorded by a RingTrace.
+//     Time:       Nanoseconds since the epoch of std::chrono::steady_clock.
+//     Offset:     The offset in the input (the start of a chunk).
+//     Length:     The length of a match, or of a chunk.
+//     Definition: The index of the definition that matched.
+//     Thread:     The number of the thread that recorded it, from 0 in the
+//                 order threads first recorded an event.
+//     Kind:       The TraceKind.
+//-----------------------------------------------------------------------------
+struct TraceEvent
+{
+    uint64_t Time;
+    uint64_t Offset;
+    uint64_t Length;
+    uint32_t Definition;
+    uint16_t Thread;
+    uint16_t Kind;
+};
+
+template<size_t _Events = 65536>
+class RingTrace
+{
+public:
+
+    static_assert(_Events && !(_Events & (_Events - 1)),
+        "A RingTrace's ring holds a power of two events");
+
+    static void onChunk(size_t from, size_t to)
+    {
+        Record(TraceChunk, from, to - from, 0);
+    }
+
+    static void onAttempt(size_t offset)
+    {
+        Record(TraceAttempt, offset, 0, 0);
+    }
+
+    static void onMatch(size_t offset, size_t length, uint32_t definition)
+    {
+        Record(TraceMatch, offset, length, definition);
+    }
+
+    static void onError(size_t offset)
+    {
+        Record(TraceError, offset, 0, 0);
+    }
+
+    // Append the events recorded since the last clear() to events, in the
+    // order they happened
+    static void dump(std::vector<TraceEvent>& events)
+    {
+        const size_t first = events.size();
+        Registry& registry = TheRegistry();
+        std::lock_guard<std::mutex> lock(registry.Mutex);
+        for (auto& ring : registry.Rings)
+            ring->copy(events);
+
+        std::stable_sort(events.begin() + first, events.end(),
+            [](const TraceEvent& a, const TraceEvent& b)
+            {
+                return a.Time < b.Time;
+            });
+    }
+
+    // Write the events as dump() finds them to out, one per line, as
+    // comma-separated time, thread, kind, offset, length and definition
+    static void dump(std::ostream& out)
+    {
+        static const char* const kinds[] = { "chunk", "attempt", "match", "error" };
+        std::vector<TraceEvent> events;
+        dump(events);
+        out << "time,thread,kind,offset,length,definition\n";
+        for (auto& event : events)
+        {
+            out << event.Time << ',' << event.Thread << ',' << kinds[event.Kind] << ','
+                << event.Offset << ',' << event.Length << ',' << event.Definition << '\n';
+        }
+    }
+
+    // Forget the events recorded so far, on every thread
+    static void clear()
+    {
+        Registry& registry = TheRegistry();
+        std::lock_guard<std::mutex> lock(registry.Mutex);
+        for (auto& ring : registry.Rings)
+            ring->Start.store(ring->Head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+
+private:
+
+    // An event's fields packed into words that are written and read
+    // atomically, so that a dump may read a slot as it is overwritten
+    struct Slot
+    {
+        std::atomic<uint64_t> Words[4];
+    };
+
+    struct Ring
+    {
+        explicit Ring(uint16_t thread)
+            : Slots(new Slot[_Events])
+            , Head(0)
+            , Start(0)
+            , Thread(thread)
+        {
+        }
+
+        // Append the events in the ring to events, leaving out any that are
+        // overwritten while they are copied. The event after the last one
+        // published may be being written over the oldest, so at most
+        // _Events - 1 events are copied.
+        void copy(std::vector<TraceEvent>& events) const
+        {
+            const uint64_t head = Head.load(std::memory_order_acquire);
+            const uint64_t first = std::max(Start.load(std::memory_order_relaxed),
+                head >= _Events ? head - _Events + 1 : 0);
+            const size_t base = events.size();
+            for (uint64_t i = first; i < head; ++i)
+            {
+                const Slot& slot = Slots[i & (_Events - 1)];
+                TraceEvent event;
+                event.Time = slot.Words[0].load(std::memory_order_relaxed);
+                event.Offset = slot.Words[1].load(std::memory_order_relaxed);
+                event.Length = slot.Words[2].load(std::memory_order_relaxed);
+                const uint64_t packed = slot.Words[3].load(std::memory_order_relaxed);
+                event.Definition = static_cast<uint32_t>(packed);
+                event.Thread = Thread;
+                event.Kind = static_cast<uint16_t>(packed >> 32);
+                events.push_back(event);
+            }
+
+            // Drop the slots the writer may have reached since head was read
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t now = Head.load(std::memory_order_relaxed);
+            if (now + 1 > first + _Events)
+            {
+                const uint64_t lost = std::min(now + 1 - _Events - first, head - first);
+                events.erase(events.begin() + base, events.begin() + base + lost);
+            }
+        }
+
+        std::unique_ptr<Slot[]> Slots;
+        std::atomic<uint64_t> Head;
+        std::atomic<uint64_t> Start;
+        uint16_t Thread;
+    };
+
+    struct Registry
+    {
+        std::mutex Mutex;
+        std::vector<std::shared_ptr<Ring> > Rings;
+    };
+
+    static Registry& TheRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    // The calling thread's ring, registered the first time it is needed
+    static Ring& ThisRing()
+    {
+        thread_local std::shared_ptr<Ring> ring;
+        if (!ring)
+        {
+            Registry& registry = TheRegistry();
+            std::lock_guard<std::mutex> lock(registry.Mutex);
+            ring = std::make_shared<Ring>(static_cast<uint16_t>(registry.Rings.size()));
+            registry.Rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    static void Record(TraceKind kind, size_t offset, size_t length, uint32_t definition)
+    {
+        Ring& ring = ThisRing();
+        const uint64_t head = ring.Head.load(std::memory_order_relaxed);
+        Slot& slot = ring.Slots[head & (_Events - 1)];
+
+        // A dump that sees any of the stores below also sees head, and so
+        // knows that the slot's old event may be gone
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        slot.Words[0].store(time, std::memory_order_relaxed);
+        slot.Words[1].store(offset, std::memory_order_relaxed);
+        slot.Words[2].store(length, std::memory_order_relaxed);
+        slot.Words[3].store(definition | (static_cast<uint64_t>(kind) << 32),
+            std::memory_order_relaxed);
+        ring.Head.store(head + 1, std::memory_order_release);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,673 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a
+    copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// luthor-lex: lex files with a grammar read from a definition file, and
+// report how fast it went and what was found. For trying grammars against
+// real data without writing any C++:
+//
+//      luthor-lex [options] <definitions> <file or directory>...
+//
+// Directories are searched recursively. The definition file has one
+// definition per line, in the order the Lexer should try them:
+//
+//      # A comment
+//      NAME  pattern                           A regex: the rest of the line
+//      NAME  %delimited OPEN CLOSE [ESCAPE] [multiline]
+//      NAME  %number [decimal] [hex] [float]   All three if none are given
+//      NAME  %keywords WORD...                 Keywords of the last regex
+//
+// The words of a % line are separated by spaces and may be quoted, and take
+// the escapes \n, \r, \t, \s (a space), \" and \\. Several lines may share
+// a NAME, and are then counted together.
+//-----------------------------------------------------------------------------
+#include "Lex.h"
+#include "LexBulk.h"
+#include "LexPerf.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+
+#ifdef _WIN32
+#   include <psapi.h>
+#   pragma comment(lib, "psapi.lib")
+#else
+#   include <sys/resource.h>
+#endif
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// The command line
+//-----------------------------------------------------------------------------
+struct Options
+{
+    Options()
+        : Threads(0)
+        , Utf8(false)
+        , Linear(false)
+        , Dump(false)
+        , IoUring(true)
+    {
+    }
+
+    string Definitions;
+    vector<string> Inputs;
+    vector<string> Extensions;
+    size_t Threads;
+    bool Utf8;
+    bool Linear;
+    bool Dump;
+    bool IoUring;
+};
+
+//-----------------------------------------------------------------------------
+// Thrown for a mistake in the definition file
+//-----------------------------------------------------------------------------
+struct DefinitionError
+{
+    DefinitionError(size_t line, const string& message)
+        : Line(line)
+        , Message(message)
+    {
+    }
+
+    size_t Line;
+    string Message;
+};
+
+//-----------------------------------------------------------------------------
+// Split the words of a % line, undoing quotes and escapes
+//-----------------------------------------------------------------------------
+vector<string> SplitWords(const string& text, size_t line)
+{
+    vector<string> words;
+    size_t i = 0;
+    while (i < text.size())
+    {
+        if (isspace(static_cast<unsigned char>(text[i])))
+        {
+            ++i;
+            continue;
+        }
+
+        string word;
+        bool quoted = text[i] == '"';
+        if (quoted)
+            ++i;
+        while (i < text.size() &&
+               (quoted ? text[i] != '"' : !isspace(static_cast<unsigned char>(text[i]))))
+        {
+            char c = text[i++];
+            if (c == '\\' && i < text.size())
+            {
+                switch (c = text[i++])
+                {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 's': c = ' '; break;
+                }
+            }
+            word += c;
+        }
+        if (quoted)
+        {
+            if (i == text.size())
+                throw DefinitionError(line, "unterminated quote");
+            ++i;
+        }
+        words.push_back(word);
+    }
+    return words;
+}
+
+//-----------------------------------------------------------------------------
+// Read the definition file at path into lexer. Token identifiers are indexes
+// into names, in the order the names first appear.
+//-----------------------------------------------------------------------------
+template<typename _Lexer>
+void LoadDefinitions(const string& path, _Lexer& lexer, vector<string>& names)
+{
+    ifstream file(path);
+    if (!file)
+        throw DefinitionError(0, "can't be read");
+
+    struct Pending
+    {
+        uint32_t ID;
+        string Pattern;
+        vector<pair<string, uint32_t> > Keywords;
+        size_t Line;
+    };
+
+    // Regexes are defined once their keywords are known
+    vector<Pending> pending;
+    auto flush = [&]()
+    {
+        for (auto& definition : pending)
+        {
+            try
+            {
+                if (definition.Keywords.empty())
+                    lexer.define(definition.ID, definition.Pattern);
+                else
+                    lexer.define(definition.ID, definition.Pattern, definition.Keywords);
+            }
+            catch (const regex_error& error)
+            {
+                throw DefinitionError(definition.Line, error.what());
+            }
+        }
+        pending.clear();
+    };
+    auto idOf = [&](const string& name)
+    {
+        auto found = find(names.begin(), names.end(), name);
+        if (found == names.end())
+        {
+            names.push_back(name);
+            found = names.end() - 1;
+        }
+        return static_cast<uint32_t>(found - names.begin());
+    };
+
+    string text;
+    for (size_t line = 1; getline(file, text); ++line)
+    {
+        while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+            text.pop_back();
+        size_t nameStart = text.find_first_not_of(" \t");
+        if (nameStart == string::npos || text[nameStart] == '#')
+            continue;
+
+        size_t nameEnd = text.find_first_of(" \t", nameStart);
+        size_t body = nameEnd == string::npos ?
+            string::npos :
+            text.find_first_not_of(" \t", nameEnd);
+        if (body == string::npos)
+            throw DefinitionError(line, "expected a name and a definition");
+
+        const uint32_t id = idOf(text.substr(nameStart, nameEnd - nameStart));
+        const string rest = text.substr(body);
+        if (rest[0] != '%')
+        {
+            Pending definition;
+            definition.ID = id;
+            definition.Pattern = rest;
+            definition.Line = line;
+            pending.push_back(definition);
+            continue;
+        }
+
+        vector<string> words = SplitWords(rest, line);
+        if (words[0] == "%keywords")
+        {
+            if (pending.empty())
+                throw DefinitionError(line, "%keywords must follow a regex");
+            for (size_t w = 1; w < words.size(); ++w)
+                pending.back().Keywords.push_back(make_pair(words[w], id));
+            continue;
+        }
+
+        flush();
+        if (words[0] == "%delimited")
+        {
+            bool multiline = words.back() == "multiline";
+            if (multiline)
+                words.pop_back();
+            if (words.size() < 3 || words.size() > 4 ||
+                (words.size() == 4 && words[3].size() != 1))
+            {
+                throw DefinitionError(line,
+                    "expected %delimited OPEN CLOSE [ESCAPE] [multiline]");
+            }
+            try
+            {
+                lexer.defineDelimited(id, words[1], words[2],
+                    words.size() == 4 ? words[3][0] : 0, multiline);
+            }
+            catch (const invalid_argument& error)
+            {
+                throw DefinitionError(line, error.what());
+            }
+        } else if (words[0] == "%number") {
+            uint32_t formats = 0;
+            for (size_t w = 1; w < words.size(); ++w)
+            {
+                if (words[w] == "decimal")
+                    formats |= Lex::NumberDecimal;
+                else if (words[w] == "hex")
+                    formats |= Lex::NumberHex;
+                else if (words[w] == "float")
+                    formats |= Lex::NumberFloat;
+                else
+                    throw DefinitionError(line, "unknown number format " + words[w]);
+            }
+            lexer.defineNumber(id, formats ? formats : uint32_t(Lex::NumberAny));
+        } else {
+            throw DefinitionError(line, "unknown directive " + words[0]);
+        }
+    }
+    flush();
+
+    if (names.empty())
+        throw DefinitionError(0, "defines no tokens");
+}
+
+//-----------------------------------------------------------------------------
+// The files to lex: the inputs, with directories replaced by the files in
+// them that have one of the extensions (or any, if there are none)
+//-----------------------------------------------------------------------------
+vector<string> CollectFiles(const Options& options)
+{
+    namespace fs = std::filesystem;
+    vector<string> files;
+    for (auto& input : options.Inputs)
+    {
+        error_code error;
+        if (!fs::is_directory(input, error))
+        {
+            files.push_back(input);
+            continue;
+        }
+
+        vector<string> found;
+        fs::recursive_directory_iterator entry(input,
+            fs::directory_options::skip_permission_denied, error);
+        for ( ; !error && entry != fs::recursive_directory_iterator(); entry.increment(error))
+        {
+            if (!entry->is_regular_file(error))
+                continue;
+
+            const string extension = entry->path().extension().string();
+            if (options.Extensions.empty() ||
+                find(options.Extensions.begin(), options.Extensions.end(), extension) !=
+                    options.Extensions.end())
+            {
+                found.push_back(entry->path().string());
+            }
+        }
+        sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    return files;
+}
+
+//-----------------------------------------------------------------------------
+// The most memory the process has held, in bytes
+//-----------------------------------------------------------------------------
+size_t PeakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#   ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#   else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#   endif
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Print a lexeme with its control characters escaped
+//-----------------------------------------------------------------------------
+void Escape(ostream& out, const char* begin, const char* end)
+{
+    for ( ; begin != end; ++begin)
+    {
+        switch (*begin)
+        {
+        case '\n': out << "\\n"; break;
+        case '\r': out << "\\r"; break;
+        case '\t': out << "\\t"; break;
+        case '\\': out << "\\\\"; break;
+        case '\'': out << "\\'"; break;
+        default:
+            if (static_cast<unsigned char>(*begin) < 0x20)
+            {
+                out << "\\x" << hex << setw(2) << setfill('0')
+                    << int(*begin) << dec << setfill(' ');
+            } else {
+                out << *begin;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Counts the columns of a file's tokens in the order they are found, so that
+// a file on one long line doesn't take quadratic time. Counts code points if
+// utf8.
+//-----------------------------------------------------------------------------
+struct ColumnCounter
+{
+    ColumnCounter()
+        : Offset(0)
+        , Column(1)
+    {
+    }
+
+    size_t columnOf(const string& text, size_t offset, bool utf8)
+    {
+        for ( ; Offset < offset; ++Offset)
+        {
+            const unsigned char c = text[Offset];
+            if (c == '\n')
+                Column = 1;
+            else if (!utf8 || (c & 0xC0) != 0x80)
+                ++Column;
+        }
+        return Column;
+    }
+
+    size_t Offset;
+    size_t Column;
+};
+
+//-----------------------------------------------------------------------------
+// Lex the files with a Lexer of type _Lexer and print the statistics.
+// Returns the exit code.
+//-----------------------------------------------------------------------------
+template<typename _Lexer>
+int Run(const Options& options)
+{
+    typedef typename _Lexer::record_type Record;
+    typedef Lex::BulkFile<string> File;
+
+    _Lexer lexer;
+    vector<string> names;
+    auto buildStart = chrono::steady_clock::now();
+    try
+    {
+        LoadDefinitions(options.Definitions, lexer, names);
+    }
+    catch (const DefinitionError& error)
+    {
+        cerr << options.Definitions;
+        if (error.Line)
+            cerr << ":" << error.Line;
+        cerr << ": " << error.Message << endl;
+        return 2;
+    }
+    const bool compiled = lexer.compile();
+    lexer.setLinearTime(options.Linear);
+    const double buildSeconds = chrono::duration<double>(
+        chrono::steady_clock::now() - buildStart).count();
+
+    vector<string> files = CollectFiles(options);
+    if (files.empty())
+    {
+        cerr << "No files to lex" << endl;
+        return 2;
+    }
+
+    Lex::BulkOptions bulkOptions;
+    bulkOptions.Threads = options.Threads ?
+        options.Threads :
+        max(1u, thread::hardware_concurrency());
+    bulkOptions.IoUring = options.IoUring;
+
+    // Counted per worker so that the workers don't share anything
+    vector<vector<uint64_t> > counts(bulkOptions.Threads, vector<uint64_t>(names.size()));
+    // The dump of the file a worker is lexing, printed once the file is
+    // done. The tokens ahead of an error are delivered before it is, so
+    // everything is written in the order it arrives.
+    struct Dump
+    {
+        string Text;
+        ColumnCounter Columns;
+
+        void clear()
+        {
+            *this = Dump();
+        }
+    };
+    vector<Dump> dumps(options.Dump ? bulkOptions.Threads : 0);
+    mutex printing;
+
+    auto onBatch = [&](const File& file, Lex::Span<Record> tokens)
+    {
+        vector<uint64_t>& count = counts[file.Worker];
+        for (auto& token : tokens)
+            ++count[token.ID];
+
+        if (!options.Dump)
+            return;
+        Dump& dump = dumps[file.Worker];
+        ostringstream out;
+        for (auto& token : tokens)
+        {
+            const char* text = file.Text->data() + token.Offset;
+            out << *file.Path << ":" << token.Line << ":"
+                << dump.Columns.columnOf(*file.Text, token.Offset, options.Utf8) << ": "
+                << names[token.ID] << " '";
+            Escape(out, text, text + token.Length);
+            out << "'\n";
+            dump.Text += out.str();
+            out.str(string());
+        }
+    };
+    auto onError = [&](const File& file, const Lex::Location& location)
+    {
+        if (!options.Dump)
+            return;
+        ostringstream out;
+        out << *file.Path << ":" << location.line_number << ":"
+            << location.within_line << ": error: no definition matches\n";
+        dumps[file.Worker].Text += out.str();
+    };
+    auto onFile = [&](const File& file, const Lex::BulkResult&)
+    {
+        if (!options.Dump)
+            return;
+        Dump& dump = dumps[file.Worker];
+        {
+            lock_guard<mutex> lock(printing);
+            cout << dump.Text;
+        }
+        dump.clear();
+    };
+
+    // Opened before the workers start, so that they are counted too
+    Lex::PerfCounters counters;
+    Lex::BulkLexer<_Lexer> bulk(lexer, bulkOptions);
+    auto lexStart = chrono::steady_clock::now();
+    counters.start();
+    vector<Lex::BulkResult> results = bulk.run(files, onBatch, onError, onFile);
+    counters.stop();
+    const double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - lexStart).count();
+
+    uint64_t bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t errors = 0;
+    size_t unreadable = 0;
+    for (size_t f = 0; f < files.size(); ++f)
+    {
+        if (!results[f].Read)
+        {
+            cerr << files[f] << ": can't be read" << endl;
+            ++unreadable;
+        }
+        bytes += results[f].Bytes;
+        tokens += results[f].Tokens;
+        errors += results[f].Errors;
+    }
+
+    vector<uint64_t> total(names.size());
+    for (auto& count : counts)
+    {
+        for (size_t id = 0; id < names.size(); ++id)
+            total[id] += count[id];
+    }
+
+    const double megabytes = bytes / (1024.0 * 1024.0);
+    const double rate = seconds > 0 ? 1 / seconds : 0;
+    ostream& out = options.Dump ? cerr : cout;
+    out << fixed << setprecision(2)
+        << "files       " << files.size() - unreadable;
+    if (unreadable)
+        out << " (" << unreadable << " unreadable)";
+    out << "\n"
+        << "bytes       " << bytes << " (" << megabytes << " MB)\n"
+        << "tokens      " << tokens << "\n"
+        << "errors      " << errors << "\n"
+        << "grammar     " << names.size() << " kinds, "
+        << (compiled ? "compiled" : "lazy DFA") << ", built in "
+        << buildSeconds * 1000 << " ms\n"
+        << "time        " << seconds * 1000 << " ms on "
+        << bulkOptions.Threads << (bulkOptions.Threads == 1 ? " thread, " : " threads, ")
+        << (bulk.usedIoUring() ? "io_uring" : "blocking reads") << ", "
+        << Lex::simdLevelName(Lex::simdLevel()) << "\n"
+        << "throughput  " << megabytes * rate << " MB/s, "
+        << tokens * rate / 1e6 << " M tokens/s\n"
+        << "peak memory " << PeakMemory() / (1024.0 * 1024.0) << " MB\n";
+
+    // Hardware counters, where the system lets us read them
+    out << setprecision(3);
+    for (int c = 0; c < Lex::PerfCounterCount; ++c)
+    {
+        const Lex::PerfCounter counter = static_cast<Lex::PerfCounter>(c);
+        if (!counters.available(counter))
+            continue;
+        const double count = static_cast<double>(counters[counter]);
+        out << left << setw(14) << Lex::perfCounterName(counter) << right
+            << setw(16) << counters[counter] << setw(10)
+            << (bytes ? count / bytes : 0.0) << " /byte" << setw(10)
+            << (tokens ? count / tokens : 0.0) << " /token\n";
+    }
+    if (counters.available(Lex::PerfCycles) && counters.available(Lex::PerfInstructions) &&
+        counters[Lex::PerfCycles])
+    {
+        out << left << setw(14) << "IPC" << right << setw(16)
+            << static_cast<double>(counters[Lex::PerfInstructions]) / counters[Lex::PerfCycles]
+            << "\n";
+    }
+    out << setprecision(2) << "\n";
+
+    size_t width = 4;
+    for (auto& name : names)
+        width = max(width, name.size());
+    out << left << setw(width) << "kind" << right << setw(14) << "count"
+        << setw(9) << "%" << "\n";
+    for (size_t id = 0; id < names.size(); ++id)
+    {
+        out << left << setw(width) << names[id] << right << setw(14) << total[id]
+            << setw(8) << (tokens ? 100.0 * total[id] / tokens : 0.0) << "%\n";
+    }
+
+    return unreadable || errors ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+void Usage()
+{
+    cerr <<
+        "Usage: luthor-lex [options] <definitions> <file or directory>...\n"
+        "\n"
+        "Lexes the files with the token definitions and reports the\n"
+        "throughput, the hardware counters (where they can be read) and\n"
+        "the tokens found. Exits with 1 if a file couldn't be read or\n"
+        "lexed, and 2 for a bad command line or definition file.\n"
+        "\n"
+        "  -j, --threads N   Lex on N threads (default: one per core)\n"
+        "  -e, --ext .c,.h   Only lex these extensions in directories\n"
+        "  -d, --dump        Print every token, a file at a time as each\n"
+        "                    is finished\n"
+        "  --utf8            Match code points rather than bytes\n"
+        "  --linear          Guarantee linear time (setLinearTime())\n"
+        "  --no-io-uring     Read with blocking reads\n";
+}
+
+//-----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    Options options;
+    vector<string> positional;
+    for (int a = 1; a < argc; ++a)
+    {
+        const string arg = argv[a];
+        const bool hasValue = a + 1 < argc;
+        if ((arg == "-j" || arg == "--threads") && hasValue)
+        {
+            options.Threads = strtoul(argv[++a], nullptr, 10);
+        } else if ((arg == "-e" || arg == "--ext") && hasValue) {
+            stringstream list(argv[++a]);
+            string extension;
+            while (getline(list, extension, ','))
+            {
+                if (!extension.empty())
+                    options.Extensions.push_back(extension[0] == '.' ? extension : "." + extension);
+            }
+        } else if (arg == "-d" || arg == "--dump") {
+            options.Dump = true;
+        } else if (arg == "--utf8") {
+            options.Utf8 = true;
+        } else if (arg == "--linear") {
+            options.Linear = true;
+        } else if (arg == "--no-io-uring") {
+            options.IoUring = false;
+        } else if (arg == "-h" || arg == "--help" || (arg[0] == '-' && arg.size() > 1)) {
+            Usage();
+            return 2;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2)
+    {
+        Usage();
+        return 2;
+    }
+    options.Definitions = positional[0];
+    options.Inputs.assign(positional.begin() + 1, positional.end());
+
+    try
+    {
+        return options.Utf8 ?
+            Run<Lex::Lexer<uint32_t, string, Lex::Utf8Regex> >(options) :
+            Run<Lex::Lexer<uint32_t, string, Lex::Regex> >(options);
+    }
+    catch (const exception& ex)
+    {
+        cerr << "EXCEPTION: " << ex.what() << endl;
+        return 2;
+    }
+}
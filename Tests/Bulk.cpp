@@ -0,0 +1,207 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that a BulkLexer with several workers delivers, for every file, the
+// tokens and errors analyzeBatched() finds in it, with a compiled Lexer and
+// with one that builds its DFA as it goes, reading through io_uring where it
+// is available and with blocking reads. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../LexBulk.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+typedef Lexer::record_type Record;
+
+//-----------------------------------------------------------------------------
+// What was lexed from a file: its token records, then the offset of each 
+// error
+//-----------------------------------------------------------------------------
+struct Lexed
+{
+    vector<Record> Tokens;
+    vector<size_t> Errors;
+
+    bool operator ==(const Lexed& other) const
+    {
+        if (Tokens.size() != other.Tokens.size() || Errors != other.Errors)
+            return false;
+        for (size_t i = 0; i < Tokens.size(); ++i)
+        {
+            const Record& a = Tokens[i];
+            const Record& b = other.Tokens[i];
+            if (a.ID != b.ID || a.Offset != b.Offset || 
+                a.Length != b.Length || a.Line != b.Line)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+Lexed Analyze(const Lexer& lex, const string& text)
+{
+    Lexed lexed;
+    auto onBatch = [&](Lex::Span<Record> tokens)
+    {
+        lexed.Tokens.insert(lexed.Tokens.end(), tokens.begin(), tokens.end());
+    };
+    auto onError = [&](const Lex::Location& location)
+    {
+        lexed.Errors.push_back(location.global);
+    };
+    lex.analyzeBatched(text, onBatch, onError);
+    return lexed;
+}
+
+//-----------------------------------------------------------------------------
+// A text of size bytes of words, numbers and operators, with the odd 
+// character nothing matches
+//-----------------------------------------------------------------------------
+string MakeText(size_t size, unsigned seed)
+{
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "while", "x", "123", "4.5", "==", "+", "\n", "  ", "@"
+    };
+    string text;
+    while (text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+        text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+void Define(Lexer& lex)
+{
+    lex.define(1, "while");
+    lex.define(2, "[a-zA-Z_][a-zA-Z0-9_]*");
+    lex.define(3, "[0-9]+(\\.[0-9]+)?");
+    lex.define(4, "==|[=+]");
+    lex.define(5, "[ \\n]+");
+}
+
+//-----------------------------------------------------------------------------
+// Lex the files with a BulkLexer and compare each with analyzeBatched()
+//-----------------------------------------------------------------------------
+bool Check(const char* name, const Lexer& lex, const vector<string>& paths, 
+    const vector<string>& texts, bool ioUring)
+{
+    Lex::BulkOptions options;
+    options.Threads = 4;
+    options.QueueDepth = 4;
+    options.ReadSize = 16 * 1024;
+    options.IoUring = ioUring;
+    Lex::BulkLexer<Lexer> bulk(lex, options);
+
+    // Each file is lexed by one worker, so each has a Lexed of its own
+    vector<Lexed> lexed(paths.size());
+    auto onBatch = [&](const Lex::BulkFile<string>& file, Lex::Span<Record> tokens)
+    {
+        auto& out = lexed[file.Index].Tokens;
+        out.insert(out.end(), tokens.begin(), tokens.end());
+    };
+    auto onError = [&](const Lex::BulkFile<string>& file, const Lex::Location& location)
+    {
+        lexed[file.Index].Errors.push_back(location.global);
+    };
+    vector<Lex::BulkResult> results = bulk.run(paths, onBatch, onError);
+
+    bool passed = results.size() == paths.size();
+    for (size_t i = 0; passed && i < paths.size(); ++i)
+    {
+        const Lexed expected = Analyze(lex, texts[i]);
+        passed = results[i].Read && 
+            results[i].Bytes == texts[i].size() &&
+            results[i].Tokens == expected.Tokens.size() &&
+            results[i].Errors == expected.Errors.size() &&
+            lexed[i] == expected;
+    }
+    printf("%-28s %-10s %s\n", name, bulk.usedIoUring() ? "io_uring" : "blocking", 
+        passed ? "ok" : "different tokens");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    const auto directory = filesystem::temp_directory_path() / ("luthor-bulk-" + 
+        to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    bool passed = true;
+    try
+    {
+        filesystem::create_directories(directory);
+        vector<string> paths;
+        vector<string> texts;
+        for (unsigned i = 0; i < 24; ++i)
+        {
+            // Some empty, some of many reads
+            const size_t size = i % 8 == 0 ? 0 : (i * 37 % 11 + 1) * 9000;
+            paths.push_back((directory / ("file" + to_string(i) + ".txt")).string());
+            texts.push_back(MakeText(size, i));
+            ofstream(paths.back(), ios::binary) << texts.back();
+        }
+
+        Lexer lazy;
+        Define(lazy);
+        Lexer compiled;
+        Define(compiled);
+        if (!compiled.compile())
+        {
+            printf("compile() failed\n");
+            passed = false;
+        }
+
+        for (bool ioUring : { true, false })
+        {
+            passed &= Check("4 workers, lazy DFA", lazy, paths, texts, ioUring);
+            passed &= Check("4 workers, compiled", compiled, paths, texts, ioUring);
+        }
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        passed = false;
+    }
+
+    error_code ignored;
+    filesystem::remove_all(directory, ignored);
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks analysis from checkpoints on a text with errors in it. A full 
+// analyze() that records a CheckpointIndex must report what a plain one 
+// does, and analyzing a range from the checkpoints must report the tokens 
+// of the full analysis that overlap the range and the errors from its 
+// checkpoint up to the end of the range, at the same locations. Exits with 
+// 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+
+//-----------------------------------------------------------------------------
+// A token or error as reported by analyze(). Errors have an ID of -1.
+//-----------------------------------------------------------------------------
+struct Event
+{
+    int ID;
+    Lex::Location Where;
+    size_t Length;
+
+    bool operator ==(const Event& other) const
+    {
+        return ID == other.ID && Length == other.Length &&
+            Where.global == other.Where.global && 
+            Where.line_number == other.Where.line_number &&
+            Where.within_line == other.Where.within_line;
+    }
+};
+
+struct Recorder
+{
+    vector<Event> Events;
+
+    void operator()(const Lex::Location& location, const int& id, 
+        string::const_iterator begin, string::const_iterator end)
+    {
+        Event event = { id, location, size_t(end - begin) };
+        Events.push_back(event);
+    }
+
+    void operator()(const Lex::Location& location)
+    {
+        Event event = { -1, location, 1 };
+        Events.push_back(event);
+    }
+};
+
+//-----------------------------------------------------------------------------
+// Lines of words, numbers and comments, some spanning lines, with the odd 
+// character nothing matches
+//-----------------------------------------------------------------------------
+string MakeText(size_t size)
+{
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "while", "123", "4.5", "==", "+", "\n", "  ", "@", "@@",
+        "/* one */", "/* two\nlines */", "/* unclosed"
+    };
+    string text;
+    unsigned seed = 5;
+    while (text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+        text += ' ';
+    }
+    return text;
+}
+
+bool Check(const char* name, const Lexer& lex, const string& text)
+{
+    Recorder full;
+    lex.analyze(text, full, full);
+
+    Lex::CheckpointIndex checkpoints(256);
+    Recorder recording;
+    lex.analyze(text, recording, recording, checkpoints);
+    bool passed = recording.Events == full.Events && checkpoints.size() > 10;
+
+    size_t errors = 0;
+    for (auto& event : full.Events)
+        errors += event.ID < 0;
+    passed &= errors > 10;
+
+    unsigned seed = 9;
+    for (int range = 0; passed && range < 500; ++range)
+    {
+        seed = seed * 1103515245 + 12345;
+        const size_t from = (seed >> 8) % text.size();
+        seed = seed * 1103515245 + 12345;
+        const size_t to = from + (seed >> 16) % 2000;
+
+        const size_t resume = checkpoints.nearest(from).global;
+        vector<Event> expected;
+        for (auto& event : full.Events)
+        {
+            const size_t begin = event.Where.global;
+            if (event.ID < 0 ? 
+                    begin >= resume && begin < to : 
+                    begin + event.Length > from && begin < to)
+            {
+                expected.push_back(event);
+            }
+        }
+
+        Recorder ranged;
+        lex.analyze(text, checkpoints, from, to, ranged, ranged);
+        passed = ranged.Events == expected;
+        if (!passed)
+            printf("range [%zu, %zu) differs\n", from, to);
+    }
+    printf("%-20s %s, %zu checkpoints, %zu errors\n", name, 
+        passed ? "ok" : "different tokens", checkpoints.size(), errors);
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer lex;
+        lex.define(1, "while");
+        lex.define(2, "[a-zA-Z_][a-zA-Z0-9_]*");
+        lex.define(3, "[0-9]+(\\.[0-9]+)?");
+        lex.define(4, "==|[=+]");
+        lex.defineDelimited(5, "/*", "*/", 0, true);
+        lex.define(6, "[ \\n]+");
+        const string text = MakeText(64 * 1024);
+        passed &= Check("lazy DFA", lex, text);
+
+        Lexer compiled = lex;
+        if (!compiled.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+        passed &= Check("compiled", compiled, text);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
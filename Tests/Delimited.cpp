@@ -0,0 +1,159 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks the lines and columns reported after delimited tokens, including 
+// ones whose delimiters hold newlines themselves. Every Location that 
+// analyze() and tokenize() report must be the line and column found by 
+// counting the newlines before its offset. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+
+//-----------------------------------------------------------------------------
+// Whether location is where offset is in text, counting lines from scratch
+//-----------------------------------------------------------------------------
+bool Placed(const string& text, const Lex::Location& location)
+{
+    size_t line = 1;
+    size_t lineBegin = 0;
+    for (size_t i = 0; i < location.global; ++i)
+    {
+        if (text[i] == '\n')
+        {
+            ++line;
+            lineBegin = i + 1;
+        }
+    }
+    return location.line_number == line && 
+        location.within_line == location.global - lineBegin + 1;
+}
+
+//-----------------------------------------------------------------------------
+// Lex text, which holds tokens of each kind, checking every location
+//-----------------------------------------------------------------------------
+bool Check(const char* name, const Lexer& lex, const string& text)
+{
+    bool passed = true;
+    size_t delimited = 0;
+    auto onMatch = [&](const Lex::Location& location, const int& id, 
+        string::const_iterator, string::const_iterator)
+    {
+        passed &= Placed(text, location);
+        delimited += id == 1;
+    };
+    auto onError = [&](const Lex::Location& location)
+    {
+        passed &= Placed(text, location);
+    };
+    lex.analyze(text, onMatch, onError);
+
+    vector<Lexer::token_type> tokens;
+    lex.tokenize(text, tokens, onError);
+    for (auto& token : tokens)
+        passed &= Placed(text, token.Where);
+
+    passed &= delimited > 0;
+    printf("%-36s %s\n", name, passed ? "ok" : "wrong location");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+// A text of words and delimited tokens between open and close
+//-----------------------------------------------------------------------------
+string MakeText(const string& open, const string& close)
+{
+    static const char* const c_bodies[] = { "", "x", "two\nlines", "a b", "\n" };
+    string text;
+    unsigned seed = 99;
+    for (int i = 0; i < 400; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        switch ((seed >> 16) % 4)
+        {
+        case 0: 
+            text += open + c_bodies[(seed >> 8) % 5] + close; 
+            break;
+        case 1: 
+            text += "word"; 
+            break;
+        case 2: 
+            text += "\n"; 
+            break;
+        default: 
+            text += " @ "; 
+            break;
+        }
+        text += ' ';
+    }
+    return text;
+}
+
+bool CheckDelimiters(const char* name, const string& open, const string& close)
+{
+    Lexer lex;
+    lex.defineDelimited(1, open, close, 0, true);
+    lex.define(2, "[a-z]+");
+    lex.define(3, "[ \\n]+");
+
+    Lexer compiled = lex;
+    if (!compiled.compile())
+        throw runtime_error("compile() failed");
+
+    const string text = MakeText(open, close);
+    return Check(name, lex, text) && 
+        Check((string(name) + ", compiled").c_str(), compiled, text);
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        passed &= CheckDelimiters("/* */", "/*", "*/");
+        passed &= CheckDelimiters("newline in opener", "<\n", ">");
+        passed &= CheckDelimiters("newline in closer", "<", "\n>");
+        passed &= CheckDelimiters("newlines in both", "\n<<\n", "\n>>\n");
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
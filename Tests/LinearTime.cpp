@@ -0,0 +1,124 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that setLinearTime(true) keeps analysis linear in the length of the
+// input on inputs built to make maximal munch quadratic: runs of "a" with
+// the definitions "a*b" and "a", where every scan reads to the end of the
+// run, and a line of "/" with "//.*\n" and "/", where every scan reads to
+// the end of the input looking for a newline. Each is lexed at sizes 16
+// times apart; the time per byte must stay about the same, where without
+// the guarantee it grows 16 times. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+
+//-----------------------------------------------------------------------------
+// The best of a few timings of an analysis of text, in seconds per byte
+//-----------------------------------------------------------------------------
+double TimePerByte(const Lexer& lex, const string& text)
+{
+    auto onMatch = [](const Lex::Location&, const int&, string::const_iterator, string::const_iterator) {};
+    auto onError = [](const Lex::Location&) { throw runtime_error("Lexing error"); };
+
+    double best = 1e9;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto start = chrono::steady_clock::now();
+        lex.analyze(text, onMatch, onError);
+        best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    return best / text.size();
+}
+
+//-----------------------------------------------------------------------------
+// Lex runs of c that keep growing, and check that the time per byte of the
+// longest is within a small factor of the shortest's
+//-----------------------------------------------------------------------------
+bool Check(const char* name, const Lexer& lex, char c)
+{
+    const size_t c_shortest = 64 * 1024;
+    const size_t c_longest = 16 * c_shortest;
+    const double c_allowedGrowth = 4;
+
+    double shortest = 0;
+    double longest = 0;
+    for (size_t size = c_shortest; size <= c_longest; size *= 2)
+    {
+        const double perByte = TimePerByte(lex, string(size, c));
+        printf("%-28s %8zu bytes: %6.2f ns/byte\n", name, size, perByte * 1e9);
+        if (size == c_shortest)
+            shortest = perByte;
+        longest = perByte;
+    }
+    return longest <= c_allowedGrowth * shortest;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer runs;
+        runs.define(1, "a*b");
+        runs.define(2, "a");
+        runs.setLinearTime(true);
+
+        Lexer comments;
+        comments.define(1, "//.*\\n");
+        comments.define(2, "/");
+        comments.setLinearTime(true);
+
+        passed &= Check("a*b and a, lazy DFA", runs, 'a');
+        passed &= Check("//.*\\n and /, lazy DFA", comments, '/');
+
+        if (!runs.compile() || !comments.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+        passed &= Check("a*b and a, compiled", runs, 'a');
+        passed &= Check("//.*\\n and /, compiled", comments, '/');
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
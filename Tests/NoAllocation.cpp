@@ -0,0 +1,223 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that once a context_type has grown to fit, lexing a large corpus
+// with a native engine makes no heap allocations. Every operator new is
+// counted; the test fails if any is called while the corpus is lexed a
+// second time. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Counting allocations
+//-----------------------------------------------------------------------------
+static atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+    ++g_allocations;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    ++g_allocations;
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+// Kept out of line, or GCC inlines them and then takes their free() for
+// the wrong way to release memory from operator new
+#if defined(_MSC_VER)
+#   define NOINLINE __declspec(noinline)
+#else
+#   define NOINLINE __attribute__((noinline))
+#endif
+
+NOINLINE void operator delete(void* p) noexcept { free(p); }
+NOINLINE void operator delete[](void* p) noexcept { free(p); }
+NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+NOINLINE void operator delete[](void* p, size_t) noexcept { free(p); }
+NOINLINE void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+NOINLINE void operator delete[](void* p, const nothrow_t&) noexcept { free(p); }
+
+//-----------------------------------------------------------------------------
+// A grammar for C-like text using every kind of definition
+//-----------------------------------------------------------------------------
+enum TokenID
+{
+    TokenComment,
+    TokenString,
+    TokenNumber,
+    TokenIdentifier,
+    TokenIf,
+    TokenReturn,
+    TokenPunctuation,
+    TokenSpace
+};
+
+template<typename _Lexer>
+void Define(_Lexer& lex)
+{
+    lex.defineDelimited(TokenComment, "/*", "*/", 0, true);
+    lex.defineDelimited(TokenComment, "//", "\n");
+    lex.defineDelimited(TokenString, "\"", "\"", '\\');
+    lex.defineNumber(TokenNumber);
+    lex.define(TokenIdentifier, "[a-zA-Z_][a-zA-Z0-9_]*", {
+        { "if", TokenIf },
+        { "return", TokenReturn } });
+    lex.define(TokenPunctuation, "[-+*/%<>=!&|^~?:;,.(){}\\[\\]']");
+    lex.define(TokenSpace, "[ \\t\\r\\n]+");
+}
+
+string Corpus()
+{
+    static const char* const c_lines[] =
+    {
+        "/* A block comment\n   over two lines */\n",
+        "int count_tokens(const char* text, size_t length)\n",
+        "{\n",
+        "    if (length > 0x40 && text[0] == 'x') // a line comment\n",
+        "        return 3.25e2 * length - 17;\n",
+        "    printf(\"%d tokens \\\"quoted\\\"\\n\", length);\n",
+        "    return @length;\n",
+        "}\n"
+    };
+    string corpus;
+    for (size_t i = 0; corpus.size() < 4 * 1024 * 1024; ++i)
+        corpus += c_lines[i % (sizeof(c_lines) / sizeof(c_lines[0]))];
+    return corpus;
+}
+
+//-----------------------------------------------------------------------------
+// Lex the corpus twice with each entry point and return the allocations
+// made the second time
+//-----------------------------------------------------------------------------
+struct Counter
+{
+    Counter()
+        : Tokens(0)
+        , Errors(0)
+    {
+    }
+
+    template<typename _TokenID, typename _StringIt>
+    void operator ()(const Lex::Location&, const _TokenID&, _StringIt, _StringIt)
+    {
+        ++Tokens;
+    }
+
+    void operator ()(const Lex::Location&)
+    {
+        ++Errors;
+    }
+
+    size_t Tokens;
+    size_t Errors;
+};
+
+template<typename _Lexer>
+bool Check(const char* name, const _Lexer& lex, const string& corpus)
+{
+    typedef typename _Lexer::record_type Record;
+    typename _Lexer::context_type context;
+    Counter counter;
+    size_t batched = 0;
+    auto onBatch = [&](Lex::Span<Record> tokens) { batched += tokens.size(); };
+    auto onError = [&](const Lex::Location&) { ++counter.Errors; };
+
+    lex.analyze(corpus, counter, counter, context);
+    lex.analyzeBatched(corpus, onBatch, onError, context);
+
+    const size_t before = g_allocations;
+    lex.analyze(corpus, counter, counter, context);
+    const size_t analyzed = g_allocations - before;
+    lex.analyzeBatched(corpus, onBatch, onError, context);
+    const size_t allocations = g_allocations - before;
+
+    printf("%-24s %zu tokens: %zu allocations in analyze(), %zu in analyzeBatched()\n",
+        name, counter.Tokens / 2, analyzed, allocations - analyzed);
+    return allocations == 0 && counter.Tokens && batched && counter.Errors;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    const string corpus = Corpus();
+    bool passed = true;
+    try
+    {
+        Lex::Lexer<TokenID, string, Lex::Regex> lex;
+        Define(lex);
+        passed &= Check("lazy DFA", lex, corpus);
+        lex.setLinearTime(true);
+        passed &= Check("lazy DFA, linear time", lex, corpus);
+        lex.setLinearTime(false);
+
+        if (!lex.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+        passed &= Check("compiled", lex, corpus);
+        lex.setLinearTime(true);
+        passed &= Check("compiled, linear time", lex, corpus);
+
+        Lex::Lexer<TokenID, string, Lex::Utf8Regex> utf8;
+        Define(utf8);
+        utf8.compile();
+        passed &= Check("UTF-8, compiled", utf8, corpus);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks relex() against tokenize(). Chains of random edits are made to a 
+// text, and after each one the tokens relex() brings up to date must be the
+// tokens tokenize() finds in the new text, locations and lookahead included.
+// The grammar has tokens that read past their end, comments that span lines
+// and characters that nothing matches, so that edits change tokens well 
+// before and after them. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+typedef Lexer::token_type Token;
+
+bool Same(const vector<Token>& a, const vector<Token>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].ID != b[i].ID || 
+            a[i].Where.global != b[i].Where.global ||
+            a[i].Where.line_number != b[i].Where.line_number ||
+            a[i].Where.within_line != b[i].Where.within_line ||
+            a[i].Length != b[i].Length ||
+            a[i].Lookahead != b[i].Lookahead)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// A random string of n pieces that the grammar finds interesting
+//-----------------------------------------------------------------------------
+string Pieces(unsigned& seed, size_t n)
+{
+    static const char* const c_pieces[] = {
+        "a", "aa", "b", "aaab", "word", " ", "\n", "/*", "*/", "x/*y\nz*/", 
+        "12", "@", "\"", "\"s\""
+    };
+    string text;
+    for (size_t i = 0; i < n; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+    }
+    return text;
+}
+
+bool Check(const char* name, const Lexer& lex)
+{
+    const int c_chains = 40;
+    const int c_edits = 50;
+
+    auto ignore = [](const Lex::Location&) {};
+    unsigned seed = 1;
+    bool passed = true;
+    size_t relexed = 0;
+    size_t total = 0;
+    for (int chain = 0; passed && chain < c_chains; ++chain)
+    {
+        string text = Pieces(seed, 300);
+        vector<Token> tokens;
+        lex.tokenize(text, tokens, ignore);
+        for (int edit = 0; passed && edit < c_edits; ++edit)
+        {
+            seed = seed * 1103515245 + 12345;
+            const size_t offset = (seed >> 8) % (text.size() + 1);
+            seed = seed * 1103515245 + 12345;
+            const size_t removed = min<size_t>((seed >> 16) % 6, text.size() - offset);
+            const string inserted = Pieces(seed, (seed >> 12) % 3);
+            text.replace(offset, removed, inserted);
+
+            relexed += lex.relex(text, offset, removed, inserted, tokens, ignore);
+            total += tokens.size();
+
+            vector<Token> expected;
+            lex.tokenize(text, expected, ignore);
+            passed = Same(tokens, expected);
+        }
+    }
+    printf("%-20s %s, %zu of %zu tokens analyzed again\n", name, 
+        passed ? "ok" : "different tokens", relexed, total);
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer lex;
+        lex.define(1, "a*b");
+        lex.define(2, "a");
+        lex.define(3, "[a-z]+");
+        lex.defineDelimited(4, "/*", "*/", 0, true);
+        lex.defineDelimited(5, "\"", "\"", '\\');
+        lex.define(6, "[0-9]+");
+        lex.define(7, "[ \\n]+");
+        passed &= Check("lazy DFA", lex);
+
+        Lexer compiled = lex;
+        if (!compiled.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+        passed &= Check("compiled", compiled);
+
+        Lexer linear = compiled;
+        linear.setLinearTime(true);
+        passed &= Check("linear time", linear);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks the events a RingTrace records against what analyze() reports. 
+// Each analysis must record one chunk, an attempt for every token and 
+// error, a match with the offset, length and definition of every token and
+// an error at the offset of every error, on the ring of the thread that 
+// ran it. A ring that is too small must keep only the newest events, and 
+// clear() must forget them. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../LexTrace.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::RingTrace<1 << 20> Trace;
+typedef Lex::RingTrace<64> SmallTrace;
+typedef Lex::Lexer<int, string, Lex::Regex, Trace> Lexer;
+typedef Lex::Lexer<int, string, Lex::Regex, SmallTrace> SmallLexer;
+
+//-----------------------------------------------------------------------------
+// The events analyze() should make the trace record
+//-----------------------------------------------------------------------------
+struct Recorder
+{
+    vector<Lex::TraceEvent> Events;
+
+    void operator()(const Lex::Location& location, const int& id, 
+        string::const_iterator begin, string::const_iterator end)
+    {
+        Lex::TraceEvent attempt = { 0, location.global, 0, 0, 0, Lex::TraceAttempt };
+        Lex::TraceEvent match = { 0, location.global, size_t(end - begin), 
+            uint32_t(id - 1), 0, Lex::TraceMatch };
+        Events.push_back(attempt);
+        Events.push_back(match);
+    }
+
+    void operator()(const Lex::Location& location)
+    {
+        Lex::TraceEvent attempt = { 0, location.global, 0, 0, 0, Lex::TraceAttempt };
+        Lex::TraceEvent error = { 0, location.global, 0, 0, 0, Lex::TraceError };
+        Events.push_back(attempt);
+        Events.push_back(error);
+    }
+};
+
+//-----------------------------------------------------------------------------
+// Lines of words, numbers and comments, with the odd character nothing 
+// matches
+//-----------------------------------------------------------------------------
+string MakeText(size_t size)
+{
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "123", "4.5", "==", "+", "\n", "  ", "@", 
+        "/* one */", "/* two\nlines */"
+    };
+    string text;
+    unsigned seed = 3;
+    while (text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+        text += ' ';
+    }
+    return text;
+}
+
+template<typename _Lexer>
+void Define(_Lexer& lex)
+{
+    lex.define(1, "[a-zA-Z_][a-zA-Z0-9_]*");
+    lex.define(2, "[0-9]+(\\.[0-9]+)?");
+    lex.define(3, "==|[=+]");
+    lex.defineDelimited(4, "/*", "*/");
+    lex.define(5, "[ \\n]+");
+}
+
+// The events analyze() reports for text, after the chunk that begins them
+vector<Lex::TraceEvent> Expected(const Lexer& lex, const string& text)
+{
+    Recorder recorder;
+    Lex::TraceEvent chunk = { 0, 0, text.size(), 0, 0, Lex::TraceChunk };
+    recorder.Events.push_back(chunk);
+    lex.analyze(text, recorder, recorder);
+    return recorder.Events;
+}
+
+// Whether events are expected in order, ignoring the time and thread
+bool Same(const Lex::TraceEvent* events, const Lex::TraceEvent* expected, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (events[i].Kind != expected[i].Kind ||
+            events[i].Offset != expected[i].Offset ||
+            events[i].Length != expected[i].Length ||
+            events[i].Definition != expected[i].Definition)
+        {
+            printf("event %zu differs\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Report(const char* name, bool passed)
+{
+    printf("%-20s %s\n", name, passed ? "ok" : "wrong events");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer lex;
+        Define(lex);
+        const string text = MakeText(16 * 1024);
+        const vector<Lex::TraceEvent> expected = Expected(lex, text);
+
+        size_t errors = 0;
+        for (auto& event : expected)
+            errors += event.Kind == Lex::TraceError;
+        if (errors < 10)
+        {
+            printf("the text has only %zu errors\n", errors);
+            return 1;
+        }
+
+        // One analysis on this thread
+        Trace::clear();
+        Recorder recorder;
+        lex.analyze(text, recorder, recorder);
+        vector<Lex::TraceEvent> events;
+        Trace::dump(events);
+        bool ordered = true;
+        for (size_t i = 1; i < events.size(); ++i)
+            ordered &= events[i - 1].Time <= events[i].Time;
+        passed &= Report("one thread", events.size() == expected.size() && 
+            ordered && Same(events.data(), expected.data(), expected.size()));
+
+        // clear() forgets them
+        Trace::clear();
+        events.clear();
+        Trace::dump(events);
+        passed &= Report("clear", events.empty());
+
+        // Analyses on other threads are recorded on their own rings
+        const size_t c_threads = 4;
+        vector<thread> threads;
+        for (size_t i = 0; i < c_threads; ++i)
+        {
+            threads.emplace_back([&lex, &text]()
+            {
+                Recorder recorder;
+                lex.analyze(text, recorder, recorder);
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        Trace::dump(events);
+        bool threaded = events.size() == c_threads * expected.size();
+        for (uint16_t id = 1; threaded && id <= c_threads; ++id)
+        {
+            vector<Lex::TraceEvent> own;
+            for (auto& event : events)
+            {
+                if (event.Thread == id)
+                    own.push_back(event);
+            }
+            threaded = own.size() == expected.size() && 
+                Same(own.data(), expected.data(), expected.size());
+        }
+        passed &= Report("threads", threaded);
+
+        // A small ring keeps the newest events, less the one that may be 
+        // being written
+        SmallLexer small;
+        Define(small);
+        small.analyze(text, recorder, recorder);
+        events.clear();
+        SmallTrace::dump(events);
+        passed &= Report("overwritten", events.size() == 63 && 
+            Same(events.data(), expected.data() + expected.size() - 63, 63));
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that a compiled Lexer survives serialize() and attach(), and 
+// saveLexer() and loadLexer(), with every kind of definition: the attached
+// Lexer must find the same tokens as the original and serialize to the same
+// image. Truncated images and images written for another kind of Lexer must
+// be refused, and images with a flipped bit must be refused or lex safely.
+// A definition added after attaching must be compiled in. Exits with 0 on
+// success.
+//-----------------------------------------------------------------------------
+#include "../LexFile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+typedef Lexer::token_type Token;
+
+bool Same(const vector<Token>& a, const vector<Token>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].ID != b[i].ID || 
+            a[i].Where.global != b[i].Where.global ||
+            a[i].Where.line_number != b[i].Where.line_number ||
+            a[i].Where.within_line != b[i].Where.within_line ||
+            a[i].Length != b[i].Length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<Token> Tokenize(const Lexer& lex, const string& text)
+{
+    auto ignore = [](const Lex::Location&) {};
+    vector<Token> tokens;
+    lex.tokenize(text, tokens, ignore);
+    return tokens;
+}
+
+//-----------------------------------------------------------------------------
+// An image copied into 8-byte aligned memory, as attach() needs
+//-----------------------------------------------------------------------------
+struct Aligned
+{
+    explicit Aligned(const vector<uint8_t>& image, size_t size)
+        : Words((size + 7) / 8)
+    {
+        if (size)
+            memcpy(Words.data(), image.data(), size);
+    }
+
+    vector<uint64_t> Words;
+};
+
+bool Report(const char* name, bool passed)
+{
+    printf("%-36s %s\n", name, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer lex;
+        lex.define(1, "[a-zA-Z_][a-zA-Z0-9_]*", { { "while", 10 }, { "if", 11 }, { "else", 12 } });
+        lex.defineNumber(2, Lex::NumberFloat);
+        lex.defineNumber(3, Lex::NumberDecimal | Lex::NumberHex);
+        lex.defineDelimited(4, "/*", "*/", 0, true);
+        lex.defineDelimited(5, "\"", "\"", '\\');
+        lex.define(6, "==|[=+;(){}]");
+        lex.define(7, "[ \\t\\n]+");
+        if (!lex.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+
+        const string text = 
+            "while (x1 == 0x1F) { y = 4.5e3 + 12; /* a\ncomment */ }\n"
+            "if (s == \"q\\\"uote\") else_ = 7.; @ elsewhere\n";
+        const vector<Token> expected = Tokenize(lex, text);
+
+        vector<uint8_t> image;
+        passed &= Report("serialize", lex.serialize(image));
+
+        // Round trip through memory
+        Aligned aligned(image, image.size());
+        Lexer attached;
+        bool ok = attached.attach(aligned.Words.data(), image.size());
+        vector<uint8_t> again;
+        ok = ok && Same(Tokenize(attached, text), expected) && 
+            attached.serialize(again) && again == image;
+        passed &= Report("attach", ok);
+
+        // A copy shares the attached tables
+        Lexer copy = attached;
+        passed &= Report("copy of attached", Same(Tokenize(copy, text), expected));
+
+        // Round trip through a file
+        const string path = (filesystem::temp_directory_path() / ("luthor-saveload-" + 
+            to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".lex")).string();
+        Lexer loaded;
+        ok = Lex::saveLexer(lex, path.c_str()) && Lex::loadLexer(loaded, path.c_str());
+        passed &= Report("saveLexer and loadLexer", ok && Same(Tokenize(loaded, text), expected));
+        remove(path.c_str());
+        Lexer missing;
+        passed &= Report("loadLexer of a missing file", !Lex::loadLexer(missing, path.c_str()));
+
+        // Every truncation is refused
+        ok = true;
+        for (size_t size = 0; size < image.size(); ++size)
+        {
+            Aligned truncated(image, size);
+            Lexer refused;
+            ok &= !refused.attach(truncated.Words.data(), size);
+        }
+        passed &= Report("truncated images refused", ok);
+
+        // A flipped bit is refused, or lexes without going out of bounds
+        size_t accepted = 0;
+        for (size_t bit = 0; bit < image.size() * 8; ++bit)
+        {
+            Aligned flipped(image, image.size());
+            reinterpret_cast<uint8_t*>(flipped.Words.data())[bit / 8] ^= uint8_t(1 << (bit % 8));
+            Lexer lexer;
+            if (lexer.attach(flipped.Words.data(), image.size()))
+            {
+                Tokenize(lexer, text);
+                ++accepted;
+            }
+        }
+        printf("flipped bits accepted: %zu of %zu\n", accepted, image.size() * 8);
+
+        // Images for other kinds of Lexer are refused
+        Lex::Lexer<int, string, Lex::Utf8Regex> utf8;
+        Lex::Lexer<long long, string, Lex::Regex> wideIds;
+        passed &= Report("other encoding refused", !utf8.attach(aligned.Words.data(), image.size()));
+        passed &= Report("other token type refused", !wideIds.attach(aligned.Words.data(), image.size()));
+
+        // Defining more after attaching compiles the patterns again
+        attached.define(8, "@");
+        ok = attached.compile();
+        vector<Token> extended = Tokenize(attached, text);
+        size_t at = 0;
+        for (auto& token : extended)
+            at += token.ID == 8;
+        passed &= Report("define after attach", ok && at == 1 && extended.size() == expected.size() + 1);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that one Lexer that hasn't been compiled, and so builds its DFA 
+// lazily as it goes, can be used by several analyses at once: an analysis
+// started from inside another's onMatch, and threads analyzing the same text
+// together with a DFA memory limit small enough that they flush each other's
+// cache. Every analysis must see the tokens a compiled copy sees. Exits with 
+// 0 on success.
+//-----------------------------------------------------------------------------
+#include "../Lex.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+
+//-----------------------------------------------------------------------------
+// Each token as its identifier, offset and length
+//-----------------------------------------------------------------------------
+struct Token
+{
+    int ID;
+    size_t Offset;
+    size_t Length;
+
+    bool operator ==(const Token& other) const
+    {
+        return ID == other.ID && Offset == other.Offset && Length == other.Length;
+    }
+};
+
+vector<Token> Analyze(const Lexer& lex, const string& text)
+{
+    vector<Token> tokens;
+    auto onMatch = [&](const Lex::Location& location, const int& id, 
+        string::const_iterator begin, string::const_iterator end)
+    {
+        Token token = { id, location.global, size_t(end - begin) };
+        tokens.push_back(token);
+    };
+    auto onError = [&](const Lex::Location& location)
+    {
+        Token token = { -1, location.global, 0 };
+        tokens.push_back(token);
+    };
+    lex.analyze(text, onMatch, onError);
+    return tokens;
+}
+
+//-----------------------------------------------------------------------------
+// A text that visits many DFA states: words, numbers and operators of many
+// lengths, with the odd character nothing matches
+//-----------------------------------------------------------------------------
+string MakeText(size_t size)
+{
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "while", "whilst", "x", "123", "4.5e6", "0x1F",
+        "==", "=", "+", "+=", "/* note */", "\"str\\\"ing\"", "  ", "\n", "@"
+    };
+    string text;
+    unsigned seed = 12345;
+    while (text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+        text += ' ';
+    }
+    return text;
+}
+
+void Define(Lexer& lex)
+{
+    lex.define(1, "while");
+    lex.define(2, "[a-zA-Z_][a-zA-Z0-9_]*");
+    lex.define(3, "0x[0-9a-fA-F]+");
+    lex.define(4, "[0-9]+(\\.[0-9]+)?([eE][+-]?[0-9]+)?");
+    lex.define(5, "/\\*([^*]|\\*+[^*/])*\\*+/");
+    lex.define(6, "\"([^\"\\\\]|\\\\.)*\"");
+    lex.define(7, "==|\\+=|[=+]");
+    lex.define(8, "[ \\t\\n]+");
+}
+
+//-----------------------------------------------------------------------------
+// Analyze text again from inside onMatch, which deadlocked while an analysis
+// held the Lexer's lock throughout
+//-----------------------------------------------------------------------------
+bool CheckNested(const Lexer& lex, const string& text, const vector<Token>& expected)
+{
+    bool passed = true;
+    size_t outer = 0;
+    auto onMatch = [&](const Lex::Location&, const int&, 
+        string::const_iterator, string::const_iterator)
+    {
+        if (outer++ % 500 == 0)
+            passed &= Analyze(lex, text) == expected;
+    };
+    auto onError = [](const Lex::Location&) {};
+    lex.analyze(text, onMatch, onError);
+    printf("nested analyses: %s\n", passed ? "ok" : "different tokens");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+// Analyze text on several threads at once, a few times each
+//-----------------------------------------------------------------------------
+bool CheckThreads(const char* name, const Lexer& lex, const string& text, 
+    const vector<Token>& expected)
+{
+    const int c_threads = 4;
+    const int c_runs = 3;
+
+    vector<char> passed(c_threads, 0);
+    vector<thread> threads;
+    for (int t = 0; t < c_threads; ++t)
+    {
+        threads.emplace_back([&, t]
+        {
+            bool same = true;
+            for (int run = 0; run < c_runs; ++run)
+                same &= Analyze(lex, text) == expected;
+            passed[t] = same;
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    bool all = true;
+    for (char p : passed)
+        all &= p != 0;
+    printf("%-32s %s\n", name, all ? "ok" : "different tokens");
+    return all;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        const string text = MakeText(200 * 1024);
+
+        Lexer compiled;
+        Define(compiled);
+        if (!compiled.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+        const vector<Token> expected = Analyze(compiled, text);
+
+        Lexer lazy;
+        Define(lazy);
+        passed &= CheckNested(lazy, text, expected);
+        passed &= CheckThreads("threads, lazy DFA", lazy, text, expected);
+
+        // Small enough to flush, and to fall back to simulation
+        Lexer small;
+        Define(small);
+        small.setDfaMemoryLimit(4 * 1024);
+        passed &= CheckThreads("threads, flushing lazy DFA", small, text, expected);
+
+        Lexer linear;
+        Define(linear);
+        linear.setDfaMemoryLimit(4 * 1024);
+        linear.setLinearTime(true);
+        passed &= CheckThreads("threads, flushing linear time", linear, text, expected);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks analyzeAvailable() on text that arrives a piece at a time. Fed in
+// chunks of many sizes, it must deliver the tokens analyzeBatched() does, and
+// report errors at the locations analyze() does. Its time per byte must not
+// grow with the length of a line, as it did while each call read back to the
+// start of the line. A Pipeline reading in small chunks must deliver the same
+// tokens too. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../LexPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+typedef Lexer::record_type Record;
+
+//-----------------------------------------------------------------------------
+// What was lexed from a text: its token records and its errors
+//-----------------------------------------------------------------------------
+struct Lexed
+{
+    vector<Record> Tokens;
+    vector<Lex::Location> Errors;
+
+    bool operator ==(const Lexed& other) const
+    {
+        if (Tokens.size() != other.Tokens.size() || Errors.size() != other.Errors.size())
+            return false;
+        for (size_t i = 0; i < Tokens.size(); ++i)
+        {
+            const Record& a = Tokens[i];
+            const Record& b = other.Tokens[i];
+            if (a.ID != b.ID || a.Offset != b.Offset || 
+                a.Length != b.Length || a.Line != b.Line)
+            {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < Errors.size(); ++i)
+        {
+            const Lex::Location& a = Errors[i];
+            const Lex::Location& b = other.Errors[i];
+            if (a.line_number != b.line_number || a.within_line != b.within_line || 
+                a.global != b.global)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+//-----------------------------------------------------------------------------
+// The tokens of analyzeBatched() and the errors of analyze(), which counts 
+// columns without analyzeAvailable()'s help
+//-----------------------------------------------------------------------------
+Lexed Expected(const Lexer& lex, const string& text)
+{
+    Lexed lexed;
+    auto onBatch = [&](Lex::Span<Record> tokens)
+    {
+        lexed.Tokens.insert(lexed.Tokens.end(), tokens.begin(), tokens.end());
+    };
+    auto ignore = [](const Lex::Location&) {};
+    lex.analyzeBatched(text, onBatch, ignore);
+
+    auto onMatch = [](const Lex::Location&, const int&, 
+        string::const_iterator, string::const_iterator) {};
+    auto onError = [&](const Lex::Location& location)
+    {
+        lexed.Errors.push_back(location);
+    };
+    lex.analyze(text, onMatch, onError);
+    return lexed;
+}
+
+//-----------------------------------------------------------------------------
+// Feed text to analyzeAvailable() chunk bytes at a time
+//-----------------------------------------------------------------------------
+Lexed Stream(const Lexer& lex, const string& text, size_t chunk)
+{
+    Lexed lexed;
+    auto onBatch = [&](Lex::Span<Record> tokens)
+    {
+        lexed.Tokens.insert(lexed.Tokens.end(), tokens.begin(), tokens.end());
+    };
+    auto onError = [&](const Lex::Location& location)
+    {
+        lexed.Errors.push_back(location);
+    };
+
+    Lexer::context_type context;
+    Lex::Location where = { 1, 1, 0 };
+    size_t available = 0;
+    do
+    {
+        available = min(available + chunk, text.size());
+        lex.analyzeAvailable(text, where, available, available == text.size(), 
+            onBatch, onError, context);
+    } while (available < text.size());
+    return lexed;
+}
+
+//-----------------------------------------------------------------------------
+// Lines of words, numbers and operators of many lengths, one of them very 
+// long, with the odd character nothing matches
+//-----------------------------------------------------------------------------
+string MakeText(size_t size, unsigned seed, bool newlines)
+{
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "while", "x", "123", "4.5", "==", "+", "\n", "  ", "@"
+    };
+    const size_t c_pieceCount = sizeof(c_pieces) / sizeof(c_pieces[0]);
+    string text;
+    while (text.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        const char* piece = c_pieces[(seed >> 16) % c_pieceCount];
+        if (newlines || *piece != '\n')
+            text += piece;
+        text += ' ';
+    }
+    text.resize(size);
+    return text;
+}
+
+void Define(Lexer& lex)
+{
+    lex.define(1, "while");
+    lex.define(2, "[a-zA-Z_][a-zA-Z0-9_]*");
+    lex.define(3, "[0-9]+(\\.[0-9]+)?");
+    lex.define(4, "==|[=+]");
+    lex.define(5, "[ \\n]+");
+}
+
+bool CheckChunks(const char* name, const Lexer& lex, const string& text)
+{
+    const Lexed expected = Expected(lex, text);
+    bool passed = !expected.Errors.empty();
+    for (size_t chunk : { 1, 7, 64, 4096 })
+        passed &= Stream(lex, text, chunk) == expected;
+    printf("%-36s %s\n", name, passed ? "ok" : "different tokens");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+// Stream lines that keep growing in 64-byte chunks, and check that the time
+// per byte of the longest is within a small factor of the shortest's
+//-----------------------------------------------------------------------------
+bool CheckLongLines(const Lexer& lex)
+{
+    const size_t c_shortest = 128 * 1024;
+    const size_t c_longest = 16 * c_shortest;
+    const double c_allowedGrowth = 4;
+
+    double shortest = 0;
+    double longest = 0;
+    for (size_t size = c_shortest; size <= c_longest; size *= 4)
+    {
+        const string text = MakeText(size, 7, false);
+        double best = 1e9;
+        for (int run = 0; run < 3; ++run)
+        {
+            auto start = chrono::steady_clock::now();
+            Stream(lex, text, 64);
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        const double perByte = best / size;
+        printf("one line of %8zu bytes, 64 at a time: %6.2f ns/byte\n", size, perByte * 1e9);
+        if (size == c_shortest)
+            shortest = perByte;
+        longest = perByte;
+    }
+    return longest <= c_allowedGrowth * shortest;
+}
+
+//-----------------------------------------------------------------------------
+// Run a Pipeline that reads 64 bytes at a time over text in a file
+//-----------------------------------------------------------------------------
+bool CheckPipeline(const Lexer& lex, const string& text)
+{
+    const auto path = filesystem::temp_directory_path() / ("luthor-streaming-" + 
+        to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".txt");
+    ofstream(path, ios::binary) << text;
+
+    Lex::PipelineOptions options;
+    options.ChunkSize = 64;
+    options.RingSize = 1024;
+    Lex::Pipeline<Lexer> pipeline(lex, options);
+    Lexed lexed;
+    auto onBatch = [&](Lex::Span<Record> tokens)
+    {
+        lexed.Tokens.insert(lexed.Tokens.end(), tokens.begin(), tokens.end());
+    };
+    auto onError = [&](const Lex::Location& location)
+    {
+        lexed.Errors.push_back(location);
+    };
+    const bool ran = pipeline.run(path.string().c_str(), onBatch, onError);
+    error_code ignored;
+    filesystem::remove(path, ignored);
+
+    const bool passed = ran && lexed == Expected(lex, text);
+    printf("%-36s %s\n", "pipeline, 64-byte reads", passed ? "ok" : "different tokens");
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        Lexer lazy;
+        Define(lazy);
+        Lexer compiled;
+        Define(compiled);
+        if (!compiled.compile())
+        {
+            printf("compile() failed\n");
+            return 1;
+        }
+
+        const string lines = MakeText(64 * 1024, 1, true);
+        const string line = MakeText(64 * 1024, 2, false);
+        passed &= CheckChunks("many lines, lazy DFA", lazy, lines);
+        passed &= CheckChunks("many lines, compiled", compiled, lines);
+        passed &= CheckChunks("one line, compiled", compiled, line);
+        passed &= CheckLongLines(compiled);
+        passed &= CheckPipeline(compiled, lines);
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+/*
+    ---------------------------------------------------------------------------
+    LUTHOR: a quick-n-dirty lexical analysis library for tokenizing a character
+    stream using regular expressions.
+    ---------------------------------------------------------------------------
+	
+    Copyright (C) 2013 Peter J. B. Lewis
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+//-----------------------------------------------------------------------------
+// Checks that token streams give back the tokens written to them. Tokens 
+// from analyzeBatched(), and made-up ones with big gaps and lines that go
+// backwards, are written with blocks of several sizes; reading the whole
+// stream, seeking to any token and seeking to any offset must find the same
+// tokens. Truncated streams must be refused or end early as corrupt, and
+// identifiers out of range must be refused. Exits with 0 on success.
+//-----------------------------------------------------------------------------
+#include "../LexTokenStream.h"
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef Lex::Lexer<int, string, Lex::Regex> Lexer;
+typedef Lexer::record_type Record;
+
+bool Same(const Record& a, const Record& b)
+{
+    return a.ID == b.ID && a.Offset == b.Offset && a.Length == b.Length && a.Line == b.Line;
+}
+
+string Write(const vector<Record>& records, size_t blockTokens)
+{
+    ostringstream out;
+    Lex::TokenStreamWriter<int> writer(out, blockTokens);
+    writer.write(Lex::Span<Record>(records.data(), records.size()));
+    if (!writer.finish() || writer.tokens() != records.size() || writer.bytes() != out.str().size())
+        throw runtime_error("finish() failed");
+    return out.str();
+}
+
+//-----------------------------------------------------------------------------
+// Read a stream back whole, then from random tokens and offsets
+//-----------------------------------------------------------------------------
+bool Check(const char* name, const vector<Record>& records, size_t blockTokens)
+{
+    const string stream = Write(records, blockTokens);
+    Lex::TokenStreamReader<int> reader;
+    bool passed = reader.open(stream.data(), stream.size()) && reader.size() == records.size();
+
+    Record token;
+    for (size_t i = 0; passed && i < records.size(); ++i)
+        passed = reader.position() == i && reader.next(token) && Same(token, records[i]);
+    passed &= !reader.next(token) && !reader.corrupt();
+
+    unsigned seed = 3;
+    for (int seek = 0; passed && seek < 200; ++seek)
+    {
+        seed = seed * 1103515245 + 12345;
+        const size_t index = (seed >> 8) % (records.size() + 2);
+        reader.seek(index);
+        for (size_t i = index; passed && i < min(index + 3, records.size()); ++i)
+            passed = reader.next(token) && Same(token, records[i]);
+        if (index >= records.size())
+            passed &= !reader.next(token);
+    }
+
+    const size_t textEnd = records.empty() ? 0 : records.back().Offset + records.back().Length;
+    for (int seek = 0; passed && seek < 200; ++seek)
+    {
+        seed = seed * 1103515245 + 12345;
+        const size_t offset = (seed >> 8) % (textEnd + 2);
+        size_t first = 0;
+        while (first < records.size() && records[first].Offset + records[first].Length <= offset)
+            ++first;
+        reader.seekOffset(offset);
+        passed = first < records.size() ? 
+            reader.next(token) && Same(token, records[first]) : 
+            !reader.next(token);
+    }
+
+    // A truncated stream is refused, or ends early as corrupt
+    for (size_t size = 0; passed && size < stream.size(); size += 1 + size / 16)
+    {
+        Lex::TokenStreamReader<int> truncated;
+        if (!truncated.open(stream.data(), size))
+            continue;
+        size_t read = 0;
+        while (truncated.next(token))
+            ++read;
+        passed = read < records.size() ? truncated.corrupt() : read == records.size();
+    }
+
+    printf("%-34s %3zu per block: %s, %.2f bytes per token\n", name, blockTokens,
+        passed ? "ok" : "different tokens", 
+        records.empty() ? 0.0 : double(stream.size()) / records.size());
+    return passed;
+}
+
+//-----------------------------------------------------------------------------
+// Tokens from analyzeBatched() over lines of code with errors in them
+//-----------------------------------------------------------------------------
+vector<Record> Lexed()
+{
+    Lexer lex;
+    lex.define(1, "[a-zA-Z_][a-zA-Z0-9_]*");
+    lex.defineNumber(2);
+    lex.defineDelimited(3, "/*", "*/", 0, true);
+    lex.define(4, "==|[=+;(){}]");
+    lex.define(5, "[ \\n]+");
+
+    static const char* const c_pieces[] = {
+        "alpha", "b2", "123", "4.5", "==", "+", "\n", "  ", "@", "/* a\nb */", 
+        "{", "}", "\n\n\n"
+    };
+    string text;
+    unsigned seed = 8;
+    while (text.size() < 100 * 1024)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += c_pieces[(seed >> 16) % (sizeof(c_pieces) / sizeof(c_pieces[0]))];
+    }
+
+    vector<Record> records;
+    auto onBatch = [&](Lex::Span<Record> tokens)
+    {
+        records.insert(records.end(), tokens.begin(), tokens.end());
+    };
+    auto ignore = [](const Lex::Location&) {};
+    lex.analyzeBatched(text, onBatch, ignore);
+    return records;
+}
+
+//-----------------------------------------------------------------------------
+// Tokens that no Lexer would make: empty, huge, far apart, on lines that 
+// jump back and forth, with large identifiers
+//-----------------------------------------------------------------------------
+vector<Record> MadeUp()
+{
+    vector<Record> records;
+    unsigned seed = 11;
+    size_t offset = 0;
+    for (int i = 0; i < 5000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        Record record;
+        record.ID = int(seed >> 1) & 0x7FFFFFFF;
+        record.Offset = offset;
+        record.Length = i % 97 == 0 ? 0xFFFFFFFFu : (seed >> 20) % 50;
+        record.Line = (seed >> 4) % 1000;
+        records.push_back(record);
+        offset += size_t(record.Length) + ((seed >> 10) % 5 == 0 ? (seed >> 8) % 100000 : (seed >> 16) % 3);
+    }
+    return records;
+}
+
+//-----------------------------------------------------------------------------
+int main()
+{
+    bool passed = true;
+    try
+    {
+        const vector<Record> lexed = Lexed();
+        const vector<Record> madeUp = MadeUp();
+        for (size_t blockTokens : { 1, 7, 256 })
+        {
+            passed &= Check("analyzeBatched() tokens", lexed, blockTokens);
+            passed &= Check("made-up tokens", madeUp, blockTokens);
+        }
+        passed &= Check("no tokens", vector<Record>(), 256);
+
+        ostringstream out;
+        Lex::TokenStreamWriter<int> writer(out);
+        Record negative = { -1, 0, 1, 1 };
+        bool threw = false;
+        try
+        {
+            writer.write(negative);
+        }
+        catch (const invalid_argument&)
+        {
+            threw = true;
+        }
+        printf("negative identifier refused: %s\n", threw ? "ok" : "FAILED");
+        passed &= threw;
+    }
+    catch (const exception& ex)
+    {
+        printf("EXCEPTION: %s\n", ex.what());
+        return 1;
+    }
+
+    printf(passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}